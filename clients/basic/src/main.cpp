@@ -10,32 +10,167 @@
 #include <sys/types.h>
 #include <netinet/ip.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <unistd.h>
 
 #include <boost/program_options.hpp>
 #include <boost/program_options/errors.hpp>
 #include <boost/program_options/option.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstring>
+#include <mutex>
 #include <string>
 #include <iostream>
 #include <stdexcept>
 #include <thread>
 #include <future>
+#include <vector>
 
 #include "packets.hpp"
 
 namespace po = boost::program_options;
 using namespace network;
 
-void sendPacket(int socket, serverbound::PacketType type, void *data, size_t size)
+std::mutex socketMutex;
+
+void appendPacket(std::vector<uint8_t>& buffer, serverbound::PacketType type, void *data, size_t size)
 {
 	serverbound::BasicHeader header{.type = type, .size = size};
-	::send(socket, &header, sizeof(header), 0);
-	::send(socket, data, size, 0);
+	const uint8_t* h = reinterpret_cast<const uint8_t*>(&header);
+	const uint8_t* d = reinterpret_cast<const uint8_t*>(data);
+	buffer.insert(buffer.end(), h, h+sizeof(header));
+	buffer.insert(buffer.end(), d, d+size);
 }
 
+void sendBuffer(int socket, const std::vector<uint8_t>& buffer)
+{
+	std::scoped_lock lock(socketMutex);
+	size_t sent = 0;
+	while(sent < buffer.size())
+	{
+		ssize_t n = ::send(socket, buffer.data()+sent, buffer.size()-sent, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+		{
+			std::cerr << "Failed to send: " << std::strerror(errno) << std::endl;
+			return;
+		}
+		sent += n;
+	}
+}
+
+void sendPacket(int socket, serverbound::PacketType type, void *data, size_t size)
+{
+	std::vector<uint8_t> buffer;
+	appendPacket(buffer, type, data, size);
+	sendBuffer(socket, buffer);
+}
+
+// maps a raw axis value to [-1, 1] with everything inside the deadzone mapped to 0
+float filterAxis(int16_t raw, float deadzone)
+{
+	float v = raw/((float)INT16_MAX);
+	float a = std::abs(v);
+	if(a <= deadzone)
+		return 0.0f;
+	return std::copysign(std::min(1.0f, (a-deadzone)/(1.0f-deadzone)), v);
+}
+
+// same as filterAxis, but uses the length of the stick vector, so diagonals are not cut off
+std::pair<float, float> filterStick(int16_t rawX, int16_t rawY, float deadzone)
+{
+	float x = rawX/((float)INT16_MAX);
+	float y = rawY/((float)INT16_MAX);
+	float length = std::sqrt(x*x + y*y);
+	if(length <= deadzone)
+		return {0.0f, 0.0f};
+	float scale = std::min(1.0f, (length-deadzone)/(1.0f-deadzone)) / length;
+	return {x*scale, y*scale};
+}
+
+struct InputState
+{
+	std::atomic<int16_t> dx = 0;
+	std::atomic<int16_t> dy = 0;
+	std::atomic<int16_t> dz = 0;
+
+	std::atomic<int16_t> rx = 0;
+	std::atomic<int16_t> ry = 0;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+};
+
+class send_stats
+{
+	public:
+		send_stats(std::chrono::microseconds tick) : m_tick(tick) {}
+
+		void sent(std::chrono::steady_clock::time_point time)
+		{
+			if(m_count > 0)
+			{
+				double interval = std::chrono::duration<double, std::micro>(time - m_last).count();
+				m_sum += interval;
+				m_sumSquared += interval*interval;
+				m_maxDeviation = std::max(m_maxDeviation, std::abs(interval - m_tick.count()));
+				m_intervals++;
+			}
+			else
+			{
+				m_start = time;
+			}
+			m_last = time;
+			m_count++;
+
+			if(time - m_start >= std::chrono::seconds(1))
+				report(time);
+		}
+
+		// an idle phase is not jitter, so the next packet starts a new measurement
+		void idle()
+		{
+			m_last = {};
+			m_intervals = 0;
+			m_sum = m_sumSquared = 0.0;
+			m_maxDeviation = 0.0;
+			m_count = 0;
+		}
+	private:
+		void report(std::chrono::steady_clock::time_point time)
+		{
+			double seconds = std::chrono::duration<double>(time - m_start).count();
+			double mean = m_intervals > 0 ? m_sum / m_intervals : 0.0;
+			double variance = m_intervals > 0 ? m_sumSquared / m_intervals - mean*mean : 0.0;
+			std::cout << "send rate: " << (m_count-1)/seconds << " Hz"
+				<< ", mean interval: " << mean << " us"
+				<< ", jitter: " << std::sqrt(std::max(0.0, variance)) << " us"
+				<< ", max deviation: " << m_maxDeviation << " us" << std::endl;
+
+			idle();
+			m_start = m_last = time;
+			m_count = 1;
+		}
+
+		std::chrono::microseconds m_tick;
+		std::chrono::steady_clock::time_point m_start;
+		std::chrono::steady_clock::time_point m_last;
+		size_t m_count = 0;
+		size_t m_intervals = 0;
+		double m_sum = 0.0;
+		double m_sumSquared = 0.0;
+		double m_maxDeviation = 0.0;
+};
+
 int main(int argc, char* argv[])
 {
 	std::string hostname;
@@ -45,6 +180,9 @@ int main(int argc, char* argv[])
 	std::string playerName = "anonymous";
 	std::string companion;
 
+	int tickRate = 120;
+	float deadzone = 0.1f;
+
 	po::options_description options("Options");
     options.add_options()("help", "print this help message");
     options.add_options()("server", po::value<std::string>(&hostname)->value_name("hostname")->required(), "server to connect to");
@@ -53,6 +191,10 @@ int main(int argc, char* argv[])
     options.add_options()("list_controllers", "list connected controllers");
 	options.add_options()("playername", po::value<std::string>(&playerName)->value_name("playername"), "your name");
 	options.add_options()("companion", po::value<std::string>(&companion)->value_name("companion")->required(), "companion to use");
+	options.add_options()("tick_rate", po::value<int>(&tickRate)->value_name("hz")->default_value(tickRate), "rate at which input is sent while a stick is deflected");
+	options.add_options()("deadzone", po::value<float>(&deadzone)->value_name("fraction")->default_value(deadzone), "axis deflection (0 to 1) below which input is ignored");
+	options.add_options()("stats", "report achieved send rate and jitter once per second");
+	options.add_options()("verbose", "print every controller event");
 	
 	po::variables_map vm;
 	try 
@@ -74,6 +216,14 @@ int main(int argc, char* argv[])
     	std::cout << options << std::endl;
     	return 0;
 	}
+	// a tick is a whole number of microseconds
+	if(tickRate <= 0 || tickRate > 1000000 || deadzone < 0.0f || deadzone >= 1.0f)
+	{
+		std::cerr << "tick_rate must be in [1, 1000000] and deadzone must be in [0, 1)" << std::endl;
+		return 2;
+	}
+	bool stats = vm.count("stats");
+	bool verbose = vm.count("verbose");
 
 	if(SDL_Init(SDL_INIT_JOYSTICK | SDL_INIT_HAPTIC | SDL_INIT_GAMECONTROLLER) < 0)
 		throw std::runtime_error("failed to initialize SDL");
@@ -166,56 +316,91 @@ int main(int argc, char* argv[])
 		return 2;
 	}
 
+	int noDelay = 1;
+	if(setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) < 0)
+		std::cerr << "Failed to set TCP_NODELAY: " << std::strerror(errno) << std::endl;
+
 	serverbound::JoinPacket join{};
 	strncpy(join.name, playerName.c_str(), sizeof(join.name));
 	strncpy(join.companion, companion.c_str(), sizeof(join.name));
 	sendPacket(socket, serverbound::PacketType::Join, &join, sizeof(join));
 
-	std::promise<void> exitPromise;
-	std::shared_future<void> exitFuture = exitPromise.get_future();
+	InputState input;
+	std::atomic<bool> stop = false;
+	const std::chrono::microseconds tick(std::max(1, 1000000 / tickRate));
 
-	struct {
-		int16_t dx = 0;
-		int16_t dy = 0;
-		int16_t dz = 0;
+	std::thread t([&input, &stop, socket, tick, deadzone, stats](){
+		using clock = std::chrono::steady_clock;
+		const float dt = std::chrono::duration<float>(tick).count();
 
-		int16_t rx = 0;
-		int16_t ry = 0;
-	} rawData{};
-	struct {
 		float yaw = 0.0f;
-	} playerState{};
+		send_stats statistics(tick);
+		std::vector<uint8_t> buffer;
+		clock::time_point next = clock::now();
 
-	std::thread t([&exitFuture, &rawData, &playerState, socket](){
+		std::unique_lock lock(input.mutex);
 		for(;;)
 		{
-			if(rawData.dx != 0 || rawData.dy != 0 || rawData.dz != 0)
-			{
-				float ndx = rawData.dx/((float)INT16_MAX);
-				float ndy = rawData.dy/((float)INT16_MAX);
-				float ndz = rawData.dz/((float)INT16_MAX);
+			if(stop)
+				return;
 
-				float rdx = -ndy * std::cos(playerState.yaw) - ndx * std::sin(playerState.yaw);
-				float rdy = -ndy * std::sin(playerState.yaw) + ndx * std::cos(playerState.yaw);
+			auto [ndx, ndy] = filterStick(input.dx, input.dy, deadzone);
+			float ndz = filterAxis(input.dz, deadzone);
+			float nrx = filterAxis(input.rx, deadzone);
+			bool moving = ndx != 0.0f || ndy != 0.0f || ndz != 0.0f;
+			bool rotating = nrx != 0.0f;
 
-				serverbound::MovePacket move = { .dx = 0.01f*rdx, .dy = 0.01f*ndz, .dz = 0.01f*rdy};
-				sendPacket(socket, serverbound::PacketType::Move, &move, sizeof(move));
+			if(!moving && !rotating)
+			{
+				// nothing to send, so sleep until the event loop reports a change
+				statistics.idle();
+				input.changed.wait(lock);
+				if(stop)
+					return;
+				next = clock::now();
+				continue;
 			}
-			if(rawData.rx != 0 || rawData.ry != 0)
+
+			buffer.clear();
+			if(moving)
 			{
-				float nrx = rawData.rx/((float)INT16_MAX);
-				float nry = rawData.ry/((float)INT16_MAX);
+				float rdx = -ndy * std::cos(yaw) - ndx * std::sin(yaw);
+				float rdy = -ndy * std::sin(yaw) + ndx * std::cos(yaw);
 
-				playerState.yaw += nrx*0.01f;
-				serverbound::RotatePacket rotate = {.yaw = playerState.yaw};
-				sendPacket(socket, serverbound::PacketType::Rotate, &rotate, sizeof(rotate));
+				serverbound::MovePacket move = { .dx = 10.0f*dt*rdx, .dy = 10.0f*dt*ndz, .dz = 10.0f*dt*rdy};
+				appendPacket(buffer, serverbound::PacketType::Move, &move, sizeof(move));
+			}
+			if(rotating)
+			{
+				yaw += 10.0f*dt*nrx;
+				serverbound::RotatePacket rotate = {.yaw = yaw};
+				appendPacket(buffer, serverbound::PacketType::Rotate, &rotate, sizeof(rotate));
 			}
 
-			if(exitFuture.wait_for(std::chrono::milliseconds(1)) == std::future_status::ready)
+			lock.unlock();
+			sendBuffer(socket, buffer);
+			if(stats)
+				statistics.sent(clock::now());
+			lock.lock();
+
+			// fixed schedule, but never try to catch up on ticks we missed
+			next += tick;
+			if(next < clock::now())
+				next = clock::now();
+			input.changed.wait_until(lock, next, [&stop](){return stop.load();});
+			if(stop)
 				return;
 		}
 	});
 
+	auto setAxis = [&input](std::atomic<int16_t>& axis, int16_t value){
+		if(axis.exchange(value) == value)
+			return;
+		// taking the lock orders this with the sender's check, so the wake-up cannot get lost
+		{ std::scoped_lock lock(input.mutex); }
+		input.changed.notify_one();
+	};
+
 	SDL_Event event;
 	bool done = false;
 	while((!done) && (SDL_WaitEvent(&event)))
@@ -230,27 +415,30 @@ int main(int argc, char* argv[])
 				}
 
 				SDL_HapticRumblePlay(haptic, 1.0, 100);
-				std::cout << SDL_GameControllerGetStringForButton((SDL_GameControllerButton)event.cbutton.button) << ": " << (int)event.cbutton.state << std::endl;
+				if(verbose)
+					std::cout << SDL_GameControllerGetStringForButton((SDL_GameControllerButton)event.cbutton.button) << ": " << (int)event.cbutton.state << std::endl;
 				break;
 			case SDL_CONTROLLERBUTTONUP:
 				SDL_HapticRumbleStop(haptic);
-				std::cout << SDL_GameControllerGetStringForButton((SDL_GameControllerButton)event.cbutton.button) << ": " << (int)event.cbutton.state << std::endl;
+				if(verbose)
+					std::cout << SDL_GameControllerGetStringForButton((SDL_GameControllerButton)event.cbutton.button) << ": " << (int)event.cbutton.state << std::endl;
 				break;
 			case SDL_CONTROLLERAXISMOTION:
-				std::cout << SDL_GameControllerGetStringForAxis((SDL_GameControllerAxis)event.caxis.axis) << ": " << (int)event.caxis.value << std::endl;
+				if(verbose)
+					std::cout << SDL_GameControllerGetStringForAxis((SDL_GameControllerAxis)event.caxis.axis) << ": " << (int)event.caxis.value << std::endl;
 				if(event.caxis.axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_LEFTX)
-					rawData.dx = event.caxis.value;
+					setAxis(input.dx, event.caxis.value);
 				if(event.caxis.axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_LEFTY)
-					rawData.dy = event.caxis.value;
+					setAxis(input.dy, event.caxis.value);
 				if(event.caxis.axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_TRIGGERLEFT)
-					rawData.dz = -event.caxis.value;
+					setAxis(input.dz, -event.caxis.value);
 				if(event.caxis.axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_TRIGGERRIGHT)
-					rawData.dz = event.caxis.value;
+					setAxis(input.dz, event.caxis.value);
 					
 				if(event.caxis.axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_RIGHTX)
-					rawData.rx = event.caxis.value;
+					setAxis(input.rx, event.caxis.value);
 				if(event.caxis.axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_RIGHTY)
-					rawData.ry = event.caxis.value;
+					setAxis(input.ry, event.caxis.value);
 				break;
 			case SDL_QUIT:
 				done = true;
@@ -258,7 +446,11 @@ int main(int argc, char* argv[])
 		}
 	}
 
-	exitPromise.set_value();
+	{
+		std::scoped_lock lock(input.mutex);
+		stop = true;
+	}
+	input.changed.notify_one();
 	t.join();
 
 	close(socket);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include "mesh_cache.hpp"
+#include "texture.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class BundleEntry : uint32_t
+{
+	// the companion.json as is
+	Manifest,
+	// a cooked mesh in the mesh cache format
+	Mesh,
+	// the mip levels of a texture in their upload format, behind a small level table
+	Texture
+};
+
+// All companions packed into a single file that is mapped once, so starting up does one sequential read
+// of the table of contents and the manifests instead of opening and parsing every companion's files.
+// The manifests come first, the meshes and textures follow aligned to 64 bytes and are used in place,
+// so they can be copied into staging or device memory straight from the mapping.
+class asset_bundle
+{
+	public:
+		static constexpr uint32_t version = 1;
+
+		asset_bundle(const std::string& path);
+
+		// the names of the companions in the bundle, which are the names of the directories they were packed from
+		std::vector<std::string> companions() const;
+		bool contains(const std::string& name, BundleEntry kind) const;
+		// throws if the entry is missing
+		std::string_view manifest(const std::string& name) const;
+		// nothing if the mesh was packed for other cook options, then the bundle has to be packed again
+		std::optional<cooked_mesh> mesh(const std::string& name, const cook_options& options) const;
+		TextureData texture(const std::string& name) const;
+	private:
+		friend class bundle_writer;
+		struct header;
+		struct entry;
+
+		std::span<const uint8_t> find(const std::string& name, BundleEntry kind) const;
+
+		std::shared_ptr<mapped_file> m_file;
+		std::map<std::pair<std::string, BundleEntry>, std::span<const uint8_t>> m_entries;
+};
+
+// collects entries in memory and writes them as a bundle
+class bundle_writer
+{
+	public:
+		void add(const std::string& name, BundleEntry kind, std::span<const uint8_t> data);
+		void addManifest(const std::string& name, std::string_view manifest);
+		void addTexture(const std::string& name, const TextureData& texture);
+
+		// writes atomically like the mesh cache, so the game never maps a partial bundle
+		void write(const std::string& path) const;
+	private:
+		struct pending
+		{
+			std::string name;
+			BundleEntry kind;
+			std::vector<uint8_t> data;
+		};
+		std::vector<pending> m_entries;
+};
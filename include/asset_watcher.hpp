@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+
+// Watches every companion directory with inotify on its own thread. Changes are reported per directory
+// once its files stayed untouched for a moment, since editors and exporters tend to write in several steps.
+class asset_watcher
+{
+	public:
+		// name is the companion's directory below the watched one, files are the changed names in it
+		using change_function = std::function<void(const std::string& name, const std::set<std::string>& files)>;
+
+		asset_watcher(const std::string& directory, change_function onChange);
+		asset_watcher(const asset_watcher&) = delete;
+		asset_watcher& operator=(const asset_watcher&) = delete;
+		~asset_watcher();
+	private:
+		void watch(const std::string& name);
+		// for a directory that appeared after the start, reports the files already in it
+		void watchNew(const std::string& name);
+		void run();
+
+		std::string m_directory;
+		change_function m_onChange;
+		int m_fd;
+		// watch descriptor to companion directory, the empty name for the watched directory itself
+		std::map<int, std::string> m_watches;
+		std::map<std::string, std::set<std::string>> m_changes;
+		std::chrono::steady_clock::time_point m_lastChange;
+
+		std::atomic<bool> m_stop = false;
+		std::thread m_thread;
+};
@@ -1,39 +1,72 @@
 #pragma once
 
 #include "draw.hpp"
+#include "uniform_ring.hpp"
 
 #include <glm/glm.hpp>
 #include <vulkan/vulkan.h>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 
+// What a client's draws read from the binding with the "client" source, unless push constants replace it.
+struct ClientVariables
+{
+	glm::mat4 matrix;
+};
+
+// What a client's draws get as push constants instead of a uniform buffer, with "clientPushConstants" in the game's pipeline layout.
+struct ClientConstants
+{
+	glm::mat4 matrix;
+	uint32_t lod;
+	// seconds since the client joined
+	float age;
+	uint32_t padding[2];
+};
+
+struct client_descriptors;
+class companion;
+
 class render_client
 {
 	public:
-		render_client(std::string companion) : m_companion(companion) {}
+		render_client(std::string companion) : m_companion(companion), m_joined(std::chrono::steady_clock::now()) {}
 
 		void init(VkDevice device);
 		void destroy(VkDevice device);
+		// picks the set of the companion with the descriptors stolen from source, null without steals; a set is written
+		// once for each content of source and texture of the companion, which only exists once it is resident and
+		// changes while levels stream in, and goes back once the frames in flight are done with it
+		void selectSet(VkDevice device, VkDescriptorSet source);
 
-		void update();
+		// writes the client variables for the frame into ring, only without push constants
+		void update(uniform_ring& ring);
+		// from the position and the rotation
+		glm::mat4 matrix();
+		ClientConstants constants();
 		
-		VkDescriptorSet descriptor_set() {return m_descriptorSet;}
+		// the one selectSet() picked, none if the companion was not resident
+		VkDescriptorSet descriptor_set();
+		// where update() put the client variables, as the dynamic offset of their binding
+		uint32_t variablesOffset() {return m_variablesOffset;}
 		std::string companion() {return m_companion;}
+		// resolved by init(), so the draws need no lookup by name
+		::companion* target() {return m_target;}
 
 		glm::vec3 m_position;
 		float m_yaw;
 		float m_pitch;
+		// level of detail drawn last frame, kept for the hysteresis
+		uint32_t m_lod = 0;
 	private:
-		struct ClientVariables
-		{
-			glm::mat4 matrix;
-		};
-
 		std::string m_companion;
+		::companion* m_target = nullptr;
+		std::chrono::steady_clock::time_point m_joined;
 
-		VkDescriptorSet m_descriptorSet;
-		VkBuffer m_variablesBuffer;
-		VkDeviceMemory m_variablesMemory;
-
-		ClientVariables* m_variables;
+		// the client variables are bound through dynamic offsets, so nothing in the set is per client
+		// and the clients of a companion share theirs
+		std::shared_ptr<client_descriptors> m_descriptors;
+		uint32_t m_variablesOffset = 0;
 };
@@ -1,8 +1,23 @@
 #pragma once
 
 #include "logger.hpp"
+#include "mesh_cache.hpp"
+#include "texture.hpp"
+#include "upload_batch.hpp"
+#include "upload_service.hpp"
+#include "asset_bundle.hpp"
+#include "gpu_allocator.hpp"
+#include "geometry_store.hpp"
+#include "frame_tracker.hpp"
 #include <vulkan/vulkan.h>
 #include <nlohmann/json.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <vector>
 #include <string>
 #include <variant>
@@ -13,57 +28,179 @@ using json = nlohmann::json;
 
 struct RenderMesh
 {
-	uint32_t indexCount;
+	VertexFormat vertexFormat;
+	VertexDequantization dequantization;
+	VkIndexType indexType;
 	VkBuffer indexBuffer;
-	std::vector<VkBuffer> vertexBuffers;
+	VkBuffer vertexBuffer;
+	// where the mesh starts in its buffers, added to the submeshes' own offsets
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	std::vector<Submesh> submeshes;
+	std::vector<MeshLod> lods;
+	float radius;
 
-	VkDeviceMemory memory;
+	// the range in the geometry store, or the memory of buffers of its own if it did not fit there
+	std::optional<geometry_range> geometry;
+	gpu_allocation memory;
+
+	VkDeviceSize residentBytes() const {return geometry ? geometry->vertexSize + geometry->indexSize : memory.size;}
+};
+
+// What the companion pass bound last, so the companions in the geometry store bind their buffers only once.
+struct GeometryBinding
+{
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	VkIndexType indexType = VK_INDEX_TYPE_MAX_ENUM;
 };
 
 struct RenderTexture
 {
 	VkImage image;
+	VkFormat format;
+	uint32_t mipLevels;
+	// the finest level that is resident, which is also the first level of imageView
+	uint32_t baseLevel;
+	VkImageLayout layout;
 	VkImageView imageView;
 	VkSampler sampler;
 
-	VkDeviceMemory memory;
+	gpu_allocation memory;
 };
 
 enum ModelType
 {
-	Obj
+	Obj,
+	Glb
 };
 
 enum TextureType
 {
 	None,
 	Png,
-	Color
+	Color,
+	Dds,
+	Ktx2,
+	// the texture of a GLB file
+	Embedded
 };
 
 class companion
 {
 	public:
-		companion(json& json, std::string filebase);
+		// with a bundle the assets are read from its entries named after the last part of filebase instead of the files
+		companion(json& json, std::string filebase, std::shared_ptr<const asset_bundle> bundle = nullptr);
 
-		void uploadMesh(VkDevice device, CheekyLayer::active_logger& logger);
-		void uploadTexture(VkDevice device, CheekyLayer::active_logger& logger);
+		// has to match the vertex format of the game's pipeline and be set before loading the mesh
+		void setVertexFormat(VertexFormat format) {m_cookOptions.vertexFormat = format;}
+		cooked_mesh loadMesh(bool& stale);
+		// with all of its mip levels, ready to be uploaded
+		TextureData loadTexture();
+		// the CPU side of loading, which needs no device and can run on any thread, also in parallel to each other;
+		// the uploads pick up the results and decode themselves if that did not happen yet
+		void decodeMesh();
+		void decodeTexture();
+		// the resources are only usable once the batch finished on the GPU
+		void uploadMesh(VkDevice device, CheekyLayer::active_logger& logger, upload_batch& batch);
+		void uploadTexture(VkDevice device, CheekyLayer::active_logger& logger, upload_batch& batch);
+		// the first user starts loading the assets in the background, before that the companion is only its manifest entry;
+		// it must not be drawn before resident()
+		void addUser(VkDevice device, upload_service& uploads);
+		void removeUser();
+		bool resident() {return m_meshResident && m_textureResident;}
+		// when the last user left, for evicting the least recently used companions first
+		std::chrono::steady_clock::time_point lastUsed();
+		VkDeviceSize residentBytes() {return m_meshBytes + m_textureBytes;}
+		// frees the assets once the frames in flight are done with them, unless the companion got a user or is still loading;
+		// only from the draw thread
+		bool unload(VkDevice device, frame_tracker& frames);
+		// rebuilds what the changed files of the companion's directory affect in the background and swaps it in
+		// from the draw thread once it is resident, the old resources are freed through frames; for any thread
+		void reload(VkDevice device, upload_service& uploads, const std::set<std::string>& files);
+		// changes whenever the texture descriptor has to be written again, only from the draw thread
+		uint32_t textureGeneration() {return m_textureGeneration;}
 
 		bool hasTexture();
 		VkDescriptorImageInfo getTextureDescriptorInfo();
 
-		void draw(VkDevice device, VkCommandBuffer commandBuffer);
+		// picks the level of detail for the distance to the viewer, lod is the caller's level from the last frame
+		uint32_t selectLod(float distance, uint32_t lod);
+		void draw(VkDevice device, VkCommandBuffer commandBuffer, GeometryBinding& bound, uint32_t lod, uint32_t instanceCount, uint32_t firstInstance);
 
 		std::string id() {return m_id;}
+		std::string directory() {return m_directory;}
+		std::string meshCacheFile();
 		RenderMesh& mesh() {return m_renderMesh;}
 		RenderTexture& texture() {return m_renderTexture;}
 	private:
+		void configure(json& json, std::string filebase);
+		std::string bundleName();
+		// the files can change with a reload while other threads load from them
+		std::string modelFile();
+		std::variant<std::string, glm::vec4> textureArgument();
+		// takes over what next reloaded, including its configuration if companion.json changed
+		void swap(VkDevice device, companion& next, bool mesh, bool texture, bool config);
+		// decodes on the workers and uploads in the background
+		void load(VkDevice device, upload_service& uploads);
+		// called from the resident callbacks
+		void uploadFinished();
+		// from the resident callbacks, reports the resources this companion created to the caches and calls done once the
+		// shared ones are resident as well, with false if any of them failed
+		void settle(bool ok, bool mesh, bool texture, std::function<void(bool)> done);
+		// frees what a failed upload left in the render mesh or texture, from its resident callback
+		void uploadFailed(VkDevice device, bool mesh, bool texture);
+		VkImageView createTextureView(VkDevice device, uint32_t baseLevel);
+		VkSampler createSampler(VkDevice device);
+		// drops the references to the shared mesh and texture, which are freed once nobody uses them and the frames in flight are done
+		void release(VkDevice device, frame_tracker& frames, bool mesh, bool texture);
+		// queues the levels uploadTexture() left out, finest last
+		void streamTexture(VkDevice device, upload_service& uploads);
+
+		// fixed, a reload that changes it is refused
 		std::string m_id;
+		std::string m_directory;
+		std::shared_ptr<const asset_bundle> m_bundle;
 		ModelType m_modelType;
+		// guards the model file, its cook options and the texture argument, which swap() replaces while the workers and the watcher read them
+		std::mutex m_configMutex;
 		std::string m_modelFile;
+		cook_options m_cookOptions;
+		float m_lodThreshold;
+		float m_lodHysteresis;
 
 		TextureType m_textureType;
 		std::variant<std::string, glm::vec4> m_textureArgument;
+		bool m_generateMipmaps;
+		// VkSamplerCreateInfo fields that override the default trilinear repeating sampler
+		json m_samplerConfig;
+		uint32_t m_streamTextureTail;
+
+		std::optional<cooked_mesh> m_decodedMesh;
+		bool m_meshCacheRebuilt = false;
+		std::string m_meshCacheError;
+		std::optional<TextureData> m_decodedTexture;
+		uint64_t m_decodedTextureHash;
+		// the content the shared resources are cached by, 0 for ones that are not shared
+		uint64_t m_meshKey = 0;
+		uint64_t m_textureKey = 0;
+		// whether the resources came from the caches instead of this companion's own upload
+		bool m_meshShared = false;
+		bool m_textureShared = false;
+		std::atomic<bool> m_meshResident = false;
+		std::atomic<bool> m_textureResident = false;
+		std::shared_ptr<TextureData> m_streamedTexture;
+		uint32_t m_textureGeneration = 0;
+
+		std::mutex m_usersMutex;
+		uint32_t m_users = 0;
+		bool m_loaded = false;
+		std::chrono::steady_clock::time_point m_lastUsed;
+		// uploads and streamed levels that were requested but are not resident yet
+		std::atomic<uint32_t> m_pendingUploads = 0;
+		std::atomic<VkDeviceSize> m_meshBytes = 0;
+		std::atomic<VkDeviceSize> m_textureBytes = 0;
+		std::set<std::string> m_deferredReloads;
 
 		RenderMesh m_renderMesh;
 		RenderTexture m_renderTexture;
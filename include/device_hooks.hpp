@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+// Puts wrappers into the layer's dispatch table of the device, so the companion sees the calls the game makes through
+// the layer besides the draws its rules report: submissions and discarded recordings for the frame tracker, and
+// descriptor set updates for the draws that steal the game's descriptors.
+// The wrappers call on to what was in the table before. Installed once, from companion:init when the device is created,
+// so the pools of all the game's command buffers are known.
+void install_device_hooks(VkDevice device);
+
+// changes whenever the set is allocated, written or copied into, so a set with the same handle and generation
+// still has the same contents; 0 for sets none of that was seen for
+uint64_t descriptor_set_generation(VkDescriptorSet set);
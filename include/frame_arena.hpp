@@ -0,0 +1,53 @@
+#pragma once
+
+#include "frame_tracker.hpp"
+#include "gpu_allocator.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <memory>
+#include <vector>
+
+// Host visible buffer space for data that the draws write every frame, like per-instance transforms.
+// It comes from persistently mapped chunks, and a frame's chunks are reused once the GPU is done with the frame,
+// so nothing is written while an earlier frame might still read it. Only used from the draw thread.
+class frame_arena
+{
+	public:
+		struct slice
+		{
+			VkBuffer buffer;
+			VkDeviceSize offset;
+			uint8_t* mapped;
+		};
+
+		frame_arena(VkDevice device, VkBufferUsageFlags usage, VkDeviceSize alignment, VkDeviceSize chunkSize);
+		frame_arena(const frame_arena&) = delete;
+		frame_arena& operator=(const frame_arena&) = delete;
+		~frame_arena();
+
+		// valid for the commands recorded until the next retire()
+		slice allocate(VkDeviceSize size);
+		// hands the chunks written since the last call over to frames, which gives them back once the GPU
+		// finished everything recorded so far; meant to be called once per frame after the draws were recorded
+		void retire(frame_tracker& frames);
+	private:
+		struct chunk
+		{
+			VkBuffer buffer;
+			gpu_allocation memory;
+			VkDeviceSize size;
+			VkDeviceSize used;
+		};
+
+		chunk* createChunk(VkDeviceSize size);
+
+		VkDevice m_device;
+		VkBufferUsageFlags m_usage;
+		VkDeviceSize m_alignment;
+		VkDeviceSize m_chunkSize;
+		std::vector<std::unique_ptr<chunk>> m_chunks;
+		// written this frame, the last one is filled next
+		std::vector<chunk*> m_current;
+		std::vector<chunk*> m_free;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Finds out when the GPU is done with what the companion draws recorded. A mark ties the deferred work to the game's
+// command buffer it was recorded into, and when the game submits that command buffer the submit hook follows it with
+// a fence on the same queue. Deferred work runs once the fences of the next mark and of all marks before it signaled.
+// A recording that is begun again, reset or freed without being submitted never runs and stops holding back the marks
+// after it; one that is submitted again keeps the fence of its first submission.
+class frame_tracker
+{
+	public:
+		frame_tracker(VkDevice device);
+		frame_tracker(const frame_tracker&) = delete;
+		frame_tracker& operator=(const frame_tracker&) = delete;
+		~frame_tracker();
+
+		// ties the functions deferred so far to commandBuffer and runs the deferred functions of finished frames;
+		// meant to be called once per frame before anything else is recorded
+		void mark(VkCommandBuffer commandBuffer);
+		// runs f from a later mark() once the commands recorded up to the next mark() finished
+		void defer(std::function<void()> f);
+
+		// from the hooks, after the game submitted the command buffers to queue
+		void submitted(VkQueue queue, const std::vector<VkCommandBuffer>& commandBuffers);
+		// from the hooks, when the command buffer's recording was thrown away
+		void discarded(VkCommandBuffer commandBuffer);
+	private:
+		struct frame
+		{
+			VkCommandBuffer commandBuffer;
+			// signaled after the command buffer's first submission, null until then
+			VkFence fence = VK_NULL_HANDLE;
+			bool discarded = false;
+			std::vector<std::function<void()>> deferred;
+		};
+
+		VkDevice m_device;
+		std::mutex m_mutex;
+		std::deque<frame> m_frames;
+		std::vector<std::function<void()>> m_deferred;
+		std::vector<VkFence> m_freeFences;
+};
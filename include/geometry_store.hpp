@@ -0,0 +1,58 @@
+#pragma once
+
+#include "gpu_allocator.hpp"
+#include "range_allocator.hpp"
+#include "upload_batch.hpp"
+#include "upload_service.hpp"
+
+#include <vulkan/vulkan.h>
+#include <nlohmann/json.hpp>
+
+#include <mutex>
+#include <optional>
+
+// Where a mesh lives in the geometry store, in bytes.
+struct geometry_range
+{
+	VkDeviceSize vertexOffset;
+	VkDeviceSize vertexSize;
+	VkDeviceSize indexOffset;
+	VkDeviceSize indexSize;
+};
+
+// One vertex and one index buffer that all companion meshes are packed into, so a whole companion pass binds
+// its geometry once and draws address their mesh with firstIndex and vertexOffset. The buffers have a fixed
+// size of "vertexBytes" and "indexBytes" from "geometryBuffer" in config.json; meshes that do not fit anymore
+// get buffers of their own. All methods can be called from any thread.
+class geometry_store
+{
+	public:
+		geometry_store(VkDevice device, const nlohmann::json& config, const upload_service& uploads);
+		geometry_store(const geometry_store&) = delete;
+		geometry_store& operator=(const geometry_store&) = delete;
+		~geometry_store();
+
+		// the vertices start at a multiple of vertexStride, so they can be addressed by vertexOffset
+		std::optional<geometry_range> allocate(VkDeviceSize vertexSize, VkDeviceSize vertexStride, VkDeviceSize indexSize);
+		// only once the GPU is done with the range
+		void free(const geometry_range& range);
+		// writes directly when the buffers are host visible, otherwise through the batch's staging copies
+		void write(upload_batch& batch, const geometry_range& range, const void* vertexData, const void* indexData);
+
+		VkBuffer vertexBuffer() const {return m_vertexBuffer;}
+		VkBuffer indexBuffer() const {return m_indexBuffer;}
+	private:
+		VkBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, const upload_service& uploads, gpu_allocation& memory);
+
+		VkDevice m_device;
+		VkBuffer m_vertexBuffer = VK_NULL_HANDLE;
+		VkBuffer m_indexBuffer = VK_NULL_HANDLE;
+		gpu_allocation m_vertexMemory;
+		gpu_allocation m_indexMemory;
+		// shared by the upload and the graphics family, so the batches write them without ownership transfers
+		bool m_concurrent = false;
+
+		std::mutex m_mutex;
+		range_allocator m_vertices;
+		range_allocator m_indices;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+// The binary container of glTF 2.0, mapped as a whole. Only the embedded BIN chunk is supported
+// as a buffer, external buffers and data URIs are not.
+class glb_file
+{
+	public:
+		glb_file(const std::string& path);
+
+		const nlohmann::json& json() const {return m_json;}
+		std::span<const uint8_t> bufferView(size_t index) const;
+
+		// an accessor's elements, each of them count components wide, with the byte stride between them
+		struct accessor
+		{
+			const uint8_t* data;
+			size_t elements;
+			size_t stride;
+			uint32_t componentType;
+			uint32_t count;
+			bool normalized;
+		};
+		accessor getAccessor(size_t index) const;
+	private:
+		std::string m_path;
+		mapped_file m_file;
+		nlohmann::json m_json;
+		std::span<const uint8_t> m_bin;
+};
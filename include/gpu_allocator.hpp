@@ -0,0 +1,74 @@
+#pragma once
+
+#include "range_allocator.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct gpu_allocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	// where the allocation starts when its memory type is host visible, those blocks stay mapped
+	uint8_t* mapped = nullptr;
+};
+
+// Suballocates device memory from large blocks, so the companions need a handful of vkAllocateMemory calls
+// instead of one per resource. Every block belongs to one memory type and holds either only buffers or only
+// images, which keeps linear and optimal resources bufferImageGranularity apart without padding. Allocations take
+// the smallest free range they fit in and freed ranges merge with their free neighbours. Allocations bigger than
+// half a block get a block of their own. All methods can be called from any thread.
+class gpu_allocator
+{
+	public:
+		struct heap_stats
+		{
+			VkDeviceSize blockBytes = 0;
+			VkDeviceSize usedBytes = 0;
+			// held in blocks without being used, alignment gaps included
+			VkDeviceSize wastedBytes = 0;
+			uint32_t blocks = 0;
+			uint32_t allocations = 0;
+		};
+
+		gpu_allocator(VkDevice device, VkDeviceSize blockSize);
+		gpu_allocator(const gpu_allocator&) = delete;
+		gpu_allocator& operator=(const gpu_allocator&) = delete;
+		~gpu_allocator();
+
+		// linear for buffers, otherwise for optimally tiled images
+		gpu_allocation allocateOfType(const VkMemoryRequirements& requirements, uint32_t memoryType, bool linear);
+		gpu_allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+		// allocates and binds the memory
+		gpu_allocation allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties);
+		gpu_allocation allocateImage(VkImage image, VkMemoryPropertyFlags properties);
+		void free(const gpu_allocation& allocation);
+
+		// indexed by memory heap
+		std::vector<heap_stats> stats();
+	private:
+		struct block
+		{
+			VkDeviceMemory memory;
+			VkDeviceSize size;
+			uint32_t memoryType;
+			bool linear;
+			bool dedicated;
+			uint8_t* mapped;
+			range_allocator ranges;
+		};
+
+		block& createBlock(VkDeviceSize size, uint32_t memoryType, bool linear, bool dedicated);
+		bool allocateFrom(block& b, const VkMemoryRequirements& requirements, gpu_allocation& allocation);
+
+		VkDevice m_device;
+		VkDeviceSize m_blockSize;
+		std::mutex m_mutex;
+		std::map<VkDeviceMemory, std::unique_ptr<block>> m_blocks;
+};
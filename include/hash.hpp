@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// fast non-cryptographic 64-bit hash for detecting changed or identical asset content
+inline uint64_t content_hash(const void* data, size_t size, uint64_t seed = 0)
+{
+	auto mix = [](uint64_t h) {
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return h;
+	};
+
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	uint64_t h = seed ^ (size * 0x9E3779B97F4A7C15ull);
+	for(; size >= 8; p += 8, size -= 8)
+	{
+		uint64_t w;
+		std::memcpy(&w, p, 8);
+		h = (h ^ mix(w)) * 0x9E3779B97F4A7C15ull;
+		h = (h << 31) | (h >> 33);
+	}
+	uint64_t tail = 0;
+	std::memcpy(&tail, p, size);
+	return mix(h ^ mix(tail));
+}
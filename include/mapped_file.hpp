@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+class mapped_file
+{
+	public:
+		// populate reads the whole file in right away, otherwise pages are read on first access
+		mapped_file(const std::string& path, bool populate = true);
+		mapped_file(mapped_file&& other) noexcept;
+		mapped_file& operator=(mapped_file&& other) noexcept;
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+		~mapped_file();
+
+		const uint8_t* data() const {return m_data;}
+		size_t size() const {return m_size;}
+		std::string_view view() const {return {reinterpret_cast<const char*>(m_data), m_size};}
+	private:
+		void release();
+
+		const uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+};
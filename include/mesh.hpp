@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Vertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texCoord;
+};
+
+struct MeshData
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	// indices of the simplified levels of detail after the full one, using the same vertices
+	std::vector<std::vector<uint32_t>> lods;
+};
+
+// the value is the size of one index in bytes
+enum class IndexType : uint32_t
+{
+	Uint16 = 2,
+	Uint32 = 4
+};
+
+// a range of the index buffer drawn with its own vertex offset
+struct Submesh
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t vertexOffset;
+};
+
+// one level of detail is drawn as a consecutive range of submeshes
+struct MeshLod
+{
+	uint32_t firstSubmesh;
+	uint32_t submeshCount;
+	// the largest geometric error of the simplification, relative to half the bounding box diagonal
+	float error;
+};
+
+// a mesh laid out for the GPU, with index data in the format given by indexType
+struct IndexedMesh
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint8_t> indexData;
+	IndexType indexType;
+	std::vector<Submesh> submeshes;
+	std::vector<MeshLod> lods;
+};
+
+MeshData load_obj(std::string file);
+// glTF 2.0 binaries, all triangle primitives of all meshes merged into one
+MeshData load_glb(std::string file);
+
+// Uses 16 bit indices whenever every vertex can be reached with them below the restart index 0xFFFF and 32 bit
+// indices otherwise. With split, meshes that are too big are cut into submeshes of at most 65535 vertices each instead,
+// which duplicates the vertices on the cuts, but keeps the whole mesh on 16 bit indices.
+// Every level of detail gets its own submeshes, lodErrors holds the error of each level.
+IndexedMesh build_indexed_mesh(const MeshData& mesh, bool split, const std::vector<float>& lodErrors = {});
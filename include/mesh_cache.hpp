@@ -0,0 +1,87 @@
+#pragma once
+
+#include "mesh.hpp"
+#include "vertex_format.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+struct MeshBounds
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+using mesh_loader = MeshData(*)(std::string);
+
+// everything besides the source file that changes the cooked result
+struct cook_options
+{
+	bool split = false;
+	// vertex cache and fetch order, optionally also overdraw order
+	bool optimize = true;
+	bool overdraw = false;
+	VertexFormat vertexFormat = VertexFormat::Float;
+	// number of levels of detail including the full mesh
+	uint32_t lodLevels = 4;
+
+	uint64_t key() const;
+};
+
+// A mesh in its precooked binary form, either mapped from a cache file or kept in memory.
+// Vertices and indices are stored back to back, so the payload can be copied into a staging buffer as is.
+class cooked_mesh
+{
+	public:
+		static constexpr uint32_t version = 6;
+
+		// maps a cache file and returns nothing if it is missing, corrupt or was cooked from another source
+		static std::optional<cooked_mesh> open(const std::string& path, uint64_t sourceHash, const cook_options& options);
+		// uses a cooked mesh in memory that owner keeps alive, like one packed into a bundle, whatever its source was
+		static std::optional<cooked_mesh> view(std::shared_ptr<const void> owner, const uint8_t* data, size_t size, const cook_options& options);
+		static cooked_mesh cook(const MeshData& mesh, uint64_t sourceHash, const cook_options& options);
+
+		// writes atomically, so a concurrently starting game never sees a partial cache
+		void write(const std::string& path) const;
+
+		uint64_t sourceHash() const;
+		MeshBounds bounds() const;
+		VertexFormat vertexFormat() const;
+		VertexDequantization dequantization() const;
+		uint32_t vertexCount() const;
+		IndexType indexType() const;
+		uint32_t indexCount() const;
+		// ACMR of the source order and of the cooked order, with a 32 entry FIFO cache
+		float acmrBefore() const;
+		float acmrAfter() const;
+		// only for VertexFormat::Float, empty otherwise
+		std::span<const Vertex> vertices() const;
+		std::span<const uint8_t> vertexData() const;
+		std::span<const uint8_t> indexData() const;
+		std::span<const Submesh> submeshes() const;
+		std::span<const MeshLod> lods() const;
+		std::span<const uint8_t> payload() const;
+		// everything, as written to a cache file
+		std::span<const uint8_t> bytes() const {return {m_data, m_size};}
+	private:
+		struct header;
+
+		static bool valid(const uint8_t* data, size_t size, const cook_options& options);
+		cooked_mesh(std::shared_ptr<const void> owner, const uint8_t* data, size_t size) :
+			m_owner(std::move(owner)), m_data(data), m_size(size) {}
+		const header& head() const;
+
+		std::shared_ptr<const void> m_owner;
+		const uint8_t* m_data;
+		size_t m_size;
+};
+
+// uses the cache if it matches the source file, otherwise loads and cooks the source and sets stale,
+// so the caller can decide whether and how to write the new cache
+cooked_mesh load_cooked_mesh(const std::string& source, const std::string& cache, mesh_loader loader, const cook_options& options, bool& stale);
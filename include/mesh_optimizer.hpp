@@ -0,0 +1,22 @@
+#pragma once
+
+#include "mesh.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// average number of vertex shader invocations per triangle with a FIFO post-transform cache of the given size
+float compute_acmr(const std::vector<uint32_t>& indices, size_t vertexCount, size_t cacheSize = 32);
+
+// reorders triangles for the post-transform cache (Forsyth's linear-speed vertex cache optimisation)
+void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+// Groups the cache-optimized triangles into clusters (as in Tipsify) and draws outward facing clusters first,
+// so less hidden surfaces get shaded. Clusters are cut where the cache is cold anyway or where the part so far
+// is within threshold of its cluster's ACMR, which keeps the ACMR increase small.
+void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f);
+
+// renumbers vertices in the order they are first used by the full mesh, so vertex fetches walk the buffer front to back;
+// the levels of detail are renumbered along
+void optimize_vertex_fetch(MeshData& mesh);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "mesh.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Quadric error edge collapse that only moves vertices onto their neighbours, so the result indexes the same
+// vertex buffer. Vertices on open borders and on attribute seams stay in place, which keeps the silhouette
+// and the texture mapping intact. Stops at targetIndexCount or when no more edges can be collapsed.
+// error is set to the largest collapse distance relative to half the bounding box diagonal.
+std::vector<uint32_t> simplify_mesh(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices,
+	size_t targetIndexCount, float& error);
+
+// Appends levels to mesh.lods, each with about half the triangles of the one before. The chain ends early
+// once simplification stops making progress. errors receives one entry per level, starting with 0 for the full mesh.
+void generate_lods(MeshData& mesh, uint32_t levels, std::vector<float>& errors);
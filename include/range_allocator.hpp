@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+
+// Hands out ranges of a fixed size space: a range takes the smallest free range it fits in aligned,
+// the gap in front of it stays free, and freed ranges merge with their free neighbours. Not thread safe.
+class range_allocator
+{
+	public:
+		range_allocator(uint64_t size);
+
+		// any alignment works, not only powers of two
+		std::optional<uint64_t> allocate(uint64_t size, uint64_t alignment);
+		void free(uint64_t offset, uint64_t size);
+
+		uint64_t size() const {return m_size;}
+		uint64_t used() const {return m_used;}
+		uint32_t allocations() const {return m_allocations;}
+	private:
+		void addFreeRange(uint64_t offset, uint64_t size);
+		void removeFreeRange(std::map<uint64_t, uint64_t>::iterator range);
+
+		uint64_t m_size;
+		uint64_t m_used = 0;
+		uint32_t m_allocations = 0;
+		// offset to size, and size to offset for finding the best fit
+		std::map<uint64_t, uint64_t> m_freeRanges;
+		std::multimap<uint64_t, uint64_t> m_freeSizes;
+};
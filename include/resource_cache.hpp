@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Reference counted GPU resources, shared by every companion whose assets have the same content.
+// Lookups and inserts happen while filling upload batches, so a resource can be found before the batch that creates it
+// finished or even got submitted. The creator reports it with resident() from its resident callback and the others
+// wait for that with whenResident() before drawing it. If the creator's upload failed the resource is dropped: later
+// lookups miss it, the waiting ones are told and the creator frees it on its own.
+template<typename T>
+class resource_cache
+{
+	public:
+		// a copy of the resource with a new reference to it, nothing if there is none yet or its upload failed
+		std::optional<T> acquire(uint64_t key)
+		{
+			std::unique_lock lock(m_mutex);
+			auto it = m_entries.find(key);
+			if(it == m_entries.end() || it->second.state == residency::Failed)
+				return std::nullopt;
+			it->second.references++;
+			return it->second.resource;
+		}
+		// for a resource the caller just created after acquire() found none, holding the first reference;
+		// false if a failed one still holds the key, then the caller keeps the resource to itself
+		bool insert(uint64_t key, const T& resource)
+		{
+			std::unique_lock lock(m_mutex);
+			return m_entries.insert({key, {resource, 1}}).second;
+		}
+		// from the creator once its upload finished; a failed resource loses the creator's reference
+		// and is only kept around until the ones waiting for it released theirs
+		void resident(uint64_t key, bool ok)
+		{
+			std::vector<std::function<void(bool)>> waiters;
+			{
+				std::unique_lock lock(m_mutex);
+				auto it = m_entries.find(key);
+				if(it == m_entries.end())
+					return;
+				it->second.state = ok ? residency::Resident : residency::Failed;
+				waiters.swap(it->second.waiters);
+				if(!ok && --it->second.references == 0)
+					m_entries.erase(it);
+			}
+			for(auto& f : waiters)
+				f(ok);
+		}
+		// calls f with whether the creator's upload succeeded, right away if it already finished
+		void whenResident(uint64_t key, std::function<void(bool)> f)
+		{
+			std::unique_lock lock(m_mutex);
+			auto it = m_entries.find(key);
+			if(it != m_entries.end() && it->second.state == residency::Loading)
+			{
+				it->second.waiters.push_back(std::move(f));
+				return;
+			}
+			bool ok = it != m_entries.end() && it->second.state == residency::Resident;
+			lock.unlock();
+			f(ok);
+		}
+		// true if that was the last reference, then the caller frees the resource; never for a failed one,
+		// which its creator already freed
+		bool release(uint64_t key)
+		{
+			std::unique_lock lock(m_mutex);
+			auto it = m_entries.find(key);
+			if(it == m_entries.end() || --it->second.references > 0)
+				return false;
+			bool failed = it->second.state == residency::Failed;
+			m_entries.erase(it);
+			return !failed;
+		}
+		size_t size()
+		{
+			std::unique_lock lock(m_mutex);
+			return m_entries.size();
+		}
+	private:
+		enum class residency
+		{
+			Loading,
+			Resident,
+			Failed
+		};
+		struct entry
+		{
+			T resource;
+			uint32_t references;
+			residency state = residency::Loading;
+			std::vector<std::function<void(bool)>> waiters;
+		};
+
+		std::mutex m_mutex;
+		std::unordered_map<uint64_t, entry> m_entries;
+};
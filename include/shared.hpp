@@ -3,12 +3,24 @@
 #include "companion.hpp"
 #include "client.hpp"
 #include "net/server.hpp"
+#include "thread_pool.hpp"
+#include "upload_service.hpp"
+#include "frame_tracker.hpp"
+#include "asset_watcher.hpp"
+#include "resource_cache.hpp"
+#include "gpu_allocator.hpp"
+#include "geometry_store.hpp"
+#include "frame_arena.hpp"
+#include "uniform_ring.hpp"
 
 #include <vulkan/vulkan.h>
 #include <nlohmann/json.hpp>
 
+#include <atomic>
 #include <map>
 #include <memory>
+#include <optional>
+#include <set>
 
 using nlohmann::json;
 
@@ -17,9 +29,50 @@ inline json gameConfig;
 inline bool ready;
 
 inline network::server* server;
+// all device memory of the companion goes through it, in blocks of "memoryBlockSize" in config.json
+inline std::unique_ptr<gpu_allocator> allocator;
+// the vertex and index buffer that the companion meshes are packed into, sized by "geometryBuffer" in config.json
+inline std::unique_ptr<geometry_store> geometry;
+// for CPU work like asset decoding, sized by "workerThreads" in config.json
+inline std::unique_ptr<thread_pool> workers;
+// uploads companion assets in the background, configured by "uploadQueue" in config.json
+inline std::unique_ptr<upload_service> uploads;
+// tells when the GPU is done with resources the draws used, marked by every draw
+inline std::unique_ptr<frame_tracker> frames;
+// the per-instance matrices of every frame, only with "instanceMatrix" in the game's config
+inline std::unique_ptr<frame_arena> instances;
+// the client variables of every frame, bound through dynamic offsets; only when a descriptor has the "client" source
+// and with "framesInFlight" slots in config.json, companions are not drawn in frames that find all of them in use
+inline std::unique_ptr<uniform_ring> clientVariables;
+// reloads companion assets when their files change, unless "hotReload" in config.json is false
+inline std::unique_ptr<asset_watcher> watcher;
+
+// meshes and textures by their content, so companions with the same assets share them
+inline resource_cache<RenderMesh> meshCache;
+inline resource_cache<RenderTexture> textureCache;
+
+// how much device memory the companions may use before unused ones get evicted, "vramBudget" in config.json
+inline VkDeviceSize vramBudget;
+// set when a companion lost its last user or finished loading, the next draw then checks the budget
+inline std::atomic<bool> evictionRequested;
 
 inline VkDevice globalDevice;
 
+// the vertex layout of every companion mesh, set from the game's "vertexFormat"
+inline VertexFormat vertexFormat = VertexFormat::Float;
+
+// the block compressed formats the device samples, found by the init; textures in the others are decoded to RGBA8 when loaded
+inline std::set<VkFormat> sampledBlockFormats;
+
+// where the viewer is assumed to be when picking levels of detail, from the game's "lodReference"
+inline glm::vec3 lodReference;
+
+// the vertex binding of the per-instance matrices, from the game's "instanceMatrix"; without it every client is drawn on its own
+inline std::optional<uint32_t> instanceBinding;
+// where the ClientConstants start in the push constants, from "clientPushConstants" in the game's pipeline layout;
+// without it the clients' matrices are in uniform buffers of their own
+inline std::optional<uint32_t> clientConstantsOffset;
+
 inline VkPipelineLayout pipelineLayout;
 inline VkRenderPass renderPass;
 inline VkPipeline pipeline;
@@ -33,6 +86,42 @@ inline int indexCount;
 inline VkDescriptorSetLayout descriptorSetLayout;
 inline VkDescriptorPool descriptorPool;
 inline std::vector<VkDescriptorSetLayoutBinding> descriptorBindings;
+// the bindings that take dynamic offsets, in the order CmdBindDescriptorSets takes them
+struct DynamicBinding
+{
+	uint32_t binding;
+	// the client variables, otherwise a stolen descriptor
+	bool client;
+};
+inline std::vector<DynamicBinding> dynamicBindings;
+
+// where a descriptor binding's contents come from, its "_source" in the game's config
+enum class DescriptorSource
+{
+	Vars,
+	Client,
+	Texture,
+	Steal
+};
+struct DescriptorPlan
+{
+	DescriptorSource source;
+	uint32_t binding;
+	VkDescriptorType type;
+	// the game's binding a stolen descriptor is copied from
+	uint32_t srcBinding;
+	// into the dynamic offsets, -1 if the binding takes none
+	int dynamicIndex;
+};
+// what the draws need from the game's config, compiled once by the init so the frames do no JSON lookups
+struct DrawPlan
+{
+	VkRect2D renderArea;
+	std::vector<VkClearValue> clearValues;
+	std::vector<DescriptorPlan> descriptors;
+	bool steals;
+};
+inline DrawPlan drawPlan;
 
 struct GeneralVariables
 {
@@ -40,11 +129,16 @@ struct GeneralVariables
 	float partial_seconds;
 };
 inline VkBuffer generalVariablesBuffer;
-inline VkDeviceMemory generalVariablesMemory;
+inline gpu_allocation generalVariablesMemory;
 inline GeneralVariables* generalVariables;
 
+void parse_json_struct(json& json, void* p, std::string type);
 VkRect2D rect2D_from_json(json& j);
+// from the game's config, after the descriptors were created
+void compileDrawPlan(json& config);
 void updateGeneralVariables();
+// unloads the least recently used companions without users until they fit into vramBudget, from the draw thread only
+void evictCompanions(VkDevice device);
 
 inline std::map<std::string, std::unique_ptr<companion>> companions;
 inline std::vector<render_client*> clients;
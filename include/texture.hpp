@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct TextureLevel
+{
+	uint32_t width;
+	uint32_t height;
+	size_t offset;
+	size_t size;
+};
+
+// a texture with all of its mip levels back to back in data, level 0 first
+struct TextureData
+{
+	VkFormat format;
+	std::vector<TextureLevel> levels;
+	std::vector<uint8_t> data;
+	// set instead of data for levels that stay in a mapped file, owner keeps the mapping alive
+	const uint8_t* mapped = nullptr;
+	std::shared_ptr<const void> owner;
+
+	const uint8_t* bytes() const {return mapped ? mapped : data.data();}
+};
+
+TextureData load_png(const std::string& file);
+// the base color texture embedded in a glTF 2.0 binary, as PNG or JPEG
+TextureData load_glb_texture(const std::string& file);
+TextureData solid_color(glm::vec4 color, uint32_t size);
+// BC1, BC3 and BC7, from legacy DXT1/DXT5 headers or DX10 extended headers
+TextureData load_dds(const std::string& file);
+// BC1, BC3, BC7 and RGBA8 without supercompression
+TextureData load_ktx2(const std::string& file);
+
+// whether the levels are a mip chain in a format the loaders return, with the sizes they give the levels,
+// for textures whose level table comes from a file as it is
+bool valid_mip_chain(VkFormat format, const std::vector<TextureLevel>& levels);
+
+// identifies textures with the same format, levels and content
+uint64_t texture_hash(const TextureData& texture);
+
+// what load_dds() and load_ktx2() can return besides RGBA8, which a device may be unable to sample
+inline constexpr std::array<VkFormat, 8> blockCompressedFormats = {
+	VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC1_RGB_SRGB_BLOCK, VK_FORMAT_BC1_RGBA_UNORM_BLOCK, VK_FORMAT_BC1_RGBA_SRGB_BLOCK,
+	VK_FORMAT_BC3_UNORM_BLOCK, VK_FORMAT_BC3_SRGB_BLOCK, VK_FORMAT_BC7_UNORM_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK
+};
+bool is_block_compressed(VkFormat format);
+// decodes every level of a BC1, BC3 or BC7 texture to RGBA8 in the same color space
+TextureData decompress_blocks(const TextureData& texture);
+
+// replaces the levels after the first one with a box filtered chain down to 1x1, only for RGBA8 textures
+void generate_mipmaps(TextureData& texture);
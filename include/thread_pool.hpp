@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Every worker has its own deque: it takes its newest task first and steals the oldest ones of others when it runs dry.
+// Tasks submitted from a worker go to that worker's deque, everything else is spread round robin.
+class thread_pool
+{
+	public:
+		explicit thread_pool(unsigned threads = std::thread::hardware_concurrency());
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+		// finishes all queued tasks before returning
+		~thread_pool();
+
+		template<typename F>
+		auto submit(F&& f) -> std::future<std::invoke_result_t<F>>
+		{
+			using result = std::invoke_result_t<F>;
+			auto task = std::make_shared<std::packaged_task<result()>>(std::forward<F>(f));
+			std::future<result> future = task->get_future();
+			push([task](){ (*task)(); });
+			return future;
+		}
+
+		size_t size() const {return m_threads.size();}
+	private:
+		struct worker_queue
+		{
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		void push(std::function<void()> task);
+		bool pop(size_t index, std::function<void()>& task);
+		void run(size_t index);
+
+		std::vector<std::unique_ptr<worker_queue>> m_queues;
+		std::vector<std::thread> m_threads;
+		std::atomic<size_t> m_next = 0;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		size_t m_pending = 0;
+		bool m_stop = false;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "frame_tracker.hpp"
+#include "gpu_allocator.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+// One persistently mapped uniform buffer split into a slot per frame in flight, for uniforms that the draws write
+// every frame and bind through dynamic offsets, so the descriptors pointing at the buffer never change.
+// A frame's slot is reused once the GPU finished the frame. Only used from the draw thread.
+class uniform_ring
+{
+	public:
+		struct slice
+		{
+			uint32_t offset;
+			uint8_t* mapped;
+		};
+
+		// room for count allocations of up to size bytes per frame, for as many frames as there are slots
+		uniform_ring(VkDevice device, VkDeviceSize size, uint32_t count, uint32_t slots);
+		uniform_ring(const uniform_ring&) = delete;
+		uniform_ring& operator=(const uniform_ring&) = delete;
+		~uniform_ring();
+
+		// takes a free slot for the frame being recorded, false if the GPU is still busy with all of them
+		bool begin();
+		// part of the current slot, aligned for dynamic offsets
+		slice allocate(VkDeviceSize size);
+		// hands the slot over to frames, which gives it back once the GPU finished everything recorded so far
+		void retire(frame_tracker& frames);
+
+		VkBuffer buffer() const {return m_buffer;}
+	private:
+		VkDevice m_device;
+		VkBuffer m_buffer;
+		gpu_allocation m_memory;
+		VkDeviceSize m_alignment;
+		VkDeviceSize m_slotSize;
+
+		std::optional<uint32_t> m_current;
+		VkDeviceSize m_used = 0;
+		std::vector<uint32_t> m_free;
+};
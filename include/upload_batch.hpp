@@ -0,0 +1,91 @@
+#pragma once
+
+#include "gpu_allocator.hpp"
+#include "texture.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <vector>
+
+// What the device offers to skip staging copies, detected once by the upload service.
+struct direct_upload
+{
+	// device local, host visible and coherent memory types on the main device local heap, as on unified memory or with ReBAR
+	uint32_t memoryTypes = 0;
+	// from VK_EXT_host_image_copy, null if the extension is not enabled
+	PFN_vkCopyMemoryToImageEXT copyMemoryToImage = nullptr;
+	PFN_vkTransitionImageLayoutEXT transitionImageLayout = nullptr;
+};
+
+// Collects the copies of many assets into one persistently mapped staging arena and one command buffer,
+// so all of them cost a single submit and a single fence wait.
+class upload_batch
+{
+	public:
+		upload_batch(VkDevice device, direct_upload direct = {});
+		upload_batch(const upload_batch&) = delete;
+		upload_batch& operator=(const upload_batch&) = delete;
+		~upload_batch();
+
+		// the data is copied into the arena right away and can be released after the call; a concurrent buffer is
+		// shared by both queue families and gets plain barriers for the written range instead of an ownership transfer
+		void uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size, bool concurrent = false);
+		// uploads levelCount levels starting at firstLevel and leaves them in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		// other levels are not touched and can be read meanwhile
+		void uploadImage(VkImage image, const TextureData& texture, uint32_t firstLevel = 0, uint32_t levelCount = VK_REMAINING_MIP_LEVELS);
+
+		// the staging-free paths, usable without a submit; a buffer's memory has to come from directMemoryType(),
+		// an image has to be created with VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT after hostImageCopy() said yes
+		bool directMemoryType(uint32_t typeBits, uint32_t& type) const;
+		// offset is relative to the start of the allocation
+		void writeMemory(const gpu_allocation& memory, VkDeviceSize offset, const void* data, VkDeviceSize size);
+		bool hostImageCopy(VkFormat format) const;
+		// writes the levels from the host and leaves them in VK_IMAGE_LAYOUT_GENERAL
+		void writeImage(VkImage image, const TextureData& texture, uint32_t firstLevel = 0, uint32_t levelCount = VK_REMAINING_MIP_LEVELS);
+
+		// records all copies and layout transitions into commandBuffer, the staging memory has to stay alive until it finished;
+		// if the families differ the resources are released from srcFamily to dstFamily, which then has to record acquireBarriers()
+		void record(VkCommandBuffer commandBuffer, uint32_t srcFamily = VK_QUEUE_FAMILY_IGNORED, uint32_t dstFamily = VK_QUEUE_FAMILY_IGNORED);
+		void acquireBarriers(uint32_t srcFamily, uint32_t dstFamily,
+			std::vector<VkBufferMemoryBarrier>& buffers, std::vector<VkImageMemoryBarrier>& images) const;
+
+		bool empty() const {return m_bufferCopies.empty() && m_imageCopies.empty();}
+		VkDeviceSize stagedBytes() const {return m_stagedBytes;}
+		VkDeviceSize writtenBytes() const {return m_writtenBytes;}
+	private:
+		struct chunk
+		{
+			VkBuffer buffer;
+			VkDeviceMemory memory;
+			uint8_t* mapped;
+			VkDeviceSize size;
+			VkDeviceSize used;
+		};
+		struct buffer_copy
+		{
+			VkBuffer source;
+			VkBuffer destination;
+			VkBufferCopy region;
+			bool concurrent;
+		};
+		struct image_copy
+		{
+			VkBuffer source;
+			VkImage destination;
+			uint32_t firstLevel;
+			uint32_t levelCount;
+			std::vector<VkBufferImageCopy> regions;
+		};
+
+		// returns the chunk and sets offset to where size bytes can be written
+		chunk& allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+
+		VkDevice m_device;
+		direct_upload m_direct;
+		std::vector<chunk> m_chunks;
+		std::vector<buffer_copy> m_bufferCopies;
+		std::vector<image_copy> m_imageCopies;
+		VkDeviceSize m_stagedBytes = 0;
+		VkDeviceSize m_writtenBytes = 0;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "logger.hpp"
+#include "upload_batch.hpp"
+
+#include <vulkan/vulkan.h>
+#include <nlohmann/json.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Uploads assets in the background, so neither big assets nor late ones ever stall a frame.
+// Requests queued while a submission is being prepared are batched into the next one, finished
+// submissions are found through their fences and hand their resources over in acquire().
+//
+// With "uploadQueue" in config.json the uploads go to queue "index" of "family", by default the first transfer-only family,
+// and the resources are handed over to "graphicsFamily" with ownership transfers. That queue has to be one that the game
+// created but never submits to itself. Without it the batches are only filled in the background and acquire() submits them
+// to the layer's transfer queue, one at a time, so that queue and its command buffer are only used from the draw thread.
+// With direct set, memory that is both device local and host visible and VK_EXT_host_image_copy are offered to the batches,
+// the latter only if createInfo, the game's create info of the device, enabled the extension and its hostImageCopy feature.
+// Streamed requests wait until acquire() lets them through, at most streamBudget bytes each time.
+class upload_service
+{
+	public:
+		// fills the batch on the upload thread, the logger is only valid during the call
+		using fill_function = std::function<void(CheekyLayer::active_logger&, upload_batch&)>;
+		// called from acquire() once the GPU finished the copies, with false if the fill threw or the batch could not
+		// be submitted; then it frees whatever its fill created, nothing uses that anymore by then
+		using resident_function = std::function<void(bool ok)>;
+
+		upload_service(VkDevice device, const VkDeviceCreateInfo* createInfo, const nlohmann::json& config, bool direct, VkDeviceSize streamBudget);
+		upload_service(const upload_service&) = delete;
+		upload_service& operator=(const upload_service&) = delete;
+		~upload_service();
+
+		void upload(fill_function fill, resident_function resident);
+		// for uploads that can wait, bytes is about what the request is going to transfer; the first one in line
+		// always gets through, so a request bigger than the budget only takes a frame of its own
+		void stream(VkDeviceSize bytes, fill_function fill, resident_function resident);
+
+		// records the acquire side of the ownership transfers of finished uploads and marks them resident,
+		// then lets the next streamed requests through; meant to be called once per frame
+		// outside of a render pass, with a command buffer for the graphics queue family
+		void acquire(VkCommandBuffer commandBuffer);
+
+		// the upload and the graphics family when they differ, a buffer that is written in parts while the draws read
+		// its other parts has to be created concurrent for them instead of having its ownership transferred
+		std::vector<uint32_t> sharingFamilies() const;
+		const direct_upload& direct() const {return m_direct;}
+	private:
+		struct request
+		{
+			fill_function fill;
+			resident_function resident;
+		};
+		struct streamed_request
+		{
+			VkDeviceSize bytes;
+			request r;
+		};
+		struct submission
+		{
+			std::unique_ptr<upload_batch> batch;
+			VkCommandBuffer commandBuffer;
+			VkFence fence;
+			std::vector<resident_function> resident;
+			// of the requests whose fill threw, told once the batch is done with what they left in it
+			std::vector<resident_function> failed;
+		};
+
+		void run();
+		void submit(std::vector<request>& requests);
+		// records and submits the batch, freeing the command buffer and the fence again if that fails
+		void send(submission& s);
+		// hands the resident callbacks over to acquire(), with the acquire barriers if the copies finished
+		void finish(submission& s, bool ok);
+		// moves finished submissions over to acquire(), waiting up to timeout nanoseconds for the oldest one
+		void retire(uint64_t timeout);
+		// without a queue of its own: finishes the submission on the layer's queue once done and sends the next one
+		void submitPrepared();
+
+		VkDevice m_device;
+		VkQueue m_queue;
+		uint32_t m_queueFamily = VK_QUEUE_FAMILY_IGNORED;
+		uint32_t m_graphicsFamily = VK_QUEUE_FAMILY_IGNORED;
+		// null when sharing the layer's transfer command buffer
+		VkCommandPool m_commandPool = VK_NULL_HANDLE;
+		direct_upload m_direct;
+
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		bool m_stop = false;
+		std::vector<request> m_requests;
+		std::deque<streamed_request> m_streamed;
+		VkDeviceSize m_streamBudget;
+		std::vector<VkBufferMemoryBarrier> m_bufferAcquires;
+		std::vector<VkImageMemoryBarrier> m_imageAcquires;
+		std::vector<std::pair<resident_function, bool>> m_resident;
+		// filled batches waiting for acquire() to submit them to the layer's transfer queue
+		std::deque<submission> m_prepared;
+
+		// only touched by the upload thread
+		std::vector<submission> m_inFlight;
+		// only touched by the draw thread, the one submission on the layer's transfer queue
+		std::optional<submission> m_submitted;
+
+		std::thread m_thread;
+};
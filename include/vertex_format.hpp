@@ -0,0 +1,44 @@
+#pragma once
+
+#include "mesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+
+enum class VertexFormat : uint32_t
+{
+	// Vertex as is, 32 bytes
+	Float,
+	// PackedVertex, 16 bytes
+	Quantized
+};
+
+// Positions are R16G16B16A16_UNORM relative to the mesh bounds (w is always 1), normals are octahedral encoded
+// R16G16_SNORM and texture coordinates are R16G16_SFLOAT. The vertex shader has to undo the position mapping
+// with the VertexDequantization push constants and decode the normal:
+//   vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+//   if(n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+//   n = normalize(n);
+struct PackedVertex
+{
+	uint16_t position[4];
+	int16_t normal[2];
+	uint16_t texCoord[2];
+};
+static_assert(sizeof(PackedVertex) == 16);
+
+// position = packed.xyz * scale.xyz + bias.xyz, laid out as a std430 push constant block at offset 0
+struct VertexDequantization
+{
+	glm::vec4 scale;
+	glm::vec4 bias;
+};
+
+VertexFormat parse_vertex_format(const std::string& name);
+size_t vertex_stride(VertexFormat format);
+
+VertexDequantization vertex_dequantization(glm::vec3 boundsMin, glm::vec3 boundsMax);
+PackedVertex pack_vertex(const Vertex& vertex, const VertexDequantization& dequantization);
+Vertex unpack_vertex(const PackedVertex& vertex, const VertexDequantization& dequantization);
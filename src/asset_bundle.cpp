@@ -0,0 +1,232 @@
+#include "asset_bundle.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+struct asset_bundle::header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t entryCount;
+	uint64_t entryOffset;
+	uint64_t nameOffset;
+};
+
+struct asset_bundle::entry
+{
+	uint64_t nameOffset;
+	uint32_t nameSize;
+	BundleEntry kind;
+	uint64_t offset;
+	uint64_t size;
+};
+
+// what a texture entry starts with, the levels follow and then the data, which starts aligned
+struct texture_header
+{
+	VkFormat format;
+	uint32_t levelCount;
+	uint64_t dataOffset;
+};
+struct texture_level
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;
+	uint64_t size;
+};
+
+static constexpr char bundleMagic[4] = {'C', 'C', 'B', 'N'};
+static constexpr size_t dataAlignment = 64;
+
+static size_t align(size_t offset, size_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+// whether size bytes at offset lie within limit, without the sum overflowing for corrupt values
+static bool fits(uint64_t offset, uint64_t size, uint64_t limit)
+{
+	return offset <= limit && size <= limit - offset;
+}
+
+asset_bundle::asset_bundle(const std::string& path)
+{
+	// only the table of contents and the manifests are needed right away, the assets once companions are used
+	m_file = std::make_shared<mapped_file>(path, false);
+	const uint8_t* data = m_file->data();
+	size_t size = m_file->size();
+
+	if(size < sizeof(header))
+		throw std::runtime_error("asset bundle is too small: "+path);
+	const header& h = *reinterpret_cast<const header*>(data);
+	if(std::memcmp(h.magic, bundleMagic, sizeof(bundleMagic)) != 0)
+		throw std::runtime_error("not an asset bundle: "+path);
+	if(h.version != version)
+		throw std::runtime_error("asset bundle "+path+" has version "+std::to_string(h.version)+" instead of "+std::to_string(version));
+	if(h.entryOffset % alignof(entry) != 0 || h.nameOffset > size || h.entryOffset > h.nameOffset ||
+		h.entryCount > (h.nameOffset - h.entryOffset) / sizeof(entry))
+		throw std::runtime_error("corrupt asset bundle: "+path);
+
+	const entry* entries = reinterpret_cast<const entry*>(data + h.entryOffset);
+	for(uint64_t i=0; i<h.entryCount; i++)
+	{
+		const entry& e = entries[i];
+		// an unknown kind would be handed to the readers of another one
+		if(!fits(e.nameOffset, e.nameSize, size - h.nameOffset) || !fits(e.offset, e.size, size) || e.offset % dataAlignment != 0 ||
+			e.kind > BundleEntry::Texture)
+			throw std::runtime_error("corrupt asset bundle: "+path);
+		std::string name(reinterpret_cast<const char*>(data + h.nameOffset + e.nameOffset), e.nameSize);
+		m_entries[{name, e.kind}] = {data + e.offset, e.size};
+	}
+}
+
+std::vector<std::string> asset_bundle::companions() const
+{
+	std::vector<std::string> names;
+	for(const auto& [key, data] : m_entries)
+		if(key.second == BundleEntry::Manifest)
+			names.push_back(key.first);
+	return names;
+}
+
+bool asset_bundle::contains(const std::string& name, BundleEntry kind) const
+{
+	return m_entries.contains({name, kind});
+}
+
+std::span<const uint8_t> asset_bundle::find(const std::string& name, BundleEntry kind) const
+{
+	auto it = m_entries.find({name, kind});
+	if(it == m_entries.end())
+		throw std::runtime_error("asset bundle has no "+std::string(kind == BundleEntry::Manifest ? "manifest" : kind == BundleEntry::Mesh ? "mesh" : "texture")+" for "+name);
+	return it->second;
+}
+
+std::string_view asset_bundle::manifest(const std::string& name) const
+{
+	auto data = find(name, BundleEntry::Manifest);
+	return {reinterpret_cast<const char*>(data.data()), data.size()};
+}
+
+std::optional<cooked_mesh> asset_bundle::mesh(const std::string& name, const cook_options& options) const
+{
+	auto data = find(name, BundleEntry::Mesh);
+	return cooked_mesh::view(m_file, data.data(), data.size(), options);
+}
+
+TextureData asset_bundle::texture(const std::string& name) const
+{
+	auto data = find(name, BundleEntry::Texture);
+	if(data.size() < sizeof(texture_header))
+		throw std::runtime_error("corrupt texture in asset bundle for "+name);
+	const texture_header& h = *reinterpret_cast<const texture_header*>(data.data());
+	if(h.levelCount == 0 || h.levelCount > (data.size() - sizeof(texture_header)) / sizeof(texture_level) ||
+		h.dataOffset < sizeof(texture_header) + h.levelCount * sizeof(texture_level) || h.dataOffset > data.size())
+		throw std::runtime_error("corrupt texture in asset bundle for "+name);
+
+	TextureData texture{h.format};
+	const texture_level* levels = reinterpret_cast<const texture_level*>(data.data() + sizeof(texture_header));
+	for(uint32_t i=0; i<h.levelCount; i++)
+	{
+		if(!fits(levels[i].offset, levels[i].size, data.size() - h.dataOffset))
+			throw std::runtime_error("corrupt texture in asset bundle for "+name);
+		texture.levels.push_back({levels[i].width, levels[i].height, levels[i].offset, levels[i].size});
+	}
+	// the uploads copy width * height texels of each level, so a level smaller than that would be read past
+	if(!valid_mip_chain(texture.format, texture.levels))
+		throw std::runtime_error("corrupt texture in asset bundle for "+name);
+	texture.mapped = data.data() + h.dataOffset;
+	texture.owner = m_file;
+	return texture;
+}
+
+void bundle_writer::add(const std::string& name, BundleEntry kind, std::span<const uint8_t> data)
+{
+	m_entries.push_back({name, kind, {data.begin(), data.end()}});
+}
+
+void bundle_writer::addManifest(const std::string& name, std::string_view manifest)
+{
+	add(name, BundleEntry::Manifest, {reinterpret_cast<const uint8_t*>(manifest.data()), manifest.size()});
+}
+
+void bundle_writer::addTexture(const std::string& name, const TextureData& texture)
+{
+	size_t dataOffset = align(sizeof(texture_header) + texture.levels.size() * sizeof(texture_level), dataAlignment);
+	size_t dataSize = 0;
+	for(const auto& level : texture.levels)
+		dataSize = std::max(dataSize, level.offset + level.size);
+
+	std::vector<uint8_t> data(dataOffset + dataSize);
+	texture_header h{texture.format, static_cast<uint32_t>(texture.levels.size()), dataOffset};
+	std::memcpy(data.data(), &h, sizeof(h));
+	for(size_t i=0; i<texture.levels.size(); i++)
+	{
+		const TextureLevel& level = texture.levels[i];
+		texture_level l{level.width, level.height, level.offset, level.size};
+		std::memcpy(data.data() + sizeof(texture_header) + i * sizeof(texture_level), &l, sizeof(l));
+	}
+	std::memcpy(data.data() + dataOffset, texture.bytes(), dataSize);
+	m_entries.push_back({name, BundleEntry::Texture, std::move(data)});
+}
+
+void bundle_writer::write(const std::string& path) const
+{
+	// the manifests go first, so reading them at startup touches only the start of the file
+	std::vector<const pending*> order;
+	for(const auto& e : m_entries)
+		order.push_back(&e);
+	std::stable_sort(order.begin(), order.end(), [](const pending* a, const pending* b) { return a->kind < b->kind; });
+
+	std::string names;
+	std::vector<asset_bundle::entry> entries;
+	for(const pending* e : order)
+	{
+		entries.push_back({names.size(), static_cast<uint32_t>(e->name.size()), e->kind, 0, e->data.size()});
+		names += e->name;
+	}
+
+	asset_bundle::header h{};
+	std::memcpy(h.magic, bundleMagic, sizeof(bundleMagic));
+	h.version = asset_bundle::version;
+	h.entryCount = entries.size();
+	h.entryOffset = align(sizeof(h), alignof(asset_bundle::entry));
+	h.nameOffset = h.entryOffset + entries.size() * sizeof(asset_bundle::entry);
+	size_t offset = h.nameOffset + names.size();
+	for(auto& e : entries)
+	{
+		e.offset = align(offset, dataAlignment);
+		offset = e.offset + e.size;
+	}
+
+	std::vector<uint8_t> buffer(offset);
+	std::memcpy(buffer.data(), &h, sizeof(h));
+	std::memcpy(buffer.data() + h.entryOffset, entries.data(), entries.size() * sizeof(asset_bundle::entry));
+	std::memcpy(buffer.data() + h.nameOffset, names.data(), names.size());
+	for(size_t i=0; i<entries.size(); i++)
+		std::memcpy(buffer.data() + entries[i].offset, order[i]->data.data(), order[i]->data.size());
+
+	std::string temporary = path + ".tmp" + std::to_string(getpid());
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		if(!out)
+			throw std::runtime_error("cannot create asset bundle: "+temporary);
+		out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+		if(!out)
+		{
+			out.close();
+			std::remove(temporary.c_str());
+			throw std::runtime_error("cannot write asset bundle: "+temporary);
+		}
+	}
+	if(std::rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		std::remove(temporary.c_str());
+		throw std::runtime_error("cannot replace asset bundle: "+path);
+	}
+}
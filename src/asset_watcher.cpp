@@ -0,0 +1,116 @@
+#include "asset_watcher.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// how long a directory has to stay quiet before its changes are reported
+static constexpr auto settleTime = std::chrono::milliseconds(250);
+static constexpr int pollTimeout = 100;
+
+asset_watcher::asset_watcher(const std::string& directory, change_function onChange)
+	: m_directory(directory), m_onChange(std::move(onChange))
+{
+	m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(m_fd < 0)
+		throw std::runtime_error("failed to initialize inotify: "+std::string(std::strerror(errno)));
+
+	try
+	{
+		watch("");
+		for(const auto& entry : std::filesystem::directory_iterator(m_directory))
+			if(entry.is_directory())
+				watch(entry.path().filename().string());
+
+		m_thread = std::thread(&asset_watcher::run, this);
+	}
+	catch(...)
+	{
+		close(m_fd);
+		throw;
+	}
+}
+
+asset_watcher::~asset_watcher()
+{
+	m_stop = true;
+	m_thread.join();
+	close(m_fd);
+}
+
+void asset_watcher::watch(const std::string& name)
+{
+	uint32_t mask = name.empty() ? IN_CREATE | IN_MOVED_TO | IN_ONLYDIR : IN_CLOSE_WRITE | IN_MOVED_TO;
+	int wd = inotify_add_watch(m_fd, (m_directory+"/"+name).c_str(), mask);
+	if(wd < 0)
+		throw std::runtime_error("failed to watch "+m_directory+"/"+name+": "+std::strerror(errno));
+	m_watches[wd] = name;
+}
+
+void asset_watcher::watchNew(const std::string& name)
+{
+	watch(name);
+	// files that were written before the watch existed have no events, like those of a directory that was moved in
+	for(const auto& entry : std::filesystem::directory_iterator(m_directory+"/"+name))
+		if(entry.is_regular_file())
+		{
+			m_changes[name].insert(entry.path().filename().string());
+			m_lastChange = std::chrono::steady_clock::now();
+		}
+}
+
+void asset_watcher::run()
+{
+	alignas(inotify_event) char buffer[4096];
+	while(!m_stop)
+	{
+		pollfd p{m_fd, POLLIN, 0};
+		if(poll(&p, 1, pollTimeout) > 0)
+		{
+			ssize_t length;
+			while((length = read(m_fd, buffer, sizeof(buffer))) > 0)
+			{
+				for(char* e = buffer; e < buffer + length; e += sizeof(inotify_event) + ((inotify_event*)e)->len)
+				{
+					const inotify_event* event = (const inotify_event*)e;
+					auto it = m_watches.find(event->wd);
+					if(it == m_watches.end())
+						continue;
+					// the kernel removed the watch, because its directory was deleted or moved away
+					if(event->mask & IN_IGNORED)
+					{
+						m_watches.erase(it);
+						continue;
+					}
+					if(event->len == 0)
+						continue;
+
+					if(it->second.empty())
+					{
+						// a directory that is gone again by now does not need a watch
+						if(event->mask & IN_ISDIR)
+							try { watchNew(event->name); } catch(const std::exception&) {}
+					}
+					else
+					{
+						m_changes[it->second].insert(event->name);
+						m_lastChange = std::chrono::steady_clock::now();
+					}
+				}
+			}
+		}
+
+		if(!m_changes.empty() && std::chrono::steady_clock::now() - m_lastChange > settleTime)
+		{
+			auto changes = std::move(m_changes);
+			m_changes.clear();
+			for(auto& [name, files] : changes)
+				m_onChange(name, files);
+		}
+	}
+}
@@ -0,0 +1,346 @@
+#include "texture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+	struct rgba
+	{
+		uint8_t c[4];
+	};
+
+	// reads a block LSB first, as BC7 stores its fields
+	class bit_reader
+	{
+		public:
+			bit_reader(const uint8_t* block) : m_block(block) {}
+
+			uint32_t read(uint32_t count)
+			{
+				uint32_t value = 0;
+				for(uint32_t i=0; i<count; i++, m_position++)
+					value |= ((m_block[m_position / 8] >> (m_position % 8)) & 1u) << i;
+				return value;
+			}
+		private:
+			const uint8_t* m_block;
+			uint32_t m_position = 0;
+	};
+
+	uint8_t expand565(uint32_t value, uint32_t bits)
+	{
+		return static_cast<uint8_t>(value << (8 - bits) | value >> (2 * bits - 8));
+	}
+
+	// alpha 0 for the fourth color of 3-color blocks, unless the block is the color part of BC3
+	void decode_bc1(const uint8_t* block, rgba out[16], bool alpha, bool forceFourColors)
+	{
+		uint16_t c0 = block[0] | block[1] << 8;
+		uint16_t c1 = block[2] | block[3] << 8;
+		uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | static_cast<uint32_t>(block[7]) << 24;
+
+		rgba colors[4];
+		colors[0] = {expand565(c0 >> 11, 5), expand565(c0 >> 5 & 0x3f, 6), expand565(c0 & 0x1f, 5), 255};
+		colors[1] = {expand565(c1 >> 11, 5), expand565(c1 >> 5 & 0x3f, 6), expand565(c1 & 0x1f, 5), 255};
+		if(c0 > c1 || forceFourColors)
+		{
+			for(int i=0; i<3; i++)
+			{
+				colors[2].c[i] = static_cast<uint8_t>((2 * colors[0].c[i] + colors[1].c[i]) / 3);
+				colors[3].c[i] = static_cast<uint8_t>((colors[0].c[i] + 2 * colors[1].c[i]) / 3);
+			}
+			colors[2].c[3] = colors[3].c[3] = 255;
+		}
+		else
+		{
+			for(int i=0; i<3; i++)
+				colors[2].c[i] = static_cast<uint8_t>((colors[0].c[i] + colors[1].c[i]) / 2);
+			colors[2].c[3] = 255;
+			colors[3] = {0, 0, 0, static_cast<uint8_t>(alpha ? 0 : 255)};
+		}
+		for(int i=0; i<16; i++)
+			out[i] = colors[indices >> (2 * i) & 3];
+	}
+
+	void decode_bc3(const uint8_t* block, rgba out[16])
+	{
+		decode_bc1(block + 8, out, false, true);
+
+		uint8_t alphas[8] = {block[0], block[1]};
+		if(alphas[0] > alphas[1])
+		{
+			for(int i=1; i<7; i++)
+				alphas[i + 1] = static_cast<uint8_t>(((7 - i) * alphas[0] + i * alphas[1]) / 7);
+		}
+		else
+		{
+			for(int i=1; i<5; i++)
+				alphas[i + 1] = static_cast<uint8_t>(((5 - i) * alphas[0] + i * alphas[1]) / 5);
+			alphas[6] = 0;
+			alphas[7] = 255;
+		}
+		uint64_t indices = 0;
+		for(int i=0; i<6; i++)
+			indices |= static_cast<uint64_t>(block[2 + i]) << (8 * i);
+		for(int i=0; i<16; i++)
+			out[i].c[3] = alphas[indices >> (3 * i) & 7];
+	}
+
+	// the BC7 tables of the Khronos Data Format Specification
+	constexpr uint8_t partitions2[64][16] = {
+		{0,0,1,1,0,0,1,1,0,0,1,1,0,0,1,1}, {0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1}, {0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1}, {0,0,0,1,0,0,1,1,0,0,1,1,0,1,1,1},
+		{0,0,0,0,0,0,0,1,0,0,0,1,0,0,1,1}, {0,0,1,1,0,1,1,1,0,1,1,1,1,1,1,1}, {0,0,0,1,0,0,1,1,0,1,1,1,1,1,1,1}, {0,0,0,0,0,0,0,1,0,0,1,1,0,1,1,1},
+		{0,0,0,0,0,0,0,0,0,0,0,1,0,0,1,1}, {0,0,1,1,0,1,1,1,1,1,1,1,1,1,1,1}, {0,0,0,0,0,0,0,1,0,1,1,1,1,1,1,1}, {0,0,0,0,0,0,0,0,0,0,0,1,0,1,1,1},
+		{0,0,0,1,0,1,1,1,1,1,1,1,1,1,1,1}, {0,0,0,0,0,0,0,0,1,1,1,1,1,1,1,1}, {0,0,0,0,1,1,1,1,1,1,1,1,1,1,1,1}, {0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1},
+		{0,0,0,0,1,0,0,0,1,1,1,0,1,1,1,1}, {0,1,1,1,0,0,0,1,0,0,0,0,0,0,0,0}, {0,0,0,0,0,0,0,0,1,0,0,0,1,1,1,0}, {0,1,1,1,0,0,1,1,0,0,0,1,0,0,0,0},
+		{0,0,1,1,0,0,0,1,0,0,0,0,0,0,0,0}, {0,0,0,0,1,0,0,0,1,1,0,0,1,1,1,0}, {0,0,0,0,0,0,0,0,1,0,0,0,1,1,0,0}, {0,1,1,1,0,0,1,1,0,0,1,1,0,0,0,1},
+		{0,0,1,1,0,0,0,1,0,0,0,1,0,0,0,0}, {0,0,0,0,1,0,0,0,1,0,0,0,1,1,0,0}, {0,1,1,0,0,1,1,0,0,1,1,0,0,1,1,0}, {0,0,1,1,0,1,1,0,0,1,1,0,1,1,0,0},
+		{0,0,0,1,0,1,1,1,1,1,1,0,1,0,0,0}, {0,0,0,0,1,1,1,1,1,1,1,1,0,0,0,0}, {0,1,1,1,0,0,0,1,1,0,0,0,1,1,1,0}, {0,0,1,1,1,0,0,1,1,0,0,1,1,1,0,0},
+		{0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,1}, {0,0,0,0,1,1,1,1,0,0,0,0,1,1,1,1}, {0,1,0,1,1,0,1,0,0,1,0,1,1,0,1,0}, {0,0,1,1,0,0,1,1,1,1,0,0,1,1,0,0},
+		{0,0,1,1,1,1,0,0,0,0,1,1,1,1,0,0}, {0,1,0,1,0,1,0,1,1,0,1,0,1,0,1,0}, {0,1,1,0,1,0,0,1,0,1,1,0,1,0,0,1}, {0,1,0,1,1,0,1,0,1,0,1,0,0,1,0,1},
+		{0,1,1,1,0,0,1,1,1,1,0,0,1,1,1,0}, {0,0,0,1,0,0,1,1,1,1,0,0,1,0,0,0}, {0,0,1,1,0,0,1,0,0,1,0,0,1,1,0,0}, {0,0,1,1,1,0,1,1,1,1,0,1,1,1,0,0},
+		{0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0}, {0,0,1,1,1,1,0,0,1,1,0,0,0,0,1,1}, {0,1,1,0,0,1,1,0,1,0,0,1,1,0,0,1}, {0,0,0,0,0,1,1,0,0,1,1,0,0,0,0,0},
+		{0,1,0,0,1,1,1,0,0,1,0,0,0,0,0,0}, {0,0,1,0,0,1,1,1,0,0,1,0,0,0,0,0}, {0,0,0,0,0,0,1,0,0,1,1,1,0,0,1,0}, {0,0,0,0,0,1,0,0,1,1,1,0,0,1,0,0},
+		{0,1,1,0,1,1,0,0,1,0,0,1,0,0,1,1}, {0,0,1,1,0,1,1,0,1,1,0,0,1,0,0,1}, {0,1,1,0,0,0,1,1,1,0,0,1,1,1,0,0}, {0,0,1,1,1,0,0,1,1,1,0,0,0,1,1,0},
+		{0,1,1,0,1,1,0,0,1,1,0,0,1,0,0,1}, {0,1,1,0,0,0,1,1,0,0,1,1,1,0,0,1}, {0,1,1,1,1,1,1,0,1,0,0,0,0,0,0,1}, {0,0,0,1,1,0,0,0,1,1,1,0,0,1,1,1},
+		{0,0,0,0,1,1,1,1,0,0,1,1,0,0,1,1}, {0,0,1,1,0,0,1,1,1,1,1,1,0,0,0,0}, {0,0,1,0,0,0,1,0,1,1,1,0,1,1,1,0}, {0,1,0,0,0,1,0,0,0,1,1,1,0,1,1,1}
+	};
+	constexpr uint8_t partitions3[64][16] = {
+		{0,0,1,1,0,0,1,1,0,2,2,1,2,2,2,2}, {0,0,0,1,0,0,1,1,2,2,1,1,2,2,2,1}, {0,0,0,0,2,0,0,1,2,2,1,1,2,2,1,1}, {0,2,2,2,0,0,2,2,0,0,1,1,0,1,1,1},
+		{0,0,0,0,0,0,0,0,1,1,2,2,1,1,2,2}, {0,0,1,1,0,0,1,1,0,0,2,2,0,0,2,2}, {0,0,2,2,0,0,2,2,1,1,1,1,1,1,1,1}, {0,0,1,1,0,0,1,1,2,2,1,1,2,2,1,1},
+		{0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2}, {0,0,0,0,1,1,1,1,1,1,1,1,2,2,2,2}, {0,0,0,0,1,1,1,1,2,2,2,2,2,2,2,2}, {0,0,1,2,0,0,1,2,0,0,1,2,0,0,1,2},
+		{0,1,1,2,0,1,1,2,0,1,1,2,0,1,1,2}, {0,1,2,2,0,1,2,2,0,1,2,2,0,1,2,2}, {0,0,1,1,0,1,1,2,1,1,2,2,1,2,2,2}, {0,0,1,1,2,0,0,1,2,2,0,0,2,2,2,0},
+		{0,0,0,1,0,0,1,1,0,1,1,2,1,1,2,2}, {0,1,1,1,0,0,1,1,2,0,0,1,2,2,0,0}, {0,0,0,0,1,1,2,2,1,1,2,2,1,1,2,2}, {0,0,2,2,0,0,2,2,0,0,2,2,1,1,1,1},
+		{0,1,1,1,0,1,1,1,0,2,2,2,0,2,2,2}, {0,0,0,1,0,0,0,1,2,2,2,1,2,2,2,1}, {0,0,0,0,0,0,1,1,0,1,2,2,0,1,2,2}, {0,0,0,0,1,1,0,0,2,2,1,0,2,2,1,0},
+		{0,1,2,2,0,1,2,2,0,0,1,1,0,0,0,0}, {0,0,1,2,0,0,1,2,1,1,2,2,2,2,2,2}, {0,1,1,0,1,2,2,1,1,2,2,1,0,1,1,0}, {0,0,0,0,0,1,1,0,1,2,2,1,1,2,2,1},
+		{0,0,2,2,1,1,0,2,1,1,0,2,0,0,2,2}, {0,1,1,0,0,1,1,0,2,0,0,2,2,2,2,2}, {0,0,1,1,0,1,2,2,0,1,2,2,0,0,1,1}, {0,0,0,0,2,0,0,0,2,2,1,1,2,2,2,1},
+		{0,0,0,0,0,0,0,2,1,1,2,2,1,2,2,2}, {0,2,2,2,0,0,2,2,0,0,1,2,0,0,1,1}, {0,0,1,1,0,0,1,2,0,0,2,2,0,2,2,2}, {0,1,2,0,0,1,2,0,0,1,2,0,0,1,2,0},
+		{0,0,0,0,1,1,1,1,2,2,2,2,0,0,0,0}, {0,1,2,0,1,2,0,1,2,0,1,2,0,1,2,0}, {0,1,2,0,2,0,1,2,1,2,0,1,0,1,2,0}, {0,0,1,1,2,2,0,0,1,1,2,2,0,0,1,1},
+		{0,0,1,1,1,1,2,2,2,2,0,0,0,0,1,1}, {0,1,0,1,0,1,0,1,2,2,2,2,2,2,2,2}, {0,0,0,0,0,0,0,0,2,1,2,1,2,1,2,1}, {0,0,2,2,1,1,2,2,0,0,2,2,1,1,2,2},
+		{0,0,2,2,0,0,1,1,0,0,2,2,0,0,1,1}, {0,2,2,0,1,2,2,1,0,2,2,0,1,2,2,1}, {0,1,0,1,2,2,2,2,2,2,2,2,0,1,0,1}, {0,0,0,0,2,1,2,1,2,1,2,1,2,1,2,1},
+		{0,1,0,1,0,1,0,1,0,1,0,1,2,2,2,2}, {0,2,2,2,0,1,1,1,0,2,2,2,0,1,1,1}, {0,0,0,2,1,1,1,2,0,0,0,2,1,1,1,2}, {0,0,0,0,2,1,1,2,2,1,1,2,2,1,1,2},
+		{0,2,2,2,0,1,1,1,0,1,1,1,0,2,2,2}, {0,0,0,2,1,1,1,2,1,1,1,2,0,0,0,2}, {0,1,1,0,0,1,1,0,0,1,1,0,2,2,2,2}, {0,0,0,0,0,0,0,0,2,1,1,2,2,1,1,2},
+		{0,1,1,0,0,1,1,0,2,2,2,2,2,2,2,2}, {0,0,2,2,0,0,1,1,0,0,1,1,0,0,2,2}, {0,0,2,2,1,1,2,2,1,1,2,2,0,0,2,2}, {0,0,0,0,0,0,0,0,0,0,0,0,2,1,1,2},
+		{0,0,0,2,0,0,0,1,0,0,0,2,0,0,0,1}, {0,2,2,2,1,2,2,2,0,2,2,2,1,2,2,2}, {0,1,0,1,2,2,2,2,2,2,2,2,2,2,2,2}, {0,1,1,1,2,0,1,1,2,2,0,1,2,2,2,0}
+	};
+	// the texels whose indices have one bit less, besides the first one
+	constexpr uint8_t anchors2[64] = {
+		15,15,15,15,15,15,15,15, 15,15,15,15,15,15,15,15, 15, 2, 8, 2, 2, 8, 8,15,  2, 8, 2, 2, 8, 8, 2, 2,
+		15,15, 6, 8, 2, 8,15,15,  2, 8, 2, 2, 2,15,15, 6,  6, 2, 6, 8,15,15, 2, 2, 15,15,15,15,15, 2, 2,15
+	};
+	constexpr uint8_t anchors3Second[64] = {
+		 3, 3,15,15, 8, 3,15,15,  8, 8, 6, 6, 6, 5, 3, 3,  3, 3, 8,15, 3, 3, 6,10,  5, 8, 8, 6, 8, 5,15,15,
+		 8,15, 3, 5, 6,10, 8,15, 15, 3,15, 5,15,15,15,15,  3,15, 5, 5, 5, 8, 5,10,  5,10, 8,13,15,12, 3, 3
+	};
+	constexpr uint8_t anchors3Third[64] = {
+		15, 8, 8, 3,15,15, 3, 8, 15,15,15,15,15,15,15, 8, 15, 8,15, 3,15, 8,15, 8,  3,15, 6,10,15,15,10, 8,
+		15, 3,15,10,10, 8, 9,10,  6,15, 8,15, 3, 6, 6, 8, 15, 3,15,15,15,15,15,15, 15,15,15,15, 3,15,15, 8
+	};
+	constexpr uint8_t weights2[4] = {0, 21, 43, 64};
+	constexpr uint8_t weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+	constexpr uint8_t weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+	struct bc7_mode
+	{
+		uint32_t subsets;
+		uint32_t partitionBits;
+		uint32_t rotationBits;
+		uint32_t indexSelectionBits;
+		uint32_t colorBits;
+		uint32_t alphaBits;
+		// one p-bit per endpoint or one shared by both endpoints of a subset
+		uint32_t endpointPBits;
+		uint32_t sharedPBits;
+		uint32_t indexBits;
+		uint32_t secondaryIndexBits;
+	};
+	constexpr bc7_mode bc7Modes[8] = {
+		{3, 4, 0, 0, 4, 0, 1, 0, 3, 0},
+		{2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+		{3, 6, 0, 0, 5, 0, 0, 0, 2, 0},
+		{2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+		{1, 0, 2, 1, 5, 6, 0, 0, 2, 3},
+		{1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+		{1, 0, 0, 0, 7, 7, 1, 0, 4, 0},
+		{2, 6, 0, 0, 5, 5, 1, 0, 2, 0}
+	};
+
+	uint8_t interpolate(uint8_t e0, uint8_t e1, uint32_t index, uint32_t bits)
+	{
+		const uint8_t* weights = bits == 2 ? weights2 : bits == 3 ? weights3 : weights4;
+		return static_cast<uint8_t>(((64 - weights[index]) * e0 + weights[index] * e1 + 32) >> 6);
+	}
+
+	uint8_t unquantize(uint32_t value, uint32_t bits)
+	{
+		value <<= 8 - bits;
+		return static_cast<uint8_t>(value | value >> bits);
+	}
+
+	void decode_bc7(const uint8_t* block, rgba out[16])
+	{
+		uint32_t mode = 0;
+		while(mode < 8 && !(block[0] >> mode & 1))
+			mode++;
+		// reserved, decodes to transparent black
+		if(mode == 8)
+		{
+			std::memset(out, 0, sizeof(rgba) * 16);
+			return;
+		}
+		const bc7_mode& m = bc7Modes[mode];
+
+		bit_reader bits(block);
+		bits.read(mode + 1);
+		uint32_t partition = bits.read(m.partitionBits);
+		uint32_t rotation = bits.read(m.rotationBits);
+		uint32_t indexSelection = bits.read(m.indexSelectionBits);
+
+		uint32_t endpoints[6][4] = {};
+		for(uint32_t c=0; c<3; c++)
+			for(uint32_t e=0; e<m.subsets*2; e++)
+				endpoints[e][c] = bits.read(m.colorBits);
+		for(uint32_t e=0; e<m.subsets*2; e++)
+			endpoints[e][3] = m.alphaBits ? bits.read(m.alphaBits) : 255;
+
+		uint32_t colorBits = m.colorBits, alphaBits = m.alphaBits;
+		if(m.endpointPBits || m.sharedPBits)
+		{
+			uint32_t pBits[6];
+			for(uint32_t e=0; e<m.subsets*2; e++)
+				pBits[e] = m.endpointPBits || e % 2 == 0 ? bits.read(1) : pBits[e - 1];
+			for(uint32_t e=0; e<m.subsets*2; e++)
+				for(uint32_t c=0; c<4; c++)
+					if(c < 3 || m.alphaBits)
+						endpoints[e][c] = endpoints[e][c] << 1 | pBits[e];
+			colorBits++;
+			if(alphaBits)
+				alphaBits++;
+		}
+		uint8_t colors[6][4];
+		for(uint32_t e=0; e<m.subsets*2; e++)
+		{
+			for(uint32_t c=0; c<3; c++)
+				colors[e][c] = unquantize(endpoints[e][c], colorBits);
+			colors[e][3] = alphaBits ? unquantize(endpoints[e][3], alphaBits) : 255;
+		}
+
+		auto subset_of = [&](uint32_t texel) -> uint32_t {
+			return m.subsets == 2 ? partitions2[partition][texel] : m.subsets == 3 ? partitions3[partition][texel] : 0;
+		};
+		auto is_anchor = [&](uint32_t texel) {
+			if(texel == 0)
+				return true;
+			if(m.subsets == 2)
+				return texel == anchors2[partition];
+			if(m.subsets == 3)
+				return texel == anchors3Second[partition] || texel == anchors3Third[partition];
+			return false;
+		};
+		uint32_t indices[16], secondaryIndices[16] = {};
+		for(uint32_t i=0; i<16; i++)
+			indices[i] = bits.read(m.indexBits - (is_anchor(i) ? 1 : 0));
+		if(m.secondaryIndexBits)
+			for(uint32_t i=0; i<16; i++)
+				secondaryIndices[i] = bits.read(m.secondaryIndexBits - (i == 0 ? 1 : 0));
+
+		for(uint32_t i=0; i<16; i++)
+		{
+			uint32_t s = subset_of(i);
+			const uint8_t* e0 = colors[2 * s];
+			const uint8_t* e1 = colors[2 * s + 1];
+			uint32_t colorIndex = indices[i], colorIndexBits = m.indexBits;
+			uint32_t alphaIndex = indices[i], alphaIndexBits = m.indexBits;
+			if(m.secondaryIndexBits)
+			{
+				// the selection bit swaps which of the two index sets the color uses
+				if(indexSelection)
+				{
+					colorIndex = secondaryIndices[i];
+					colorIndexBits = m.secondaryIndexBits;
+				}
+				else
+				{
+					alphaIndex = secondaryIndices[i];
+					alphaIndexBits = m.secondaryIndexBits;
+				}
+			}
+			for(uint32_t c=0; c<3; c++)
+				out[i].c[c] = interpolate(e0[c], e1[c], colorIndex, colorIndexBits);
+			out[i].c[3] = interpolate(e0[3], e1[3], alphaIndex, alphaIndexBits);
+			if(rotation)
+				std::swap(out[i].c[3], out[i].c[rotation - 1]);
+		}
+	}
+}
+
+bool is_block_compressed(VkFormat format)
+{
+	return std::find(blockCompressedFormats.begin(), blockCompressedFormats.end(), format) != blockCompressedFormats.end();
+}
+
+TextureData decompress_blocks(const TextureData& texture)
+{
+	bool srgb;
+	void (*decode)(const uint8_t*, rgba[16]);
+	size_t blockBytes;
+	switch(texture.format)
+	{
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+			srgb = texture.format == VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+			decode = [](const uint8_t* block, rgba out[16]){ decode_bc1(block, out, false, false); };
+			blockBytes = 8;
+			break;
+		case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+			srgb = texture.format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+			decode = [](const uint8_t* block, rgba out[16]){ decode_bc1(block, out, true, false); };
+			blockBytes = 8;
+			break;
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+			srgb = texture.format == VK_FORMAT_BC3_SRGB_BLOCK;
+			decode = &decode_bc3;
+			blockBytes = 16;
+			break;
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+			srgb = texture.format == VK_FORMAT_BC7_SRGB_BLOCK;
+			decode = &decode_bc7;
+			blockBytes = 16;
+			break;
+		default:
+			throw std::runtime_error("not a block compressed format: "+std::to_string(texture.format));
+	}
+
+	TextureData result{srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM};
+	for(const TextureLevel& level : texture.levels)
+	{
+		size_t blocksX = (level.width + 3) / 4, blocksY = (level.height + 3) / 4;
+		if(level.size < blocksX * blocksY * blockBytes)
+			throw std::runtime_error("block compressed level is truncated");
+
+		TextureLevel decoded{level.width, level.height, result.data.size(), static_cast<size_t>(level.width) * level.height * 4};
+		result.data.resize(decoded.offset + decoded.size);
+		const uint8_t* in = texture.bytes() + level.offset;
+		uint8_t* out = result.data.data() + decoded.offset;
+		for(size_t by=0; by<blocksY; by++)
+		{
+			for(size_t bx=0; bx<blocksX; bx++)
+			{
+				rgba texels[16];
+				decode(in + (by * blocksX + bx) * blockBytes, texels);
+				// the blocks at the right and bottom edges cover texels past the level
+				for(uint32_t y=0; y<4 && by*4 + y < level.height; y++)
+					for(uint32_t x=0; x<4 && bx*4 + x < level.width; x++)
+						std::memcpy(out + ((by*4 + y) * level.width + bx*4 + x) * 4, texels[y*4 + x].c, 4);
+			}
+		}
+		result.levels.push_back(decoded);
+	}
+	return result;
+}
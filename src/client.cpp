@@ -2,139 +2,237 @@
 #include "draw.hpp"
 #include "shared.hpp"
 
+#include "device_hooks.hpp"
 #include "dispatch.hpp"
 #include "rules/execution_env.hpp"
 #include "utils.hpp"
 
 #include <glm/ext/matrix_transform.hpp>
+#include <algorithm>
+#include <map>
+#include <mutex>
 #include <glm/fwd.hpp>
 #include <vulkan/vulkan_core.h>
 #include <vulkan/vulkan.hpp>
 
-void render_client::init(VkDevice device)
-{
-	VkResult r;
-
-	// client variables buffer
-	VkBufferCreateInfo bufferCreateInfo{};
-	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	bufferCreateInfo.size = sizeof(ClientVariables);
-	bufferCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-	
-	if((r = device_dispatch[GetKey(device)].CreateBuffer(device, &bufferCreateInfo, nullptr, &m_variablesBuffer)) != VK_SUCCESS)
-		throw std::runtime_error("failed to create client variables buffer: "+vk::to_string((vk::Result)r));
-
-	VkMemoryRequirements requirements;
-	device_dispatch[GetKey(device)].GetBufferMemoryRequirements(device, m_variablesBuffer, &requirements);
+// how many of the game's sets a companion keeps copies of the stolen descriptors for, games often cycle through a few
+static constexpr size_t maxStolenSets = 4;
 
-	VkMemoryAllocateInfo memoryallocateInfo{};
-	memoryallocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryallocateInfo.memoryTypeIndex = findMemoryType(deviceInfos[device].memory, requirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	memoryallocateInfo.allocationSize = requirements.size;
-
-	if(device_dispatch[GetKey(device)].AllocateMemory(device, &memoryallocateInfo, nullptr, &m_variablesMemory) != VK_SUCCESS)
-		throw std::runtime_error("failed to allocate memory for client variables buffer");
+struct client_descriptors
+{
+	struct stolen_set
+	{
+		VkDescriptorSet set;
+		// of the game's set when the descriptors were copied
+		uint64_t generation;
+		uint64_t lastUsed;
+	};
+
+	VkDevice device;
+	uint32_t textureGeneration = 0;
+	// a set for each of the game's sets the descriptors were stolen from, all with the current texture;
+	// just one under the null handle without steals
+	std::map<VkDescriptorSet, stolen_set> sets;
+	uint64_t selections = 0;
+	// the one selectSet() picked last, none until the companion is resident
+	VkDescriptorSet current = VK_NULL_HANDLE;
+
+	// the last client may go away while frames in flight still have the sets bound, like the companion's resources
+	~client_descriptors()
+	{
+		std::vector<VkDescriptorSet> freed;
+		for(auto& [source, s] : sets)
+			freed.push_back(s.set);
+		if(freed.empty())
+			return;
+		frames->defer([device = device, freed](){
+			device_dispatch[GetKey(device)].FreeDescriptorSets(device, descriptorPool, freed.size(), freed.data());
+		});
+	}
+};
 
-	if(device_dispatch[GetKey(device)].BindBufferMemory(device, m_variablesBuffer, m_variablesMemory, 0) != VK_SUCCESS)
-		throw std::runtime_error("failed to bind memory to client variables buffer");
+// the sets shared by the clients of each companion
+static std::mutex sharedDescriptorsMutex;
+static std::map<std::string, std::weak_ptr<client_descriptors>> sharedDescriptors;
+// retired sets the frames in flight are done with, reused before allocating new ones
+static std::vector<VkDescriptorSet> spareDescriptorSets;
 
-	if(device_dispatch[GetKey(device)].MapMemory(device, m_variablesMemory, 0, sizeof(ClientVariables), 0, (void**)&m_variables) != VK_SUCCESS)
-		throw std::runtime_error("failed to map memory for client variables buffer");
+static VkDescriptorSet take_descriptor_set(VkDevice device)
+{
+	{
+		std::unique_lock lock(sharedDescriptorsMutex);
+		if(!spareDescriptorSets.empty())
+		{
+			VkDescriptorSet set = spareDescriptorSets.back();
+			spareDescriptorSets.pop_back();
+			return set;
+		}
+	}
 
-	// descriptor set
 	VkDescriptorSetAllocateInfo allocateInfo{};
 	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocateInfo.descriptorPool = descriptorPool;
 	allocateInfo.descriptorSetCount = 1;
 	allocateInfo.pSetLayouts = &descriptorSetLayout;
 
-	r = device_dispatch[GetKey(device)].AllocateDescriptorSets(device, &allocateInfo, &m_descriptorSet);
+	VkDescriptorSet set;
+	VkResult r = device_dispatch[GetKey(device)].AllocateDescriptorSets(device, &allocateInfo, &set);
 	if(r != VK_SUCCESS)
 		throw std::runtime_error("failed to allocate descriptor set: "+vk::to_string((vk::Result)r));
+	return set;
+}
+
+// frames in flight may still have the set bound, so it is only written again once they are done
+static void retire_descriptor_set(VkDescriptorSet set)
+{
+	if(!set)
+		return;
+	frames->defer([set](){
+		std::unique_lock lock(sharedDescriptorsMutex);
+		spareDescriptorSets.push_back(set);
+	});
+}
+
+void render_client::init(VkDevice device)
+{
+	m_target = companions.at(m_companion).get();
+
+	std::unique_lock lock(sharedDescriptorsMutex);
+	if(auto shared = sharedDescriptors[m_companion].lock())
+	{
+		m_descriptors = shared;
+		return;
+	}
+	// the sets are written by selectSet() once the companion is resident
+	m_descriptors = std::make_shared<client_descriptors>();
+	m_descriptors->device = device;
+	sharedDescriptors[m_companion] = m_descriptors;
+}
+
+VkDescriptorSet render_client::descriptor_set()
+{
+	return m_descriptors->current;
+}
 
-	// update descriptor set
-	auto& companion = companions[m_companion];
-	auto descriptorCount = gameConfig["descriptors"].size();
+void render_client::selectSet(VkDevice device, VkDescriptorSet source)
+{
+	::companion* companion = m_target;
+	client_descriptors& d = *m_descriptors;
+	if(!companion->resident())
+		return;
+	if(companion->textureGeneration() != d.textureGeneration)
+	{
+		for(auto& [s, stolen] : d.sets)
+			retire_descriptor_set(stolen.set);
+		d.sets.clear();
+		d.textureGeneration = companion->textureGeneration();
+	}
+
+	uint64_t generation = source ? descriptor_set_generation(source) : 0;
+	auto found = d.sets.find(source);
+	if(found != d.sets.end() && found->second.generation == generation)
+	{
+		found->second.lastUsed = ++d.selections;
+		d.current = found->second.set;
+		return;
+	}
+	d.current = VK_NULL_HANDLE;
+	if(found != d.sets.end())
+	{
+		retire_descriptor_set(found->second.set);
+		d.sets.erase(found);
+	}
+	else if(d.sets.size() >= maxStolenSets)
+	{
+		auto oldest = std::min_element(d.sets.begin(), d.sets.end(), [](const auto& a, const auto& b){return a.second.lastUsed < b.second.lastUsed;});
+		retire_descriptor_set(oldest->second.set);
+		d.sets.erase(oldest);
+	}
 
-	std::vector<VkDescriptorBufferInfo> bufferInfos;	bufferInfos.reserve(descriptorCount);
-	std::vector<VkDescriptorImageInfo> imageInfos;		imageInfos.reserve(descriptorCount);
+	// sets the GPU may still read are never written, every new content goes into a set of its own
+	VkDescriptorSet set = take_descriptor_set(device);
+	std::vector<VkDescriptorBufferInfo> bufferInfos;	bufferInfos.reserve(drawPlan.descriptors.size());
+	VkDescriptorImageInfo imageInfo{};
+	if(companion->hasTexture())
+		imageInfo = companion->getTextureDescriptorInfo();
 	std::vector<VkWriteDescriptorSet> writes;
-	for(auto& d : gameConfig["descriptors"])
+	std::vector<VkCopyDescriptorSet> copies;
+	for(const DescriptorPlan& p : drawPlan.descriptors)
 	{
-		auto& source = d["_source"];
-		int dstBinding = d["binding"];
-		if(source["type"]=="vars")
+		if(p.source == DescriptorSource::Steal)
+		{
+			VkCopyDescriptorSet& copy = copies.emplace_back();
+			copy.sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET;
+			copy.srcSet = source;
+			copy.srcBinding = p.srcBinding;
+			copy.srcArrayElement = 0;
+			copy.dstSet = set;
+			copy.dstBinding = p.binding;
+			copy.dstArrayElement = 0;
+			copy.descriptorCount = 1;
+			continue;
+		}
+		if(p.source == DescriptorSource::Texture && !companion->hasTexture())
+			continue;
+
+		VkWriteDescriptorSet& write = writes.emplace_back();
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = p.binding;
+		write.dstArrayElement = 0;
+		write.descriptorCount = 1;
+		write.descriptorType = p.type;
+		if(p.source == DescriptorSource::Texture)
+		{
+			write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			write.pImageInfo = &imageInfo;
+			continue;
+		}
+
+		VkDescriptorBufferInfo& bufferInfo = bufferInfos.emplace_back();
+		if(p.source == DescriptorSource::Vars)
 		{
-			VkDescriptorType t = descriptorBindings.at(dstBinding).descriptorType;
-			
-			VkWriteDescriptorSet& write = writes.emplace_back();
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.dstSet = m_descriptorSet;
-			write.dstBinding = dstBinding;
-			write.dstArrayElement = 0;
-			write.descriptorCount = 1;
-			write.descriptorType = t;
-
-			VkDescriptorBufferInfo& bufferInfo = bufferInfos.emplace_back();
 			bufferInfo.buffer = generalVariablesBuffer;
 			bufferInfo.offset = 0;
 			bufferInfo.range = sizeof(GeneralVariables);
-			write.pBufferInfo = &bufferInfo;
-		}
-		else if(source["type"]=="texture")
-		{
-			if(companion->hasTexture())
-			{
-				VkWriteDescriptorSet& write = writes.emplace_back();
-				write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				write.dstSet = m_descriptorSet;
-				write.dstBinding = dstBinding;
-				write.dstArrayElement = 0;
-				write.descriptorCount = 1;
-				write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-
-				imageInfos.push_back(companion->getTextureDescriptorInfo());
-				write.pImageInfo = &imageInfos.back();
-			}
 		}
-		else if(source["type"]=="client")
+		else
 		{
-			VkDescriptorType t = descriptorBindings.at(dstBinding).descriptorType;
-
-			VkWriteDescriptorSet& write = writes.emplace_back();
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.dstSet = m_descriptorSet;
-			write.dstBinding = dstBinding;
-			write.dstArrayElement = 0;
-			write.descriptorCount = 1;
-			write.descriptorType = t;
-				
-			VkDescriptorBufferInfo& bufferInfo = bufferInfos.emplace_back();
-			bufferInfo.buffer = m_variablesBuffer;
+			// the client's part of the ring is selected with the dynamic offset
+			bufferInfo.buffer = clientVariables->buffer();
 			bufferInfo.offset = 0;
 			bufferInfo.range = sizeof(ClientVariables);
-			write.pBufferInfo = &bufferInfo;
 		}
+		write.pBufferInfo = &bufferInfo;
 	}
-	device_dispatch[GetKey(device)].UpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+	device_dispatch[GetKey(device)].UpdateDescriptorSets(device, writes.size(), writes.data(), copies.size(), copies.data());
+
+	d.sets[source] = {set, generation, ++d.selections};
+	d.current = set;
 }
 
 void render_client::destroy(VkDevice device)
 {
-	device_dispatch[GetKey(device)].FreeDescriptorSets(device, descriptorPool, 1, &m_descriptorSet);
-
-	device_dispatch[GetKey(device)].DestroyBuffer(device, m_variablesBuffer, nullptr);
-
-	device_dispatch[GetKey(device)].UnmapMemory(device, m_variablesMemory);
-	device_dispatch[GetKey(device)].FreeMemory(device, m_variablesMemory, nullptr);
+	// the set goes with the last client sharing it
+	m_descriptors.reset();
 }
 
-void render_client::update()
+glm::mat4 render_client::matrix()
 {
 	glm::mat4 rotate = glm::rotate(glm::mat4(1.0), m_yaw, glm::vec3(0.0, 1.0, 0.0));
 	glm::mat4 translate = glm::translate(glm::mat4(1.0), m_position);
-	m_variables->matrix = translate * rotate;
-	//m_variables->matrix = glm::mat4(1.0);
+	return translate * rotate;
+}
+
+ClientConstants render_client::constants()
+{
+	std::chrono::duration<float> age = std::chrono::steady_clock::now() - m_joined;
+	return {.matrix = matrix(), .lod = m_lod, .age = age.count()};
+}
+
+void render_client::update(uniform_ring& ring)
+{
+	uniform_ring::slice slice = ring.allocate(sizeof(ClientVariables));
+	reinterpret_cast<ClientVariables*>(slice.mapped)->matrix = matrix();
+	m_variablesOffset = slice.offset;
 }
@@ -1,442 +1,814 @@
 #include "companion.hpp"
+#include "mesh.hpp"
 #include "dispatch.hpp"
 #include "layer.hpp"
 #include "logger.hpp"
 #include "utils.hpp"
-#include "image.hpp"
+#include "shared.hpp"
+#include "texture.hpp"
+#include "hash.hpp"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
-#include <glm/glm.hpp>
 #include <fstream>
+#include <glm/glm.hpp>
 #include <glm/gtx/string_cast.hpp>
-#include <iomanip>
-#include <ios>
-#include <iterator>
-#include <sstream>
 #include <stdexcept>
 #include <string>
-#include <tuple>
 #include <vulkan/vulkan_core.h>
-#include <stb_image.h>
+#include <vulkan/vulkan.hpp>
+
+companion::companion(json& json, std::string filebase, std::shared_ptr<const asset_bundle> bundle) : m_directory(filebase), m_bundle(std::move(bundle))
+{
+	configure(json, filebase);
+}
 
-companion::companion(json& json, std::string filebase)
+void companion::configure(json& json, std::string filebase)
 {
+	std::unique_lock lock(m_configMutex);
 	m_id = json["id"];
 
 	if(json["modelType"] == "obj") 		m_modelType = Obj;
+	if(json["modelType"] == "glb") 		m_modelType = Glb;
 	m_modelFile = filebase + "/" + (std::string)json["modelFile"];
+	m_cookOptions.split = json.value("splitMesh", false);
+	m_cookOptions.optimize = json.value("optimizeMesh", true);
+	m_cookOptions.overdraw = json.value("optimizeOverdraw", false);
+	m_cookOptions.lodLevels = json.value("lodLevels", 4);
+	// the error a level may have per unit of distance, and how far past its switching distance a level stays
+	m_lodThreshold = json.value("lodThreshold", 0.001f);
+	m_lodHysteresis = json.value("lodHysteresis", 0.1f);
 
 	if(json["textureType"] == "none") 	m_textureType = None;
 	if(json["textureType"] == "png") 	m_textureType = Png;
 	if(json["textureType"] == "color") 	m_textureType = Color;
+	if(json["textureType"] == "dds") 	m_textureType = Dds;
+	if(json["textureType"] == "ktx2") 	m_textureType = Ktx2;
+	if(json["textureType"] == "glb") 	m_textureType = Embedded;
 
-	if(m_textureType == Png)
+	if(m_textureType == Png || m_textureType == Dds || m_textureType == Ktx2)
 		m_textureArgument = filebase + "/" + (std::string)json["textureFile"];
+	// the texture embedded in the model, unless textureFile names another GLB file
+	if(m_textureType == Embedded)
+		m_textureArgument = json.contains("textureFile") ? filebase + "/" + (std::string)json["textureFile"] : m_modelFile;
 	if(m_textureType == Color)
 		m_textureArgument = glm::vec4(json["textureColor"]["r"].get<float>(), 
 			json["textureColor"]["g"].get<float>(), json["textureColor"]["b"].get<float>(), json["textureColor"]["a"].get<float>());
+	// compressed textures bring their own mip levels
+	m_generateMipmaps = json.value("generateMipmaps", true);
+	m_samplerConfig = json.value("sampler", nlohmann::json::object());
+	// the largest level size uploaded right away, the finer levels stream in later; 0 uploads everything at once
+	m_streamTextureTail = json.value("streamTextureTail", 0u);
 }
 
-struct Vertex
+cooked_mesh companion::loadMesh(bool& stale)
 {
-	glm::vec3 position;
-	glm::vec3 normal;
-	glm::vec2 texCoord;
-};
+	mesh_loader loader;
+	switch(m_modelType)
+	{
+		case Obj:
+			loader = &load_obj;
+			break;
+		case Glb:
+			loader = &load_glb;
+			break;
+	}
+	return load_cooked_mesh(modelFile(), meshCacheFile(), loader, m_cookOptions, stale);
+}
 
-std::tuple<std::vector<Vertex>,std::vector<uint16_t>> load_obj(std::string file)
+std::string companion::modelFile()
 {
-	std::vector<glm::vec3> positions;
-	std::vector<glm::vec3> normals;
-	std::vector<glm::vec2> texCoords;
-	std::vector<std::tuple<int, int, int>> indices;
-
-	std::ifstream obj(file);
-	if(!obj)
-		throw std::runtime_error("file not found: "+file);
+	std::unique_lock lock(m_configMutex);
+	return m_modelFile;
+}
 
-	std::string line;
-	while(std::getline(obj, line))
-	{
-		std::istringstream is(line);
-		std::string type;
-		is >> type;
-		if(type=="v")
-		{
-			float x, y, z;
-			is >> x >> y >> z;
-			positions.push_back({x, y, z});
-		}
-		if(type=="vt")
-		{
-			float u, v;
-			is >> u >> v;
-			texCoords.push_back({u, -v});
-		}
-		if(type=="vn")
-		{
-			float x, y, z;
-			is >> x >> y >> z;
-			normals.push_back({x, y, z});
-		}
-		if(type=="f")
-		{
-			std::array<std::string, 3> args;
-			is >> args[0] >> args[1] >> args[2];
-			for(int i=0; i<3; i++)
-			{
-				std::stringstream s(args[i]);
-				int vertex, uv, normal;
+std::string companion::meshCacheFile()
+{
+	// companions that cook the same model differently, like with another vertex format, keep a cache each
+	std::unique_lock lock(m_configMutex);
+	return m_modelFile + "." + std::to_string(m_cookOptions.key()) + ".cache";
+}
 
-				s >> vertex;
-				s.ignore(1);
-				s >> uv;
-				s.ignore(1);
-				s >> normal;
+std::variant<std::string, glm::vec4> companion::textureArgument()
+{
+	std::unique_lock lock(m_configMutex);
+	return m_textureArgument;
+}
 
-				indices.push_back({vertex-1, uv-1, normal-1});
-			}
-		}
+void companion::decodeMesh()
+{
+	m_meshCacheRebuilt = false;
+	m_meshCacheError.clear();
+	if(m_bundle)
+	{
+		m_decodedMesh = m_bundle->mesh(bundleName(), m_cookOptions);
+		if(!m_decodedMesh)
+			throw std::runtime_error("the bundle's mesh was packed with other cook options, pack it again");
+		return;
 	}
 
-	std::vector<Vertex> vertices;
-	std::vector<std::tuple<int, int, int>> indexCombos;
-	std::vector<uint16_t> newIndices;
-	for(int i=0; i<indices.size(); i++)
+	bool stale;
+	m_decodedMesh = loadMesh(stale);
+	if(stale)
 	{
-		auto index = indices[i];
-		auto p = std::find(indexCombos.begin(), indexCombos.end(), index);
-		if(p == indexCombos.end())
+		try
 		{
-			newIndices.push_back(vertices.size());
-			auto [pos, tex, nor] = index;
-			vertices.push_back({positions[pos], normals[nor], texCoords[tex]});
-			indexCombos.push_back(index);
+			m_decodedMesh->write(meshCacheFile());
+			m_meshCacheRebuilt = true;
 		}
-		else
+		catch(const std::exception& ex)
 		{
-			newIndices.push_back(std::distance(indexCombos.begin(), p));
+			m_meshCacheError = ex.what();
 		}
 	}
-
-	return {vertices, newIndices};
 }
 
-void companion::uploadMesh(VkDevice device, CheekyLayer::active_logger& logger)
+void companion::decodeTexture()
 {
-	std::vector<Vertex> vertices;
-	std::vector<uint16_t> indices;
+	if(m_textureType == None)
+		return;
+	// bundles hold their textures with the final levels already
+	m_decodedTexture = m_bundle ? m_bundle->texture(bundleName()) : loadTexture();
+	// the device cannot sample the format, the decoded levels keep the texture's mip chain
+	if(is_block_compressed(m_decodedTexture->format) && !sampledBlockFormats.contains(m_decodedTexture->format))
+		m_decodedTexture = decompress_blocks(*m_decodedTexture);
+	m_decodedTextureHash = texture_hash(*m_decodedTexture);
+}
 
-	switch(m_modelType)
+TextureData companion::loadTexture()
+{
+	TextureData texture;
+	auto argument = textureArgument();
+	switch(m_textureType)
 	{
-		case Obj:
-			std::tie(vertices, indices) = load_obj(m_modelFile);
+		case None:
+			break;
+		case Png:
+			texture = load_png(std::get<std::string>(argument));
+			break;
+		case Color:
+			texture = solid_color(std::get<glm::vec4>(argument), 4);
+			break;
+		case Dds:
+			texture = load_dds(std::get<std::string>(argument));
+			break;
+		case Ktx2:
+			texture = load_ktx2(std::get<std::string>(argument));
+			break;
+		case Embedded:
+			texture = load_glb_texture(std::get<std::string>(argument));
 			break;
 	}
-	logger << "[" << m_id << "] loaded mesh with " << vertices.size() << " vertices and " << indices.size() << " indices!\n";
+	if(m_generateMipmaps && texture.levels.size() == 1 &&
+		(texture.format == VK_FORMAT_R8G8B8A8_SRGB || texture.format == VK_FORMAT_R8G8B8A8_UNORM))
+		generate_mipmaps(texture);
+	return texture;
+}
 
-	VkBuffer vertexBuffer;
-	VkBuffer indexBuffer;
-	VkDeviceMemory memory;
+std::string companion::bundleName()
+{
+	return std::filesystem::path(m_directory).filename().string();
+}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingMemory;
+void companion::uploadMesh(VkDevice device, CheekyLayer::active_logger& logger, upload_batch& batch)
+{
+	if(!m_decodedMesh)
+		decodeMesh();
+	cooked_mesh mesh = std::move(*m_decodedMesh);
+	m_decodedMesh.reset();
+	if(m_meshCacheRebuilt)
+		logger << "[" << m_id << "] rebuilt mesh cache " << meshCacheFile() << "\n";
+	if(!m_meshCacheError.empty())
+		logger << "[" << m_id << "] failed to write mesh cache: " << m_meshCacheError << "\n";
+	auto vertexData = mesh.vertexData();
+	auto indexData = mesh.indexData();
+	logger << "[" << m_id << "] loaded mesh with " << mesh.vertexCount() << " " << (mesh.vertexFormat() == VertexFormat::Quantized ? "quantized " : "")
+		<< "vertices and " << mesh.indexCount() << " "
+		<< (mesh.indexType() == IndexType::Uint16 ? "16" : "32") << " bit indices in " << mesh.submeshes().size() << " submeshes and " << mesh.lods().size() << " levels of detail!\n";
+	logger << "[" << m_id << "] ACMR " << mesh.acmrBefore() << " -> " << mesh.acmrAfter() << "\n";
+
+	// the same source cooked the same way gives the same mesh
+	uint64_t key[] = {mesh.sourceHash(), m_cookOptions.key()};
+	uint64_t meshKey = content_hash(key, sizeof(key));
+	m_meshShared = false;
+	if(auto shared = meshCache.acquire(meshKey))
+	{
+		logger << "[" << m_id << "] shares its mesh with other companions\n";
+		m_meshKey = meshKey;
+		m_meshShared = true;
+		m_renderMesh = *shared;
+		m_meshBytes = m_renderMesh.residentBytes();
+		return;
+	}
+
+	m_renderMesh = {
+		.vertexFormat = mesh.vertexFormat(),
+		.dequantization = mesh.dequantization(),
+		.indexType = mesh.indexType() == IndexType::Uint16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32,
+		.submeshes = {mesh.submeshes().begin(), mesh.submeshes().end()},
+		.lods = {mesh.lods().begin(), mesh.lods().end()},
+		.radius = glm::length(mesh.bounds().max - mesh.bounds().min) / 2.0f
+	};
+	VkDeviceSize vertexStride = vertex_stride(mesh.vertexFormat());
+	VkDeviceSize indexSize = mesh.indexType() == IndexType::Uint16 ? 2 : 4;
+	if(auto range = geometry->allocate(vertexData.size(), vertexStride, indexData.size()))
+	{
+		m_renderMesh.geometry = range;
+		geometry->write(batch, *range, vertexData.data(), indexData.data());
+		m_renderMesh.vertexBuffer = geometry->vertexBuffer();
+		m_renderMesh.indexBuffer = geometry->indexBuffer();
+		m_renderMesh.firstIndex = range->indexOffset / indexSize;
+		m_renderMesh.vertexOffset = range->vertexOffset / vertexStride;
+		m_meshBytes = m_renderMesh.residentBytes();
+		if(meshCache.insert(meshKey, m_renderMesh))
+			m_meshKey = meshKey;
+		return;
+	}
+	logger << "[" << m_id << "] does not fit into the geometry store anymore and gets buffers of its own\n";
+
+	// what exists so far is kept in m_renderMesh, for uploadFailed() to free
+	VkBuffer& vertexBuffer = m_renderMesh.vertexBuffer;
+	VkBuffer& indexBuffer = m_renderMesh.indexBuffer;
 
 	VkBufferCreateInfo vertexBufferCreateInfo{};
 	vertexBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	vertexBufferCreateInfo.size = vertices.size() * sizeof(Vertex);
+	vertexBufferCreateInfo.size = vertexData.size();
 	vertexBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 	vertexBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	if(device_dispatch[GetKey(device)].CreateBuffer(device, &vertexBufferCreateInfo, nullptr, &vertexBuffer) != VK_SUCCESS)
+	{
+		vertexBuffer = VK_NULL_HANDLE;
 		throw std::runtime_error("failed to create vertex buffer");
+	}
 	
 	VkBufferCreateInfo indexBufferCreateInfo{};
 	indexBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	indexBufferCreateInfo.size = indices.size() * sizeof(uint16_t);
+	indexBufferCreateInfo.size = indexData.size();
 	indexBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
 	indexBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	if(device_dispatch[GetKey(device)].CreateBuffer(device, &indexBufferCreateInfo, nullptr, &indexBuffer) != VK_SUCCESS)
+	{
+		indexBuffer = VK_NULL_HANDLE;
 		throw std::runtime_error("failed to create index buffer");
+	}
 
-	VkBufferCreateInfo stagingBufferCreateInfo{};
-	stagingBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	stagingBufferCreateInfo.size = vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint16_t);
-	stagingBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	stagingBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	if(device_dispatch[GetKey(device)].CreateBuffer(device, &stagingBufferCreateInfo, nullptr, &stagingBuffer) != VK_SUCCESS)
-		throw std::runtime_error("failed to create staging buffer");
-	
 	VkMemoryRequirements vertexBufferMemoryRequirements;
 	VkMemoryRequirements indexBufferMemoryRequirements;
 	device_dispatch[GetKey(device)].GetBufferMemoryRequirements(device, vertexBuffer, &vertexBufferMemoryRequirements);
 	device_dispatch[GetKey(device)].GetBufferMemoryRequirements(device, indexBuffer, &indexBufferMemoryRequirements);
 
-	VkMemoryRequirements stagingBufferMemoryRequirements;
-	device_dispatch[GetKey(device)].GetBufferMemoryRequirements(device, stagingBuffer, &stagingBufferMemoryRequirements);
-
-	VkMemoryAllocateInfo memoryallocateInfo{};
-	memoryallocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryallocateInfo.allocationSize = vertexBufferMemoryRequirements.size + indexBufferMemoryRequirements.size;
-	memoryallocateInfo.memoryTypeIndex = findMemoryType(deviceInfos[device].memory, 
-		vertexBufferMemoryRequirements.memoryTypeBits | indexBufferMemoryRequirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	if(device_dispatch[GetKey(device)].AllocateMemory(device, &memoryallocateInfo, nullptr, &memory) != VK_SUCCESS)
-		throw std::runtime_error("failed to allocate memory");
-	
-	VkMemoryAllocateInfo stagingMemoryallocateInfo{};
-	stagingMemoryallocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	stagingMemoryallocateInfo.allocationSize = stagingBufferMemoryRequirements.size;
-	stagingMemoryallocateInfo.memoryTypeIndex = findMemoryType(deviceInfos[device].memory, 
-		stagingBufferMemoryRequirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	if(device_dispatch[GetKey(device)].AllocateMemory(device, &stagingMemoryallocateInfo, nullptr, &stagingMemory) != VK_SUCCESS)
-		throw std::runtime_error("failed to allocate staging memory");
-
-	if(device_dispatch[GetKey(device)].BindBufferMemory(device, vertexBuffer, memory, 0) != VK_SUCCESS)
+	VkDeviceSize indexOffset = (vertexBufferMemoryRequirements.size + indexBufferMemoryRequirements.alignment - 1)
+		/ indexBufferMemoryRequirements.alignment * indexBufferMemoryRequirements.alignment;
+	// both buffers share one allocation
+	VkMemoryRequirements requirements{};
+	requirements.size = indexOffset + indexBufferMemoryRequirements.size;
+	requirements.alignment = std::max(vertexBufferMemoryRequirements.alignment, indexBufferMemoryRequirements.alignment);
+	requirements.memoryTypeBits = vertexBufferMemoryRequirements.memoryTypeBits & indexBufferMemoryRequirements.memoryTypeBits;
+	uint32_t memoryType;
+	bool direct = batch.directMemoryType(requirements.memoryTypeBits, memoryType);
+	gpu_allocation& memory = m_renderMesh.memory;
+	memory = direct ? allocator->allocateOfType(requirements, memoryType, true)
+		: allocator->allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+	m_meshBytes = memory.size;
+
+	if(device_dispatch[GetKey(device)].BindBufferMemory(device, vertexBuffer, memory.memory, memory.offset) != VK_SUCCESS)
 		throw std::runtime_error("failed to bind memory to vertex buffer");
-	if(device_dispatch[GetKey(device)].BindBufferMemory(device, indexBuffer, memory, vertexBufferMemoryRequirements.size) != VK_SUCCESS)
-		throw std::runtime_error("failed to bind memory to vertex buffer");
-	if(device_dispatch[GetKey(device)].BindBufferMemory(device, stagingBuffer, stagingMemory, 0) != VK_SUCCESS)
-		throw std::runtime_error("failed to bind memory to staging buffer");
-	
+	if(device_dispatch[GetKey(device)].BindBufferMemory(device, indexBuffer, memory.memory, memory.offset + indexOffset) != VK_SUCCESS)
+		throw std::runtime_error("failed to bind memory to index buffer");
+
+	if(direct)
 	{
-		void* stagingPointer;
-		if(device_dispatch[GetKey(device)].MapMemory(device, stagingMemory, 0, VK_WHOLE_SIZE, 0, &stagingPointer) != VK_SUCCESS)
-			throw std::runtime_error("failed to map staging memory");
-		std::copy(vertices.begin(), vertices.end(), (Vertex*)((uint8_t*)stagingPointer + 0));
-		std::copy(indices.begin(), indices.end(), (uint16_t*)((uint8_t*)stagingPointer + vertexBufferCreateInfo.size));
-		device_dispatch[GetKey(device)].UnmapMemory(device, stagingMemory);
+		batch.writeMemory(memory, 0, vertexData.data(), vertexData.size());
+		batch.writeMemory(memory, indexOffset, indexData.data(), indexData.size());
+	}
+	else
+	{
+		batch.uploadBuffer(vertexBuffer, 0, vertexData.data(), vertexData.size());
+		batch.uploadBuffer(indexBuffer, 0, indexData.data(), indexData.size());
 	}
 
-	VkCommandBuffer commandBuffer = transferCommandBuffers[device];
-	if(device_dispatch[GetKey(device)].ResetCommandBuffer(commandBuffer, 0) != VK_SUCCESS)
-		throw std::runtime_error("failed to reset command buffer");
-
-	VkCommandBufferBeginInfo beginInfo{};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	if(device_dispatch[GetKey(device)].BeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
-		throw std::runtime_error("failed to begin the command buffer");
-	
-	VkBufferCopy copyVertexRegion{};
-	copyVertexRegion.srcOffset = 0;
-	copyVertexRegion.dstOffset = 0;
-	copyVertexRegion.size = vertexBufferCreateInfo.size;
-	device_dispatch[GetKey(device)].CmdCopyBuffer(commandBuffer, stagingBuffer, vertexBuffer, 1, &copyVertexRegion);
-
-	VkBufferCopy copyIndexRegion{};
-	copyIndexRegion.srcOffset = vertexBufferCreateInfo.size;
-	copyIndexRegion.dstOffset = 0;
-	copyIndexRegion.size = indexBufferCreateInfo.size;
-	device_dispatch[GetKey(device)].CmdCopyBuffer(commandBuffer, stagingBuffer, indexBuffer, 1, &copyIndexRegion);
-
-	if(device_dispatch[GetKey(device)].EndCommandBuffer(commandBuffer) != VK_SUCCESS)
-		throw std::runtime_error("failed to end command buffer");
-	
-	VkQueue queue = transferQueues[device];
-
-	if(device_dispatch[GetKey(device)].QueueWaitIdle(queue) != VK_SUCCESS)
-		throw std::runtime_error("cannot wait for queue to be idle before copying");
-	
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-	if(device_dispatch[GetKey(device)].QueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
-		throw std::runtime_error("failed to submit command buffer");
-
-	if(device_dispatch[GetKey(device)].QueueWaitIdle(queue) != VK_SUCCESS)
-		throw std::runtime_error("cannot wait for queue to be idle after copying");
-
-	device_dispatch[GetKey(device)].DestroyBuffer(device, stagingBuffer, nullptr);
-	device_dispatch[GetKey(device)].FreeMemory(device, stagingMemory, nullptr);
-
-	m_renderMesh = {.indexCount = static_cast<uint32_t>(indices.size()), .indexBuffer = indexBuffer, .vertexBuffers={vertexBuffer}, .memory = memory};
+	m_renderMesh.firstIndex = 0;
+	m_renderMesh.vertexOffset = 0;
+	if(meshCache.insert(meshKey, m_renderMesh))
+		m_meshKey = meshKey;
 }
 
-void companion::uploadTexture(VkDevice device, CheekyLayer::active_logger &logger)
+void companion::uploadTexture(VkDevice device, CheekyLayer::active_logger &logger, upload_batch& batch)
 {
 	if(m_textureType == None)
 		return;
-	
-	int w, h, comp;
-	uint8_t* buf;
 
-	if(m_textureType == Png)
-	{
-		std::string path = std::get<std::string>(m_textureArgument);
-		if(!std::filesystem::exists(path))
-			throw std::runtime_error("file not foind: "+path);
-
-		buf = stbi_load(path.c_str(), &w, &h, &comp, STBI_rgb_alpha);
-		logger << "[" << m_id << "] Loaded image " << path << " with size of " << w << "x" << h << ".\n";
-	}
-	else if(m_textureType == Color)
-	{
-		glm::vec4 cv = std::get<glm::vec4>(m_textureArgument);
-		image_tools::image::color color = image_tools::color(cv);
-		w = 4;
-		h = 4;
-		buf = new uint8_t[w*h*4];
-		std::fill(reinterpret_cast<uint32_t*>(buf), reinterpret_cast<uint32_t*>(buf)+(w*h), color);
-		logger << "[" << m_id << "] Created image of color " << glm::to_string(cv) << " (converted to " 
-			<< std::hex << std::showbase << std::internal << std::setw(8) << color << std::dec << ") with size of " << w << "x" << h << ".\n";
-	}
+	if(!m_decodedTexture)
+		decodeTexture();
+	auto streamed = std::make_shared<TextureData>(std::move(*m_decodedTexture));
+	const TextureData& texture = *streamed;
+	m_decodedTexture.reset();
+	uint64_t hash = m_decodedTextureHash;
 
-	VkImage image;
-	VkImageView imageView;
-	VkSampler sampler;
-	VkDeviceMemory memory;
+	auto argument = textureArgument();
+	if(m_textureType == Color)
+		logger << "[" << m_id << "] Created image of color " << glm::to_string(std::get<glm::vec4>(argument)) << " with size of "
+			<< texture.levels[0].width << "x" << texture.levels[0].height << ".\n";
+	else
+		logger << "[" << m_id << "] Loaded " << vk::to_string((vk::Format)texture.format) << " image " << std::get<std::string>(argument)
+			<< " with size of " << texture.levels[0].width << "x" << texture.levels[0].height << " and " << texture.levels.size() << " mip levels.\n";
+	uint32_t mipLevels = texture.levels.size();
+	bool hostCopy = batch.hostImageCopy(texture.format);
+
+	// only the levels up to the tail size now, the finer ones are streamed afterwards
+	uint32_t baseLevel = 0;
+	if(m_streamTextureTail > 0)
+		while(baseLevel+1 < mipLevels && std::max(texture.levels[baseLevel].width, texture.levels[baseLevel].height) > m_streamTextureTail)
+			baseLevel++;
+	m_streamedTexture = baseLevel > 0 ? streamed : nullptr;
+
+	// a streamed image only gets its finer levels later, so it stays with its companion
+	uint64_t textureKey = baseLevel == 0 ? hash : 0;
+	m_textureShared = false;
+	if(textureKey != 0)
+		if(auto shared = textureCache.acquire(textureKey))
+		{
+			logger << "[" << m_id << "] shares its texture with other companions\n";
+			m_textureKey = textureKey;
+			m_textureShared = true;
+			m_renderTexture = *shared;
+			m_renderTexture.sampler = createSampler(device);
+			m_textureBytes = m_renderTexture.memory.size;
+			return;
+		}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingMemory;
+	// what exists so far is kept in m_renderTexture, for uploadFailed() to free
+	m_renderTexture = {VK_NULL_HANDLE, texture.format, mipLevels, baseLevel, hostCopy ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_NULL_HANDLE, VK_NULL_HANDLE, {}};
+	VkImage& image = m_renderTexture.image;
 
 	VkImageCreateInfo imageCreateInfo{};
 	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-	imageCreateInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
-	imageCreateInfo.extent = {static_cast<uint32_t>(w), static_cast<uint32_t>(h), 1};
-	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.format = texture.format;
+	imageCreateInfo.extent = {texture.levels[0].width, texture.levels[0].height, 1};
+	imageCreateInfo.mipLevels = mipLevels;
 	imageCreateInfo.arrayLayers = 1;
 	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-	imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | (hostCopy ? VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT : VK_IMAGE_USAGE_TRANSFER_DST_BIT);
 	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	if(device_dispatch[GetKey(device)].CreateImage(device, &imageCreateInfo, nullptr, &image) != VK_SUCCESS)
+	{
+		image = VK_NULL_HANDLE;
 		throw std::runtime_error("failed to create image");
+	}
 
-	VkBufferCreateInfo stagingBufferCreateInfo{};
-	stagingBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	stagingBufferCreateInfo.size = w*h*4;
-	stagingBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	stagingBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	if(device_dispatch[GetKey(device)].CreateBuffer(device, &stagingBufferCreateInfo, nullptr, &stagingBuffer) != VK_SUCCESS)
-		throw std::runtime_error("failed to staging buffer");
-
-	VkMemoryRequirements imageRequirements;
-	VkMemoryRequirements stagingBufferMemoryRequirements;
-	device_dispatch[GetKey(device)].GetImageMemoryRequirements(device, image, &imageRequirements);
-	device_dispatch[GetKey(device)].GetBufferMemoryRequirements(device, stagingBuffer, &stagingBufferMemoryRequirements);
-
-	VkMemoryAllocateInfo allocateInfo{};
-	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocateInfo.allocationSize = stagingBufferMemoryRequirements.size;
-	allocateInfo.memoryTypeIndex = findMemoryType(deviceInfos[device].memory, 
-		imageRequirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	if(device_dispatch[GetKey(device)].AllocateMemory(device, &allocateInfo, nullptr, &memory) != VK_SUCCESS)
-		throw std::runtime_error("failed to allocate image memory");
-	
-	VkMemoryAllocateInfo stagingMemoryallocateInfo{};
-	stagingMemoryallocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	stagingMemoryallocateInfo.allocationSize = stagingBufferMemoryRequirements.size;
-	stagingMemoryallocateInfo.memoryTypeIndex = findMemoryType(deviceInfos[device].memory, 
-		stagingBufferMemoryRequirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	if(device_dispatch[GetKey(device)].AllocateMemory(device, &stagingMemoryallocateInfo, nullptr, &stagingMemory) != VK_SUCCESS)
-		throw std::runtime_error("failed to allocate staging memory");
-
-	if(device_dispatch[GetKey(device)].BindImageMemory(device, image, memory, 0) != VK_SUCCESS)
-		throw std::runtime_error("failed to bind memory to image");
-	if(device_dispatch[GetKey(device)].BindBufferMemory(device, stagingBuffer, stagingMemory, 0) != VK_SUCCESS)
-		throw std::runtime_error("failed to bind memory to staging buffer");
+	m_renderTexture.memory = allocator->allocateImage(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	m_textureBytes = m_renderTexture.memory.size;
 
-	VkImageViewCreateInfo imageViewCreateInfo{};
-	imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	imageViewCreateInfo.image = image;
-	imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	imageViewCreateInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
-	imageViewCreateInfo.components = {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY};
-	imageViewCreateInfo.subresourceRange = VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-	if(device_dispatch[GetKey(device)].CreateImageView(device, &imageViewCreateInfo, nullptr, &imageView) != VK_SUCCESS)
-		throw std::runtime_error("failed to create image view");
+	if(hostCopy)
+		batch.writeImage(image, texture, baseLevel);
+	else
+		batch.uploadImage(image, texture, baseLevel);
+
+	m_renderTexture.imageView = createTextureView(device, baseLevel);
+	m_renderTexture.sampler = createSampler(device);
+	if(textureKey != 0)
+	{
+		// the cached copy is shared without this companion's sampler
+		RenderTexture shared = m_renderTexture;
+		shared.sampler = VK_NULL_HANDLE;
+		if(textureCache.insert(textureKey, shared))
+			m_textureKey = textureKey;
+	}
+}
 
+VkSampler companion::createSampler(VkDevice device)
+{
 	VkSamplerCreateInfo samplerCreateInfo{};
 	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
-	samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
-	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerCreateInfo.minLod = 0.0f;
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
 	samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+	parse_json_struct(m_samplerConfig, &samplerCreateInfo, "VkSamplerCreateInfo");
+	VkSampler sampler;
 	if(device_dispatch[GetKey(device)].CreateSampler(device, &samplerCreateInfo, nullptr, &sampler) != VK_SUCCESS)
 		throw std::runtime_error("failed to create sampler");
+	return sampler;
+}
+
+VkImageView companion::createTextureView(VkDevice device, uint32_t baseLevel)
+{
+	VkImageViewCreateInfo imageViewCreateInfo{};
+	imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	imageViewCreateInfo.image = m_renderTexture.image;
+	imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	imageViewCreateInfo.format = m_renderTexture.format;
+	imageViewCreateInfo.components = {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY};
+	imageViewCreateInfo.subresourceRange = VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, baseLevel, m_renderTexture.mipLevels - baseLevel, 0, 1};
+	VkImageView imageView;
+	if(device_dispatch[GetKey(device)].CreateImageView(device, &imageViewCreateInfo, nullptr, &imageView) != VK_SUCCESS)
+		throw std::runtime_error("failed to create image view");
+	return imageView;
+}
 
+void companion::streamTexture(VkDevice device, upload_service& uploads)
+{
+	std::shared_ptr<TextureData> texture = std::move(m_streamedTexture);
+	if(!texture)
+		return;
+
+	*::logger << CheekyLayer::logger::begin << "[" << m_id << "] streaming " << m_renderTexture.baseLevel << " more mip levels" << CheekyLayer::logger::end;
+	m_pendingUploads += m_renderTexture.baseLevel;
+	for(uint32_t level = m_renderTexture.baseLevel; level-- > 0;)
 	{
-		void* stagingPointer;
-		if(device_dispatch[GetKey(device)].MapMemory(device, stagingMemory, 0, VK_WHOLE_SIZE, 0, &stagingPointer) != VK_SUCCESS)
-			throw std::runtime_error("failed to map staging memory");
-		std::copy(buf, buf+w*h*4, (uint8_t*)stagingPointer);
-		device_dispatch[GetKey(device)].UnmapMemory(device, stagingMemory);
-	}
-
-	VkCommandBuffer commandBuffer = transferCommandBuffers[device];
-	if(device_dispatch[GetKey(device)].ResetCommandBuffer(commandBuffer, 0) != VK_SUCCESS)
-		throw std::runtime_error("failed to reset command buffer");
-
-	VkCommandBufferBeginInfo beginInfo{};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	if(device_dispatch[GetKey(device)].BeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
-		throw std::runtime_error("failed to begin the command buffer");
-
-	VkImageMemoryBarrier imagePre{};
-	imagePre.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	imagePre.image = image;
-	imagePre.srcAccessMask = 0;
-	imagePre.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	imagePre.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	imagePre.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	imagePre.subresourceRange = VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-	device_dispatch[GetKey(device)].CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, {}, 
-		0, nullptr, 0, nullptr, 1, &imagePre);
-
-	VkBufferImageCopy copy{};
-	copy.imageExtent = imageCreateInfo.extent;
-	copy.imageSubresource = VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
-	device_dispatch[GetKey(device)].CmdCopyBufferToImage(commandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
-
-	VkImageMemoryBarrier imagePost{};
-	imagePost.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	imagePost.image = image;
-	imagePost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	imagePost.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-	imagePost.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	imagePost.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	imagePost.subresourceRange = VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-	device_dispatch[GetKey(device)].CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, {}, 
-		0, nullptr, 0, nullptr, 1, &imagePost);
-
-	if(device_dispatch[GetKey(device)].EndCommandBuffer(commandBuffer) != VK_SUCCESS)
-		throw std::runtime_error("failed to end command buffer");
-	
-	VkQueue queue = transferQueues[device];
+		uploads.stream(texture->levels[level].size, [this, texture, level](CheekyLayer::active_logger&, upload_batch& batch){
+			if(m_renderTexture.layout == VK_IMAGE_LAYOUT_GENERAL)
+				batch.writeImage(m_renderTexture.image, *texture, level, 1);
+			else
+				batch.uploadImage(m_renderTexture.image, *texture, level, 1);
+		}, [this, device, level](bool ok){
+			// the view only grows by levels that are all there, a failed one ends the streaming at the level before it
+			if(ok && level + 1 == m_renderTexture.baseLevel)
+			{
+				// frames in flight may still use the old view, the draws switch to a set with the new one
+				frames->defer([device, view = m_renderTexture.imageView](){
+					device_dispatch[GetKey(device)].DestroyImageView(device, view, nullptr);
+				});
+				m_renderTexture.imageView = createTextureView(device, level);
+				m_renderTexture.baseLevel = level;
+				m_textureGeneration++;
+			}
+			uploadFinished();
+		});
+	}
+}
 
-	if(device_dispatch[GetKey(device)].QueueWaitIdle(queue) != VK_SUCCESS)
-		throw std::runtime_error("cannot wait for queue to be idle before copying");
-	
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-	if(device_dispatch[GetKey(device)].QueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
-		throw std::runtime_error("failed to submit command buffer");
+void companion::load(VkDevice device, upload_service& uploads)
+{
+	m_textureResident = m_textureType == None;
+	m_pendingUploads += m_textureResident ? 1 : 2;
 
-	if(device_dispatch[GetKey(device)].QueueWaitIdle(queue) != VK_SUCCESS)
-		throw std::runtime_error("cannot wait for queue to be idle after copying");
+	workers->submit([this, device, &uploads](){
+		try
+		{
+			decodeMesh();
+			uploads.upload([this, device](CheekyLayer::active_logger& logger, upload_batch& batch){ uploadMesh(device, logger, batch); },
+				[this, device](bool ok){
+					settle(ok, true, false, [this, device](bool ok){
+						if(ok)
+							m_meshResident = true;
+						else
+							uploadFailed(device, true, false);
+						uploadFinished();
+					});
+				});
+		}
+		catch(const std::exception& ex)
+		{
+			*::logger << CheekyLayer::logger::begin << CheekyLayer::logger::error << "[" << m_id << "] failed to load mesh: " << ex.what() << CheekyLayer::logger::end;
+			uploadFinished();
+		}
+	});
 
-	device_dispatch[GetKey(device)].DestroyBuffer(device, stagingBuffer, nullptr);
-	device_dispatch[GetKey(device)].FreeMemory(device, stagingMemory, nullptr);
+	if(m_textureResident)
+		return;
+	workers->submit([this, device, &uploads](){
+		try
+		{
+			decodeTexture();
+			uploads.upload([this, device](CheekyLayer::active_logger& logger, upload_batch& batch){
+				uploadTexture(device, logger, batch);
+			}, [this, device, &uploads](bool ok){
+				settle(ok, false, true, [this, device, &uploads](bool ok){
+					if(ok)
+					{
+						m_textureResident = true;
+						m_textureGeneration++;
+						// the finer levels go into the image only after it exists on the GPU
+						streamTexture(device, uploads);
+					}
+					else
+						uploadFailed(device, false, true);
+					uploadFinished();
+				});
+			});
+		}
+		catch(const std::exception& ex)
+		{
+			*::logger << CheekyLayer::logger::begin << CheekyLayer::logger::error << "[" << m_id << "] failed to load texture: " << ex.what() << CheekyLayer::logger::end;
+			uploadFinished();
+		}
+	});
+}
 
-	if(m_textureType == Png)
-		stbi_image_free(buf);
-	if(m_textureType == Color)
-		delete [] buf;
+void companion::uploadFinished()
+{
+	std::set<std::string> reloads;
+	{
+		std::unique_lock lock(m_usersMutex);
+		if(--m_pendingUploads > 0)
+			return;
+		reloads.swap(m_deferredReloads);
+	}
+	// a finished load might have pushed the companions over the budget
+	evictionRequested = true;
+	if(!reloads.empty())
+		workers->submit([this, reloads](){ reload(globalDevice, *uploads, reloads); });
+}
+
+void companion::settle(bool ok, bool mesh, bool texture, std::function<void(bool)> done)
+{
+	// what this companion created itself is resident for the others now, or dropped from the caches and freed by uploadFailed()
+	if(mesh && m_meshKey != 0 && !m_meshShared)
+	{
+		meshCache.resident(m_meshKey, ok);
+		if(!ok)
+			m_meshKey = 0;
+	}
+	if(texture && m_textureKey != 0 && !m_textureShared)
+	{
+		textureCache.resident(m_textureKey, ok);
+		if(!ok)
+			m_textureKey = 0;
+	}
+	if(!ok)
+	{
+		done(false);
+		return;
+	}
+
+	// what it shares might still be on its way in the creator's batch
+	auto waitTexture = [this, texture, done](bool ok){
+		if(ok && texture && m_textureShared)
+			textureCache.whenResident(m_textureKey, done);
+		else
+			done(ok);
+	};
+	if(mesh && m_meshShared)
+		meshCache.whenResident(m_meshKey, waitTexture);
+	else
+		waitTexture(true);
+}
+
+void companion::uploadFailed(VkDevice device, bool mesh, bool texture)
+{
+	release(device, *frames, mesh, texture);
+	if(mesh)
+	{
+		m_renderMesh = {};
+		m_meshKey = 0;
+		m_meshBytes = 0;
+	}
+	if(texture)
+	{
+		m_renderTexture = {};
+		m_textureKey = 0;
+		m_textureBytes = 0;
+		m_streamedTexture.reset();
+	}
+}
+
+static void destroy_mesh(VkDevice device, const RenderMesh& mesh)
+{
+	if(mesh.geometry)
+	{
+		geometry->free(*mesh.geometry);
+		return;
+	}
+	device_dispatch[GetKey(device)].DestroyBuffer(device, mesh.indexBuffer, nullptr);
+	device_dispatch[GetKey(device)].DestroyBuffer(device, mesh.vertexBuffer, nullptr);
+	allocator->free(mesh.memory);
+}
+
+// everything but the sampler, which every companion has its own of
+static void destroy_texture(VkDevice device, const RenderTexture& texture)
+{
+	device_dispatch[GetKey(device)].DestroyImageView(device, texture.imageView, nullptr);
+	device_dispatch[GetKey(device)].DestroyImage(device, texture.image, nullptr);
+	allocator->free(texture.memory);
+}
 
-	m_renderTexture = {image, imageView, sampler, memory};
+void companion::release(VkDevice device, frame_tracker& frames, bool mesh, bool texture)
+{
+	bool freeMesh = mesh && (m_meshKey == 0 || meshCache.release(m_meshKey));
+	bool freeTexture = texture && (m_textureKey == 0 || textureCache.release(m_textureKey));
+	frames.defer([device, renderMesh = m_renderMesh, renderTexture = m_renderTexture, texture, freeMesh, freeTexture](){
+		if(freeMesh)
+			destroy_mesh(device, renderMesh);
+		if(texture)
+			device_dispatch[GetKey(device)].DestroySampler(device, renderTexture.sampler, nullptr);
+		if(freeTexture)
+			destroy_texture(device, renderTexture);
+	});
+}
+
+void companion::reload(VkDevice device, upload_service& uploads, const std::set<std::string>& files)
+{
+	// bundled companions have no files of their own to change
+	if(m_bundle)
+		return;
+
+	std::unique_lock lock(m_usersMutex);
+	// the streamed levels and the previous reload still write into the current resources
+	if(m_pendingUploads > 0)
+	{
+		m_deferredReloads.insert(files.begin(), files.end());
+		return;
+	}
+
+	auto changed = [&files](const std::string& path) {
+		return files.contains(std::filesystem::path(path).filename().string());
+	};
+	bool config = files.contains("companion.json");
+	auto argument = textureArgument();
+	bool mesh = config || changed(modelFile());
+	bool texture = config || (std::holds_alternative<std::string>(argument) && changed(std::get<std::string>(argument)));
+	if(!mesh && !texture)
+		return;
+
+	json json;
+	{
+		std::ifstream in(m_directory+"/companion.json");
+		in >> json;
+	}
+	// the companions and their clients find each other by the id, which only a restart may change
+	if(json["id"] != m_id)
+	{
+		*::logger << CheekyLayer::logger::begin << CheekyLayer::logger::error << "[" << m_id << "] the id changed, keeping the old assets until a restart" << CheekyLayer::logger::end;
+		return;
+	}
+	// without users the assets are loaded from scratch the next time anyway
+	if(!m_loaded)
+	{
+		if(config)
+			configure(json, m_directory);
+		return;
+	}
+
+	auto next = std::make_shared<companion>(json, m_directory);
+	next->setVertexFormat(m_cookOptions.vertexFormat);
+	next->m_streamTextureTail = 0;
+	m_pendingUploads++;
+	lock.unlock();
+
+	*::logger << CheekyLayer::logger::begin << "[" << m_id << "] reloading" << (mesh ? " mesh" : "") << (texture ? " texture" : "")
+		<< (config ? " config" : "") << CheekyLayer::logger::end;
+	// decoding takes a while, the watcher goes on with the next changes
+	workers->submit([this, next, device, &uploads, mesh, texture, config](){
+		try
+		{
+			if(mesh)
+				next->decodeMesh();
+			if(texture)
+				next->decodeTexture();
+		}
+		catch(const std::exception& ex)
+		{
+			*::logger << CheekyLayer::logger::begin << CheekyLayer::logger::error << "[" << m_id << "] failed to reload: " << ex.what() << CheekyLayer::logger::end;
+			uploadFinished();
+			return;
+		}
+		uploads.upload([next, device, mesh, texture](CheekyLayer::active_logger& logger, upload_batch& batch){
+			if(mesh)
+				next->uploadMesh(device, logger, batch);
+			if(texture)
+				next->uploadTexture(device, logger, batch);
+		}, [this, next, device, mesh, texture, config](bool ok){
+			bool hasTexture = texture && next->m_textureType != None;
+			next->settle(ok, mesh, hasTexture, [this, next, device, mesh, texture, hasTexture, config](bool ok){
+				if(ok)
+					swap(device, *next, mesh, texture, config);
+				else
+				{
+					*::logger << CheekyLayer::logger::begin << CheekyLayer::logger::error << "[" << m_id << "] failed to reload, keeping the old assets" << CheekyLayer::logger::end;
+					next->uploadFailed(device, mesh, hasTexture);
+				}
+				uploadFinished();
+			});
+		});
+	});
+}
+
+void companion::swap(VkDevice device, companion& next, bool mesh, bool texture, bool config)
+{
+	std::unique_lock lock(m_usersMutex);
+	release(device, *frames, mesh && m_meshResident, texture && m_textureResident && m_textureType != None);
+	if(mesh)
+	{
+		m_renderMesh = next.m_renderMesh;
+		m_meshKey = next.m_meshKey;
+		m_meshBytes = next.m_meshBytes.load();
+		m_meshResident = true;
+	}
+	if(texture)
+	{
+		m_renderTexture = next.m_renderTexture;
+		m_textureKey = next.m_textureKey;
+		m_textureBytes = next.m_textureBytes.load();
+		m_textureResident = true;
+		m_textureGeneration++;
+	}
+	if(config)
+	{
+		std::unique_lock configLock(m_configMutex);
+		m_modelType = next.m_modelType;
+		m_modelFile = next.m_modelFile;
+		m_cookOptions = next.m_cookOptions;
+		m_lodThreshold = next.m_lodThreshold;
+		m_lodHysteresis = next.m_lodHysteresis;
+		m_textureType = next.m_textureType;
+		m_textureArgument = next.m_textureArgument;
+		m_generateMipmaps = next.m_generateMipmaps;
+		m_samplerConfig = next.m_samplerConfig;
+	}
+}
+
+void companion::addUser(VkDevice device, upload_service& uploads)
+{
+	std::unique_lock lock(m_usersMutex);
+	m_users++;
+	if(!m_loaded)
+	{
+		m_loaded = true;
+		load(device, uploads);
+	}
+}
+
+void companion::removeUser()
+{
+	std::unique_lock lock(m_usersMutex);
+	if(--m_users == 0)
+	{
+		m_lastUsed = std::chrono::steady_clock::now();
+		evictionRequested = true;
+	}
+}
+
+std::chrono::steady_clock::time_point companion::lastUsed()
+{
+	std::unique_lock lock(m_usersMutex);
+	return m_lastUsed;
+}
+
+bool companion::unload(VkDevice device, frame_tracker& frames)
+{
+	std::unique_lock lock(m_usersMutex);
+	if(m_users > 0 || !m_loaded || m_pendingUploads > 0)
+		return false;
+
+	// a failed load leaves nothing behind to free
+	bool hasMesh = m_meshResident;
+	bool hasTexture = m_textureResident && m_textureType != None;
+	m_loaded = false;
+	m_meshResident = false;
+	m_textureResident = false;
+	m_meshBytes = 0;
+	m_textureBytes = 0;
+	release(device, frames, hasMesh, hasTexture);
+	return true;
+}
+
+void evictCompanions(VkDevice device)
+{
+	if(!evictionRequested.exchange(false))
+		return;
+
+	VkDeviceSize used = 0;
+	std::vector<companion*> loaded;
+	for(auto& [id, c] : companions)
+	{
+		used += c->residentBytes();
+		if(c->residentBytes() > 0)
+			loaded.push_back(c.get());
+	}
+	if(used <= vramBudget)
+		return;
+
+	auto heaps = allocator->stats();
+	for(size_t i=0; i<heaps.size(); i++)
+		if(heaps[i].blocks > 0)
+			*::logger << CheekyLayer::logger::begin << "Heap " << i << ": " << heaps[i].usedBytes << " bytes used by " << heaps[i].allocations << " allocations, "
+				<< heaps[i].wastedBytes << " bytes unused in " << heaps[i].blocks << " blocks" << CheekyLayer::logger::end;
+
+	// unload() skips the ones that are in use
+	std::sort(loaded.begin(), loaded.end(), [](companion* a, companion* b){return a->lastUsed() < b->lastUsed();});
+	for(companion* c : loaded)
+	{
+		if(used <= vramBudget)
+			break;
+		VkDeviceSize bytes = c->residentBytes();
+		if(c->unload(device, *frames))
+		{
+			used -= bytes;
+			*::logger << CheekyLayer::logger::begin << "[" << c->id() << "] evicted " << bytes << " bytes" << CheekyLayer::logger::end;
+		}
+	}
 }
 
 bool companion::hasTexture()
@@ -449,17 +821,48 @@ VkDescriptorImageInfo companion::getTextureDescriptorInfo()
 	return {
 		.sampler = m_renderTexture.sampler,
 		.imageView = m_renderTexture.imageView,
-		.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		.imageLayout = m_renderTexture.layout
 	};
 }
 
-void companion::draw(VkDevice device, VkCommandBuffer commandBuffer)
+uint32_t companion::selectLod(float distance, uint32_t lod)
 {
-	device_dispatch[GetKey(device)].CmdBindIndexBuffer(commandBuffer, m_renderMesh.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+	const auto& lods = m_renderMesh.lods;
+	lod = std::min<uint32_t>(lod, lods.size() - 1);
+	auto switchDistance = [&](uint32_t level) {
+		return lods[level].error * m_renderMesh.radius / m_lodThreshold;
+	};
+	while(lod + 1 < lods.size() && distance > switchDistance(lod + 1) * (1.0f + m_lodHysteresis))
+		lod++;
+	while(lod > 0 && distance < switchDistance(lod) * (1.0f - m_lodHysteresis))
+		lod--;
+	return lod;
+}
 
-	auto vertexBufferCount = m_renderMesh.vertexBuffers.size();
-	std::vector<VkDeviceSize> offsets(vertexBufferCount);
-	device_dispatch[GetKey(device)].CmdBindVertexBuffers(commandBuffer, 0, vertexBufferCount, m_renderMesh.vertexBuffers.data(), offsets.data());
-	
-	device_dispatch[GetKey(device)].CmdDrawIndexed(commandBuffer, m_renderMesh.indexCount, 1, 0, 0, 0);
+void companion::draw(VkDevice device, VkCommandBuffer commandBuffer, GeometryBinding& bound, uint32_t lod, uint32_t instanceCount, uint32_t firstInstance)
+{
+	if(bound.indexBuffer != m_renderMesh.indexBuffer || bound.indexType != m_renderMesh.indexType)
+	{
+		device_dispatch[GetKey(device)].CmdBindIndexBuffer(commandBuffer, m_renderMesh.indexBuffer, 0, m_renderMesh.indexType);
+		bound.indexBuffer = m_renderMesh.indexBuffer;
+		bound.indexType = m_renderMesh.indexType;
+	}
+	if(bound.vertexBuffer != m_renderMesh.vertexBuffer)
+	{
+		VkDeviceSize offset = 0;
+		device_dispatch[GetKey(device)].CmdBindVertexBuffers(commandBuffer, 0, 1, &m_renderMesh.vertexBuffer, &offset);
+		bound.vertexBuffer = m_renderMesh.vertexBuffer;
+	}
+
+	if(m_renderMesh.vertexFormat == VertexFormat::Quantized)
+		device_dispatch[GetKey(device)].CmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+			0, sizeof(VertexDequantization), &m_renderMesh.dequantization);
+
+	const MeshLod& level = m_renderMesh.lods[lod];
+	for(uint32_t i=level.firstSubmesh; i<level.firstSubmesh+level.submeshCount; i++)
+	{
+		const Submesh& submesh = m_renderMesh.submeshes[i];
+		device_dispatch[GetKey(device)].CmdDrawIndexed(commandBuffer, submesh.indexCount, instanceCount, m_renderMesh.firstIndex + submesh.firstIndex,
+			m_renderMesh.vertexOffset + submesh.vertexOffset, firstInstance);
+	}
 }
@@ -0,0 +1,266 @@
+#include "device_hooks.hpp"
+
+#include "dispatch.hpp"
+#include "logger.hpp"
+#include "shared.hpp"
+
+#include <exception>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using CheekyLayer::logger;
+
+// what the dispatch table held before, the wrappers call on to it
+static decltype(VkLayerDispatchTable::QueueSubmit) nextQueueSubmit;
+static decltype(VkLayerDispatchTable::QueueSubmit2) nextQueueSubmit2;
+static decltype(VkLayerDispatchTable::QueueSubmit2KHR) nextQueueSubmit2KHR;
+static decltype(VkLayerDispatchTable::BeginCommandBuffer) nextBeginCommandBuffer;
+static decltype(VkLayerDispatchTable::ResetCommandBuffer) nextResetCommandBuffer;
+static decltype(VkLayerDispatchTable::AllocateCommandBuffers) nextAllocateCommandBuffers;
+static decltype(VkLayerDispatchTable::FreeCommandBuffers) nextFreeCommandBuffers;
+static decltype(VkLayerDispatchTable::ResetCommandPool) nextResetCommandPool;
+static decltype(VkLayerDispatchTable::DestroyCommandPool) nextDestroyCommandPool;
+static decltype(VkLayerDispatchTable::AllocateDescriptorSets) nextAllocateDescriptorSets;
+static decltype(VkLayerDispatchTable::FreeDescriptorSets) nextFreeDescriptorSets;
+static decltype(VkLayerDispatchTable::UpdateDescriptorSets) nextUpdateDescriptorSets;
+static decltype(VkLayerDispatchTable::UpdateDescriptorSetWithTemplate) nextUpdateDescriptorSetWithTemplate;
+static decltype(VkLayerDispatchTable::UpdateDescriptorSetWithTemplateKHR) nextUpdateDescriptorSetWithTemplateKHR;
+
+// the pool of every command buffer the game allocated, resetting or destroying a pool discards all of its recordings
+static std::mutex poolsMutex;
+static std::unordered_map<VkCommandBuffer, VkCommandPool> commandBufferPools;
+
+static std::mutex generationsMutex;
+static uint64_t lastGeneration = 0;
+static std::unordered_map<VkDescriptorSet, uint64_t> generations;
+
+// the wrapped call already went through, so a failure here is only logged
+static void track_submission(VkQueue queue, const std::vector<VkCommandBuffer>& commandBuffers)
+{
+	if(!frames || commandBuffers.empty())
+		return;
+	try
+	{
+		frames->submitted(queue, commandBuffers);
+	}
+	catch(const std::exception& ex)
+	{
+		*::logger << logger::begin << logger::error << "failed to track submission: " << ex.what() << logger::end;
+	}
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL hook_QueueSubmit(VkQueue queue, uint32_t submitCount, const VkSubmitInfo* pSubmits, VkFence fence)
+{
+	VkResult r = nextQueueSubmit(queue, submitCount, pSubmits, fence);
+	if(r != VK_SUCCESS)
+		return r;
+	std::vector<VkCommandBuffer> commandBuffers;
+	for(uint32_t i=0; i<submitCount; i++)
+		commandBuffers.insert(commandBuffers.end(), pSubmits[i].pCommandBuffers, pSubmits[i].pCommandBuffers + pSubmits[i].commandBufferCount);
+	track_submission(queue, commandBuffers);
+	return r;
+}
+
+static void track_submission2(VkQueue queue, uint32_t submitCount, const VkSubmitInfo2* pSubmits)
+{
+	std::vector<VkCommandBuffer> commandBuffers;
+	for(uint32_t i=0; i<submitCount; i++)
+		for(uint32_t j=0; j<pSubmits[i].commandBufferInfoCount; j++)
+			commandBuffers.push_back(pSubmits[i].pCommandBufferInfos[j].commandBuffer);
+	track_submission(queue, commandBuffers);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL hook_QueueSubmit2(VkQueue queue, uint32_t submitCount, const VkSubmitInfo2* pSubmits, VkFence fence)
+{
+	VkResult r = nextQueueSubmit2(queue, submitCount, pSubmits, fence);
+	if(r == VK_SUCCESS)
+		track_submission2(queue, submitCount, pSubmits);
+	return r;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL hook_QueueSubmit2KHR(VkQueue queue, uint32_t submitCount, const VkSubmitInfo2* pSubmits, VkFence fence)
+{
+	VkResult r = nextQueueSubmit2KHR(queue, submitCount, pSubmits, fence);
+	if(r == VK_SUCCESS)
+		track_submission2(queue, submitCount, pSubmits);
+	return r;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL hook_BeginCommandBuffer(VkCommandBuffer commandBuffer, const VkCommandBufferBeginInfo* pBeginInfo)
+{
+	// beginning resets the command buffer implicitly
+	if(frames)
+		frames->discarded(commandBuffer);
+	return nextBeginCommandBuffer(commandBuffer, pBeginInfo);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL hook_ResetCommandBuffer(VkCommandBuffer commandBuffer, VkCommandBufferResetFlags flags)
+{
+	if(frames)
+		frames->discarded(commandBuffer);
+	return nextResetCommandBuffer(commandBuffer, flags);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL hook_AllocateCommandBuffers(VkDevice device, const VkCommandBufferAllocateInfo* pAllocateInfo, VkCommandBuffer* pCommandBuffers)
+{
+	VkResult r = nextAllocateCommandBuffers(device, pAllocateInfo, pCommandBuffers);
+	if(r != VK_SUCCESS)
+		return r;
+	std::unique_lock lock(poolsMutex);
+	for(uint32_t i=0; i<pAllocateInfo->commandBufferCount; i++)
+		commandBufferPools[pCommandBuffers[i]] = pAllocateInfo->commandPool;
+	return r;
+}
+
+static VKAPI_ATTR void VKAPI_CALL hook_FreeCommandBuffers(VkDevice device, VkCommandPool commandPool, uint32_t commandBufferCount, const VkCommandBuffer* pCommandBuffers)
+{
+	{
+		std::unique_lock lock(poolsMutex);
+		for(uint32_t i=0; i<commandBufferCount; i++)
+		{
+			commandBufferPools.erase(pCommandBuffers[i]);
+			if(frames)
+				frames->discarded(pCommandBuffers[i]);
+		}
+	}
+	nextFreeCommandBuffers(device, commandPool, commandBufferCount, pCommandBuffers);
+}
+
+// discards the recordings of all command buffers of the pool, and forgets the command buffers when the pool goes away
+static void discard_pool(VkCommandPool commandPool, bool destroyed)
+{
+	std::unique_lock lock(poolsMutex);
+	for(auto it = commandBufferPools.begin(); it != commandBufferPools.end();)
+	{
+		if(it->second != commandPool)
+		{
+			++it;
+			continue;
+		}
+		if(frames)
+			frames->discarded(it->first);
+		it = destroyed ? commandBufferPools.erase(it) : std::next(it);
+	}
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL hook_ResetCommandPool(VkDevice device, VkCommandPool commandPool, VkCommandPoolResetFlags flags)
+{
+	discard_pool(commandPool, false);
+	return nextResetCommandPool(device, commandPool, flags);
+}
+
+static VKAPI_ATTR void VKAPI_CALL hook_DestroyCommandPool(VkDevice device, VkCommandPool commandPool, const VkAllocationCallbacks* pAllocator)
+{
+	discard_pool(commandPool, true);
+	nextDestroyCommandPool(device, commandPool, pAllocator);
+}
+
+// sets of a reset or destroyed pool keep their entries, their handles get a new generation when allocated again
+static void bump_generations(auto sets)
+{
+	std::unique_lock lock(generationsMutex);
+	for(VkDescriptorSet set : sets)
+		generations[set] = ++lastGeneration;
+}
+
+uint64_t descriptor_set_generation(VkDescriptorSet set)
+{
+	std::unique_lock lock(generationsMutex);
+	auto it = generations.find(set);
+	return it == generations.end() ? 0 : it->second;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL hook_AllocateDescriptorSets(VkDevice device, const VkDescriptorSetAllocateInfo* pAllocateInfo, VkDescriptorSet* pDescriptorSets)
+{
+	VkResult r = nextAllocateDescriptorSets(device, pAllocateInfo, pDescriptorSets);
+	if(r == VK_SUCCESS)
+		bump_generations(std::vector<VkDescriptorSet>(pDescriptorSets, pDescriptorSets + pAllocateInfo->descriptorSetCount));
+	return r;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL hook_FreeDescriptorSets(VkDevice device, VkDescriptorPool descriptorPool, uint32_t descriptorSetCount, const VkDescriptorSet* pDescriptorSets)
+{
+	{
+		std::unique_lock lock(generationsMutex);
+		for(uint32_t i=0; i<descriptorSetCount; i++)
+			generations.erase(pDescriptorSets[i]);
+	}
+	return nextFreeDescriptorSets(device, descriptorPool, descriptorSetCount, pDescriptorSets);
+}
+
+static VKAPI_ATTR void VKAPI_CALL hook_UpdateDescriptorSets(VkDevice device, uint32_t descriptorWriteCount, const VkWriteDescriptorSet* pDescriptorWrites,
+	uint32_t descriptorCopyCount, const VkCopyDescriptorSet* pDescriptorCopies)
+{
+	nextUpdateDescriptorSets(device, descriptorWriteCount, pDescriptorWrites, descriptorCopyCount, pDescriptorCopies);
+	std::vector<VkDescriptorSet> sets;
+	for(uint32_t i=0; i<descriptorWriteCount; i++)
+		sets.push_back(pDescriptorWrites[i].dstSet);
+	for(uint32_t i=0; i<descriptorCopyCount; i++)
+		sets.push_back(pDescriptorCopies[i].dstSet);
+	bump_generations(sets);
+}
+
+static VKAPI_ATTR void VKAPI_CALL hook_UpdateDescriptorSetWithTemplate(VkDevice device, VkDescriptorSet descriptorSet,
+	VkDescriptorUpdateTemplate descriptorUpdateTemplate, const void* pData)
+{
+	nextUpdateDescriptorSetWithTemplate(device, descriptorSet, descriptorUpdateTemplate, pData);
+	bump_generations(std::vector<VkDescriptorSet>{descriptorSet});
+}
+
+static VKAPI_ATTR void VKAPI_CALL hook_UpdateDescriptorSetWithTemplateKHR(VkDevice device, VkDescriptorSet descriptorSet,
+	VkDescriptorUpdateTemplate descriptorUpdateTemplate, const void* pData)
+{
+	nextUpdateDescriptorSetWithTemplateKHR(device, descriptorSet, descriptorUpdateTemplate, pData);
+	bump_generations(std::vector<VkDescriptorSet>{descriptorSet});
+}
+
+void install_device_hooks(VkDevice device)
+{
+	VkLayerDispatchTable& table = device_dispatch[GetKey(device)];
+	if(table.QueueSubmit == &hook_QueueSubmit)
+		return;
+
+	nextQueueSubmit = table.QueueSubmit;
+	table.QueueSubmit = &hook_QueueSubmit;
+	// only there when the device has Vulkan 1.3 or VK_KHR_synchronization2, older games call the KHR one
+	if(table.QueueSubmit2)
+	{
+		nextQueueSubmit2 = table.QueueSubmit2;
+		table.QueueSubmit2 = &hook_QueueSubmit2;
+	}
+	if(table.QueueSubmit2KHR)
+	{
+		nextQueueSubmit2KHR = table.QueueSubmit2KHR;
+		table.QueueSubmit2KHR = &hook_QueueSubmit2KHR;
+	}
+	nextBeginCommandBuffer = table.BeginCommandBuffer;
+	table.BeginCommandBuffer = &hook_BeginCommandBuffer;
+	nextResetCommandBuffer = table.ResetCommandBuffer;
+	table.ResetCommandBuffer = &hook_ResetCommandBuffer;
+	nextAllocateCommandBuffers = table.AllocateCommandBuffers;
+	table.AllocateCommandBuffers = &hook_AllocateCommandBuffers;
+	nextFreeCommandBuffers = table.FreeCommandBuffers;
+	table.FreeCommandBuffers = &hook_FreeCommandBuffers;
+	nextResetCommandPool = table.ResetCommandPool;
+	table.ResetCommandPool = &hook_ResetCommandPool;
+	nextDestroyCommandPool = table.DestroyCommandPool;
+	table.DestroyCommandPool = &hook_DestroyCommandPool;
+
+	nextAllocateDescriptorSets = table.AllocateDescriptorSets;
+	table.AllocateDescriptorSets = &hook_AllocateDescriptorSets;
+	nextFreeDescriptorSets = table.FreeDescriptorSets;
+	table.FreeDescriptorSets = &hook_FreeDescriptorSets;
+	nextUpdateDescriptorSets = table.UpdateDescriptorSets;
+	table.UpdateDescriptorSets = &hook_UpdateDescriptorSets;
+	if(table.UpdateDescriptorSetWithTemplate)
+	{
+		nextUpdateDescriptorSetWithTemplate = table.UpdateDescriptorSetWithTemplate;
+		table.UpdateDescriptorSetWithTemplate = &hook_UpdateDescriptorSetWithTemplate;
+	}
+	if(table.UpdateDescriptorSetWithTemplateKHR)
+	{
+		nextUpdateDescriptorSetWithTemplateKHR = table.UpdateDescriptorSetWithTemplateKHR;
+		table.UpdateDescriptorSetWithTemplateKHR = &hook_UpdateDescriptorSetWithTemplateKHR;
+	}
+}
@@ -5,6 +5,7 @@
 #include "descriptors.hpp"
 
 #include "rules/rules.hpp"
+#include <algorithm>
 #include <exception>
 #include <istream>
 #include <stdexcept>
@@ -47,71 +48,127 @@ class draw_action : public action
 			info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 			info.renderPass = renderPass;
 			info.framebuffer = ctx.commandBufferState->framebuffer;
-			info.renderArea = rect2D_from_json(gameConfig["renderPassBegin"]["renderArea"]);
-
-			std::vector<VkClearValue> clearValues(gameConfig["renderPass"]["subpasses"][0]["colorAttachments"].size()+1);
-			info.pClearValues = clearValues.data();
-			info.clearValueCount = clearValues.size();
+			info.renderArea = drawPlan.renderArea;
+			info.pClearValues = drawPlan.clearValues.data();
+			info.clearValueCount = drawPlan.clearValues.size();
 
 			device_dispatch[GetKey(ctx.device)].CmdEndRenderPass(ctx.commandBuffer);
+			uploads->acquire(ctx.commandBuffer);
+			frames->mark(ctx.commandBuffer);
+			evictCompanions(ctx.device);
 			device_dispatch[GetKey(ctx.device)].CmdBeginRenderPass(ctx.commandBuffer, &info, VK_SUBPASS_CONTENTS_INLINE);
+			if(clientVariables && !clientVariables->begin())
+			{
+				ctx.logger << CheekyLayer::logger::error << "skipping the companions, the GPU still uses the client variables of every frame in flight";
+				return;
+			}
 
-			auto descriptorCount = gameConfig["descriptors"].size();
-			std::vector<std::vector<uint32_t>> dynamicOffsets(clients.size());
-			std::vector<VkDescriptorImageInfo> imageInfos;		imageInfos.reserve(descriptorCount * clients.size());
-			std::vector<VkDescriptorBufferInfo> bufferInfos;	bufferInfos.reserve(descriptorCount * clients.size());
-			std::vector<VkWriteDescriptorSet> writes;
-			std::vector<VkCopyDescriptorSet> copies;
-			for(int i=0; i<clients.size(); i++)
+			// the stolen offsets are the same for every client, the client variables' are filled in per client
+			std::vector<uint32_t> dynamicOffsets(dynamicBindings.size());
+			VkDescriptorSet source = VK_NULL_HANDLE;
+			if(drawPlan.steals)
 			{
-				auto& client = clients[i];
-				dynamicOffsets[i].resize(descriptorCount);
-				for(auto& d : gameConfig["descriptors"])
+				try
+				{
+					source = ctx.commandBufferState->descriptorSets.at(0);
+					for(const DescriptorPlan& d : drawPlan.descriptors)
+						if(d.source == DescriptorSource::Steal && d.dynamicIndex >= 0 && ctx.commandBufferState->descriptorDynamicOffsets.size() > d.srcBinding)
+							dynamicOffsets[d.dynamicIndex] = ctx.commandBufferState->descriptorDynamicOffsets[d.srcBinding];
+				}
+				catch(const std::exception& ex)
 				{
-					int dstBinding = d["binding"];
-					try
-					{
-						auto& source = d["_source"];
-						if(source["type"]=="steal")
-						{
-							int srcBinding = source["binding"];
-							VkDescriptorSet set = ctx.commandBufferState->descriptorSets.at(0);
-
-							VkCopyDescriptorSet& copy = copies.emplace_back();
-							copy.sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET;
-							copy.srcSet = set;
-							copy.srcBinding = srcBinding;
-							copy.srcArrayElement = 0;
-							copy.dstSet = client->descriptor_set();
-							copy.dstBinding = dstBinding;
-							copy.dstArrayElement = 0;
-							copy.descriptorCount = 1;
-
-							if(ctx.commandBufferState->descriptorDynamicOffsets.size() > srcBinding)
-								dynamicOffsets[i][dstBinding] = ctx.commandBufferState->descriptorDynamicOffsets[srcBinding];
-						}
-					}
-					catch(const std::exception& ex)
-					{
-						ctx.logger << CheekyLayer::logger::error << "failed to update descriptor binding " << dstBinding << ": " << ex.what();
-					}
+					ctx.logger << CheekyLayer::logger::error << "failed to steal descriptors: " << ex.what();
+					return;
+				}
+			}
+			// the offsets are passed when binding, so the sets only depend on the source set and the companions' textures
+			for(auto& client : clients)
+			{
+				try
+				{
+					client->selectSet(ctx.device, source);
+				}
+				catch(const std::exception& ex)
+				{
+					ctx.logger << CheekyLayer::logger::error << "failed to write the descriptor set of a companion: " << ex.what();
 				}
 			}
-			device_dispatch[GetKey(ctx.device)].UpdateDescriptorSets(ctx.device, writes.size(), writes.data(), copies.size(), copies.data());
 			device_dispatch[GetKey(ctx.device)].CmdBindPipeline(ctx.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
+			// clients of the same companion at the same level of detail are drawn together
+			struct instance
+			{
+				companion* c;
+				uint32_t lod;
+				int client;
+			};
+			std::vector<instance> visible;
+			visible.reserve(clients.size());
 			for(int i=0; i<clients.size(); i++)
 			{
 				auto& client = clients[i];
-				client->update();
-
-				VkDescriptorSet set = client->descriptor_set();
-				device_dispatch[GetKey(ctx.device)].CmdBindDescriptorSets(ctx.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 
-					1, &set, dynamicOffsets.size(), dynamicOffsets[i].data());
-				
-				auto& companion = companions[client->companion()];
-				companion->draw(ctx.device, ctx.commandBuffer);
+				companion* companion = client->target();
+				if(!companion->resident() || !client->descriptor_set())
+					continue;
+				if(clientVariables)
+					client->update(*clientVariables);
+				client->m_lod = companion->selectLod(glm::distance(client->m_position, lodReference), client->m_lod);
+				visible.push_back({companion, client->m_lod, i});
+			}
+			std::sort(visible.begin(), visible.end(), [](const instance& a, const instance& b){
+				return a.c != b.c ? a.c < b.c : a.lod < b.lod;
+			});
+
+			glm::mat4* matrices = nullptr;
+			if(instanceBinding && !visible.empty())
+			{
+				frame_arena::slice slice = instances->allocate(visible.size() * sizeof(glm::mat4));
+				device_dispatch[GetKey(ctx.device)].CmdBindVertexBuffers(ctx.commandBuffer, *instanceBinding, 1, &slice.buffer, &slice.offset);
+				matrices = reinterpret_cast<glm::mat4*>(slice.mapped);
+			}
+
+			// the geometry store's buffers stay bound across the companions in it
+			GeometryBinding bound;
+			// the clients of a companion share their set, which is bound once for all of them unless their variables' offsets differ
+			VkDescriptorSet boundSet = VK_NULL_HANDLE;
+			for(size_t first=0; first<visible.size();)
+			{
+				// without instance matrices, every client is drawn on its own
+				size_t last = first+1;
+				if(matrices)
+				{
+					while(last < visible.size() && visible[last].c == visible[first].c && visible[last].lod == visible[first].lod)
+						last++;
+					for(size_t j=first; j<last; j++)
+						matrices[j] = clients[visible[j].client]->matrix();
+				}
+
+				// a group shares the companion's texture, so any of its sets will do
+				int i = visible[first].client;
+				VkDescriptorSet set = clients[i]->descriptor_set();
+				if(set != boundSet || clientVariables)
+				{
+					for(size_t k=0; k<dynamicBindings.size(); k++)
+						if(dynamicBindings[k].client)
+							dynamicOffsets[k] = clients[i]->variablesOffset();
+					device_dispatch[GetKey(ctx.device)].CmdBindDescriptorSets(ctx.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 
+						1, &set, dynamicOffsets.size(), dynamicOffsets.data());
+					boundSet = set;
+				}
+				if(clientConstantsOffset)
+				{
+					ClientConstants constants = clients[i]->constants();
+					device_dispatch[GetKey(ctx.device)].CmdPushConstants(ctx.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+						*clientConstantsOffset, sizeof(ClientConstants), &constants);
+				}
+
+				visible[first].c->draw(ctx.device, ctx.commandBuffer, bound, visible[first].lod, last - first, matrices ? first : 0);
+				first = last;
 			}
+			if(instances)
+				instances->retire(*frames);
+			if(clientVariables)
+				clientVariables->retire(*frames);
 		}
 
 		std::ostream& print(std::ostream& out) override
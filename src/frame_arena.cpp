@@ -0,0 +1,87 @@
+#include "frame_arena.hpp"
+
+#include "dispatch.hpp"
+#include "shared.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <vulkan/vulkan.hpp>
+
+frame_arena::frame_arena(VkDevice device, VkBufferUsageFlags usage, VkDeviceSize alignment, VkDeviceSize chunkSize)
+	: m_device(device), m_usage(usage), m_alignment(std::max<VkDeviceSize>(alignment, 1)), m_chunkSize(chunkSize)
+{
+}
+
+frame_arena::~frame_arena()
+{
+	for(auto& c : m_chunks)
+	{
+		device_dispatch[GetKey(m_device)].DestroyBuffer(m_device, c->buffer, nullptr);
+		allocator->free(c->memory);
+	}
+}
+
+frame_arena::chunk* frame_arena::createChunk(VkDeviceSize size)
+{
+	VkBufferCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	createInfo.size = size;
+	createInfo.usage = m_usage;
+	createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkBuffer buffer;
+	VkResult r;
+	if((r = device_dispatch[GetKey(m_device)].CreateBuffer(m_device, &createInfo, nullptr, &buffer)) != VK_SUCCESS)
+		throw std::runtime_error("failed to create frame arena buffer of "+std::to_string(size)+" bytes: "+vk::to_string((vk::Result)r));
+
+	gpu_allocation memory;
+	try
+	{
+		memory = allocator->allocateBuffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	}
+	catch(...)
+	{
+		device_dispatch[GetKey(m_device)].DestroyBuffer(m_device, buffer, nullptr);
+		throw;
+	}
+	return m_chunks.emplace_back(std::make_unique<chunk>(chunk{buffer, memory, size, 0})).get();
+}
+
+frame_arena::slice frame_arena::allocate(VkDeviceSize size)
+{
+	if(!m_current.empty())
+	{
+		chunk& c = *m_current.back();
+		VkDeviceSize offset = (c.used + m_alignment - 1) / m_alignment * m_alignment;
+		if(offset + size <= c.size)
+		{
+			c.used = offset + size;
+			return {c.buffer, offset, c.memory.mapped + offset};
+		}
+	}
+
+	// a fresh chunk starts at offset 0, which is aligned for any alignment
+	chunk* next = nullptr;
+	auto found = std::find_if(m_free.begin(), m_free.end(), [size](chunk* c){return c->size >= size;});
+	if(found != m_free.end())
+	{
+		next = *found;
+		m_free.erase(found);
+	}
+	else
+		next = createChunk(std::max(size, m_chunkSize));
+	next->used = size;
+	m_current.push_back(next);
+	return {next->buffer, 0, next->memory.mapped};
+}
+
+void frame_arena::retire(frame_tracker& frames)
+{
+	if(m_current.empty())
+		return;
+	frames.defer([this, chunks = std::move(m_current)](){
+		m_free.insert(m_free.end(), chunks.begin(), chunks.end());
+	});
+	m_current.clear();
+}
@@ -0,0 +1,118 @@
+#include "frame_tracker.hpp"
+
+#include "dispatch.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <vulkan/vulkan.hpp>
+
+using CheekyLayer::logger;
+
+frame_tracker::frame_tracker(VkDevice device) : m_device(device)
+{
+}
+
+frame_tracker::~frame_tracker()
+{
+	std::vector<VkFence> fences = m_freeFences;
+	for(auto& f : m_frames)
+		if(f.fence && std::find(fences.begin(), fences.end(), f.fence) == fences.end())
+			fences.push_back(f.fence);
+	if(!fences.empty())
+		device_dispatch[GetKey(m_device)].WaitForFences(m_device, fences.size(), fences.data(), VK_TRUE, UINT64_MAX);
+	for(VkFence fence : fences)
+		device_dispatch[GetKey(m_device)].DestroyFence(m_device, fence, nullptr);
+}
+
+void frame_tracker::mark(VkCommandBuffer commandBuffer)
+{
+	std::vector<std::function<void()>> finished;
+	{
+		std::unique_lock lock(m_mutex);
+		while(!m_frames.empty())
+		{
+			frame& f = m_frames.front();
+			if(!f.discarded && (!f.fence || device_dispatch[GetKey(m_device)].GetFenceStatus(m_device, f.fence) != VK_SUCCESS))
+				break;
+			finished.insert(finished.end(), std::make_move_iterator(f.deferred.begin()), std::make_move_iterator(f.deferred.end()));
+			VkFence fence = f.fence;
+			m_frames.pop_front();
+
+			// one fence covers every command buffer of a submission
+			if(fence && std::none_of(m_frames.begin(), m_frames.end(), [fence](const frame& other){return other.fence == fence;}))
+			{
+				device_dispatch[GetKey(m_device)].ResetFences(m_device, 1, &fence);
+				m_freeFences.push_back(fence);
+			}
+		}
+
+		m_frames.push_back({commandBuffer, VK_NULL_HANDLE, false, std::move(m_deferred)});
+		m_deferred.clear();
+	}
+
+	for(auto& f : finished)
+		f();
+}
+
+void frame_tracker::defer(std::function<void()> f)
+{
+	std::unique_lock lock(m_mutex);
+	m_deferred.push_back(std::move(f));
+}
+
+void frame_tracker::submitted(VkQueue queue, const std::vector<VkCommandBuffer>& commandBuffers)
+{
+	VkFence fence = VK_NULL_HANDLE;
+	{
+		std::unique_lock lock(m_mutex);
+		for(auto& f : m_frames)
+		{
+			if(f.fence || f.discarded || std::find(commandBuffers.begin(), commandBuffers.end(), f.commandBuffer) == commandBuffers.end())
+				continue;
+			if(!fence)
+			{
+				if(m_freeFences.empty())
+				{
+					VkFenceCreateInfo fenceCreateInfo{};
+					fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+					VkResult r = device_dispatch[GetKey(m_device)].CreateFence(m_device, &fenceCreateInfo, nullptr, &fence);
+					if(r != VK_SUCCESS)
+						throw std::runtime_error("failed to create frame fence: "+vk::to_string((vk::Result)r));
+				}
+				else
+				{
+					fence = m_freeFences.back();
+					m_freeFences.pop_back();
+				}
+			}
+			f.fence = fence;
+		}
+	}
+	if(!fence)
+		return;
+
+	// an empty submission signals its fence once everything submitted to the queue before it finished
+	VkResult r = device_dispatch[GetKey(m_device)].QueueSubmit(queue, 0, nullptr, fence);
+	if(r == VK_SUCCESS)
+		return;
+
+	*::logger << logger::begin << logger::error << "failed to submit frame fence: " << vk::to_string((vk::Result)r) << logger::end;
+	std::unique_lock lock(m_mutex);
+	for(auto& f : m_frames)
+		if(f.fence == fence)
+		{
+			f.fence = VK_NULL_HANDLE;
+			f.discarded = true;
+		}
+	device_dispatch[GetKey(m_device)].DestroyFence(m_device, fence, nullptr);
+}
+
+void frame_tracker::discarded(VkCommandBuffer commandBuffer)
+{
+	std::unique_lock lock(m_mutex);
+	for(auto& f : m_frames)
+		if(f.commandBuffer == commandBuffer && !f.fence)
+			f.discarded = true;
+}
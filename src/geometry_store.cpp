@@ -0,0 +1,116 @@
+#include "geometry_store.hpp"
+
+#include "dispatch.hpp"
+#include "layer.hpp"
+#include "logger.hpp"
+#include "shared.hpp"
+
+#include <bit>
+#include <stdexcept>
+#include <string>
+
+#include <vulkan/vulkan.hpp>
+
+using CheekyLayer::logger;
+
+geometry_store::geometry_store(VkDevice device, const nlohmann::json& config, const upload_service& uploads)
+	: m_device(device), m_vertices(config.value("vertexBytes", VkDeviceSize{64} << 20)), m_indices(config.value("indexBytes", VkDeviceSize{32} << 20))
+{
+	m_vertexBuffer = createBuffer(m_vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, uploads, m_vertexMemory);
+	try
+	{
+		m_indexBuffer = createBuffer(m_indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, uploads, m_indexMemory);
+	}
+	catch(...)
+	{
+		device_dispatch[GetKey(m_device)].DestroyBuffer(m_device, m_vertexBuffer, nullptr);
+		allocator->free(m_vertexMemory);
+		throw;
+	}
+	*::logger << logger::begin << "Geometry store of " << (m_vertices.size() >> 20) << " MiB vertices and " << (m_indices.size() >> 20)
+		<< " MiB indices, " << (m_vertexMemory.mapped && m_indexMemory.mapped ? "written directly" : "written through staging copies") << logger::end;
+}
+
+geometry_store::~geometry_store()
+{
+	device_dispatch[GetKey(m_device)].DestroyBuffer(m_device, m_vertexBuffer, nullptr);
+	device_dispatch[GetKey(m_device)].DestroyBuffer(m_device, m_indexBuffer, nullptr);
+	allocator->free(m_vertexMemory);
+	allocator->free(m_indexMemory);
+}
+
+VkBuffer geometry_store::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, const upload_service& uploads, gpu_allocation& memory)
+{
+	// meshes are written while the draws read other meshes from the same buffer, which an ownership transfer of the
+	// whole buffer would not allow
+	std::vector<uint32_t> families = uploads.sharingFamilies();
+	m_concurrent = !families.empty();
+
+	VkBufferCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	createInfo.size = size;
+	createInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage;
+	createInfo.sharingMode = families.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT;
+	createInfo.queueFamilyIndexCount = families.size();
+	createInfo.pQueueFamilyIndices = families.data();
+	VkBuffer buffer;
+	VkResult r;
+	if((r = device_dispatch[GetKey(m_device)].CreateBuffer(m_device, &createInfo, nullptr, &buffer)) != VK_SUCCESS)
+		throw std::runtime_error("failed to create geometry buffer of "+std::to_string(size)+" bytes: "+vk::to_string((vk::Result)r));
+
+	VkMemoryRequirements requirements;
+	device_dispatch[GetKey(m_device)].GetBufferMemoryRequirements(m_device, buffer, &requirements);
+	try
+	{
+		uint32_t direct = requirements.memoryTypeBits & uploads.direct().memoryTypes;
+		memory = direct ? allocator->allocateOfType(requirements, std::countr_zero(direct), true)
+			: allocator->allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+		if((r = device_dispatch[GetKey(m_device)].BindBufferMemory(m_device, buffer, memory.memory, memory.offset)) != VK_SUCCESS)
+		{
+			allocator->free(memory);
+			throw std::runtime_error("failed to bind geometry buffer memory: "+vk::to_string((vk::Result)r));
+		}
+	}
+	catch(...)
+	{
+		device_dispatch[GetKey(m_device)].DestroyBuffer(m_device, buffer, nullptr);
+		throw;
+	}
+	return buffer;
+}
+
+std::optional<geometry_range> geometry_store::allocate(VkDeviceSize vertexSize, VkDeviceSize vertexStride, VkDeviceSize indexSize)
+{
+	std::unique_lock lock(m_mutex);
+	auto vertexOffset = m_vertices.allocate(vertexSize, vertexStride);
+	if(!vertexOffset)
+		return std::nullopt;
+	// 4 bytes fit both index types
+	auto indexOffset = m_indices.allocate(indexSize, 4);
+	if(!indexOffset)
+	{
+		m_vertices.free(*vertexOffset, vertexSize);
+		return std::nullopt;
+	}
+	return geometry_range{*vertexOffset, vertexSize, *indexOffset, indexSize};
+}
+
+void geometry_store::free(const geometry_range& range)
+{
+	std::unique_lock lock(m_mutex);
+	m_vertices.free(range.vertexOffset, range.vertexSize);
+	m_indices.free(range.indexOffset, range.indexSize);
+}
+
+void geometry_store::write(upload_batch& batch, const geometry_range& range, const void* vertexData, const void* indexData)
+{
+	// the store's memory is only mapped when it came from the direct memory types
+	if(m_vertexMemory.mapped)
+		batch.writeMemory(m_vertexMemory, range.vertexOffset, vertexData, range.vertexSize);
+	else
+		batch.uploadBuffer(m_vertexBuffer, range.vertexOffset, vertexData, range.vertexSize, m_concurrent);
+	if(m_indexMemory.mapped)
+		batch.writeMemory(m_indexMemory, range.indexOffset, indexData, range.indexSize);
+	else
+		batch.uploadBuffer(m_indexBuffer, range.indexOffset, indexData, range.indexSize, m_concurrent);
+}
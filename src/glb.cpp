@@ -0,0 +1,99 @@
+#include "glb.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+static constexpr uint32_t glbMagic = 0x46546C67; // "glTF"
+static constexpr uint32_t chunkJson = 0x4E4F534A;
+static constexpr uint32_t chunkBin = 0x004E4942;
+
+static bool fits(uint64_t offset, uint64_t size, uint64_t limit)
+{
+	return offset <= limit && size <= limit - offset;
+}
+
+static size_t component_size(uint32_t componentType)
+{
+	switch(componentType)
+	{
+		case 5120: case 5121: return 1;
+		case 5122: case 5123: return 2;
+		case 5125: case 5126: return 4;
+		default: throw std::runtime_error("unknown accessor component type "+std::to_string(componentType));
+	}
+}
+
+static uint32_t component_count(const std::string& type)
+{
+	if(type == "SCALAR") return 1;
+	if(type == "VEC2") return 2;
+	if(type == "VEC3") return 3;
+	if(type == "VEC4") return 4;
+	throw std::runtime_error("unsupported accessor type "+type);
+}
+
+glb_file::glb_file(const std::string& path) : m_path(path), m_file(path)
+{
+	const uint8_t* data = m_file.data();
+	size_t size = m_file.size();
+	uint32_t header[3];
+	if(size < sizeof(header))
+		throw std::runtime_error("not a GLB file: "+path);
+	std::memcpy(header, data, sizeof(header));
+	if(header[0] != glbMagic || header[1] != 2 || header[2] > size)
+		throw std::runtime_error("not a glTF 2.0 GLB file: "+path);
+
+	// chunks are 4 byte aligned, JSON first and an optional BIN after it
+	for(size_t offset = sizeof(header); offset + 8 <= header[2];)
+	{
+		uint32_t chunk[2];
+		std::memcpy(chunk, data + offset, sizeof(chunk));
+		offset += sizeof(chunk);
+		if(offset + chunk[0] > header[2])
+			throw std::runtime_error("truncated GLB chunk in "+path);
+		if(chunk[1] == chunkJson && m_json.is_null())
+			m_json = nlohmann::json::parse(data + offset, data + offset + chunk[0]);
+		else if(chunk[1] == chunkBin && m_bin.empty())
+			m_bin = {data + offset, chunk[0]};
+		offset += (chunk[0] + 3) & ~3u;
+	}
+	if(m_json.is_null())
+		throw std::runtime_error("GLB file without JSON chunk: "+path);
+}
+
+std::span<const uint8_t> glb_file::bufferView(size_t index) const
+{
+	const auto& view = m_json.at("bufferViews").at(index);
+	if(view.at("buffer") != 0 || m_json.at("buffers").at(0).contains("uri"))
+		throw std::runtime_error("only the embedded buffer of GLB files is supported: "+m_path);
+	size_t offset = view.value("byteOffset", size_t{0});
+	size_t length = view.at("byteLength");
+	if(!fits(offset, length, m_bin.size()))
+		throw std::runtime_error("buffer view "+std::to_string(index)+" is out of bounds in "+m_path);
+	return m_bin.subspan(offset, length);
+}
+
+glb_file::accessor glb_file::getAccessor(size_t index) const
+{
+	const auto& a = m_json.at("accessors").at(index);
+	if(a.contains("sparse"))
+		throw std::runtime_error("sparse accessors are not supported: "+m_path);
+
+	accessor result{};
+	result.componentType = a.at("componentType");
+	result.count = component_count(a.at("type"));
+	result.elements = a.at("count");
+	result.normalized = a.value("normalized", false);
+	size_t elementSize = component_size(result.componentType) * result.count;
+
+	auto view = bufferView(a.at("bufferView"));
+	result.stride = m_json["bufferViews"][a["bufferView"].get<size_t>()].value("byteStride", elementSize);
+	size_t offset = a.value("byteOffset", size_t{0});
+	if(result.stride < elementSize)
+		throw std::runtime_error("accessor "+std::to_string(index)+" has a byte stride smaller than its elements in "+m_path);
+	// the last element has to end inside the view, checked without byteOffset + count * stride wrapping around
+	if(result.elements > 0 && (!fits(offset, elementSize, view.size()) || result.elements - 1 > (view.size() - offset - elementSize) / result.stride))
+		throw std::runtime_error("accessor "+std::to_string(index)+" is out of bounds in "+m_path);
+	result.data = view.data() + offset;
+	return result;
+}
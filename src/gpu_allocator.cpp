@@ -0,0 +1,156 @@
+#include "gpu_allocator.hpp"
+#include "dispatch.hpp"
+#include "layer.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vulkan/vulkan.hpp>
+
+gpu_allocator::gpu_allocator(VkDevice device, VkDeviceSize blockSize) : m_device(device), m_blockSize(blockSize)
+{
+}
+
+gpu_allocator::~gpu_allocator()
+{
+	for(auto& [memory, b] : m_blocks)
+		device_dispatch[GetKey(m_device)].FreeMemory(m_device, memory, nullptr);
+}
+
+gpu_allocator::block& gpu_allocator::createBlock(VkDeviceSize size, uint32_t memoryType, bool linear, bool dedicated)
+{
+	VkMemoryAllocateInfo allocateInfo{};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.allocationSize = size;
+	allocateInfo.memoryTypeIndex = memoryType;
+	VkDeviceMemory memory;
+	VkResult r;
+	if((r = device_dispatch[GetKey(m_device)].AllocateMemory(m_device, &allocateInfo, nullptr, &memory)) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate a memory block of "+std::to_string(size)+" bytes: "+vk::to_string((vk::Result)r));
+
+	void* mapped = nullptr;
+	if(deviceInfos[m_device].memory.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		if((r = device_dispatch[GetKey(m_device)].MapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, &mapped)) != VK_SUCCESS)
+		{
+			device_dispatch[GetKey(m_device)].FreeMemory(m_device, memory, nullptr);
+			throw std::runtime_error("failed to map a memory block: "+vk::to_string((vk::Result)r));
+		}
+	}
+
+	auto b = std::make_unique<block>(block{memory, size, memoryType, linear, dedicated, static_cast<uint8_t*>(mapped), range_allocator(size)});
+	return *(m_blocks[memory] = std::move(b));
+}
+
+bool gpu_allocator::allocateFrom(block& b, const VkMemoryRequirements& requirements, gpu_allocation& allocation)
+{
+	auto offset = b.ranges.allocate(requirements.size, requirements.alignment);
+	if(!offset)
+		return false;
+	allocation.memory = b.memory;
+	allocation.offset = *offset;
+	allocation.size = requirements.size;
+	allocation.mapped = b.mapped ? b.mapped + *offset : nullptr;
+	return true;
+}
+
+gpu_allocation gpu_allocator::allocateOfType(const VkMemoryRequirements& requirements, uint32_t memoryType, bool linear)
+{
+	std::unique_lock lock(m_mutex);
+	gpu_allocation allocation;
+	if(requirements.size > m_blockSize / 2)
+	{
+		if(!allocateFrom(createBlock(requirements.size, memoryType, linear, true), requirements, allocation))
+			throw std::runtime_error("failed to allocate from a dedicated memory block");
+		return allocation;
+	}
+
+	for(auto& [memory, b] : m_blocks)
+		if(b->memoryType == memoryType && b->linear == linear && !b->dedicated && allocateFrom(*b, requirements, allocation))
+			return allocation;
+	if(!allocateFrom(createBlock(m_blockSize, memoryType, linear, false), requirements, allocation))
+		throw std::runtime_error("failed to allocate from a new memory block");
+	return allocation;
+}
+
+gpu_allocation gpu_allocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear)
+{
+	return allocateOfType(requirements, findMemoryType(deviceInfos[m_device].memory, requirements.memoryTypeBits, properties), linear);
+}
+
+gpu_allocation gpu_allocator::allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties)
+{
+	VkMemoryRequirements requirements;
+	device_dispatch[GetKey(m_device)].GetBufferMemoryRequirements(m_device, buffer, &requirements);
+	gpu_allocation allocation = allocate(requirements, properties, true);
+	VkResult r;
+	if((r = device_dispatch[GetKey(m_device)].BindBufferMemory(m_device, buffer, allocation.memory, allocation.offset)) != VK_SUCCESS)
+	{
+		free(allocation);
+		throw std::runtime_error("failed to bind buffer memory: "+vk::to_string((vk::Result)r));
+	}
+	return allocation;
+}
+
+gpu_allocation gpu_allocator::allocateImage(VkImage image, VkMemoryPropertyFlags properties)
+{
+	VkMemoryRequirements requirements;
+	device_dispatch[GetKey(m_device)].GetImageMemoryRequirements(m_device, image, &requirements);
+	gpu_allocation allocation = allocate(requirements, properties, false);
+	VkResult r;
+	if((r = device_dispatch[GetKey(m_device)].BindImageMemory(m_device, image, allocation.memory, allocation.offset)) != VK_SUCCESS)
+	{
+		free(allocation);
+		throw std::runtime_error("failed to bind image memory: "+vk::to_string((vk::Result)r));
+	}
+	return allocation;
+}
+
+void gpu_allocator::free(const gpu_allocation& allocation)
+{
+	if(allocation.memory == VK_NULL_HANDLE)
+		return;
+
+	std::unique_lock lock(m_mutex);
+	auto found = m_blocks.find(allocation.memory);
+	if(found == m_blocks.end())
+		throw std::runtime_error("freeing memory that was not allocated here");
+	block& b = *found->second;
+
+	b.ranges.free(allocation.offset, allocation.size);
+
+	if(b.ranges.allocations() > 0)
+		return;
+	// keep one empty block per kind around, so a companion coming right back does not allocate again
+	bool spare = !b.dedicated;
+	if(spare)
+		for(auto& [memory, other] : m_blocks)
+			if(other.get() != &b && other->memoryType == b.memoryType && other->linear == b.linear && !other->dedicated && other->ranges.allocations() == 0)
+			{
+				spare = false;
+				break;
+			}
+	if(spare)
+		return;
+	device_dispatch[GetKey(m_device)].FreeMemory(m_device, b.memory, nullptr);
+	m_blocks.erase(found);
+}
+
+std::vector<gpu_allocator::heap_stats> gpu_allocator::stats()
+{
+	const auto& properties = deviceInfos[m_device].memory;
+	std::vector<heap_stats> heaps(properties.memoryHeapCount);
+
+	std::unique_lock lock(m_mutex);
+	for(auto& [memory, b] : m_blocks)
+	{
+		heap_stats& s = heaps[properties.memoryTypes[b->memoryType].heapIndex];
+		s.blockBytes += b->size;
+		s.usedBytes += b->ranges.used();
+		s.wastedBytes += b->size - b->ranges.used();
+		s.blocks++;
+		s.allocations += b->ranges.allocations();
+	}
+	return heaps;
+}
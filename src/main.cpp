@@ -2,6 +2,7 @@
 #include "companion.hpp"
 #include "net/server.hpp"
 #include "net/handler.hpp"
+#include "device_hooks.hpp"
 
 #include "logger.hpp"
 #include "dispatch.hpp"
@@ -13,11 +14,14 @@
 #include "utils.hpp"
 
 #include <cmath>
+#include <filesystem>
 #include <memory>
 #include <ostream>
 #include <stdexcept>
 #include <string>
+#include <algorithm>
 #include <chrono>
+#include <thread>
 #include <vulkan/vulkan_core.h>
 
 #include <vulkan/vulkan.hpp>
@@ -59,7 +63,19 @@ void createDescriptors(json& json, VkDevice device, CheekyLayer::active_logger&
 	VkDescriptorSetLayoutCreateInfo layoutInfo{};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	std::vector<VkDescriptorSetLayoutBinding> bindings;
-	for(auto& a : json) parse_json_struct(a, &bindings.emplace_back(), "VkDescriptorSetLayoutBinding");
+	dynamicBindings.clear();
+	for(auto& a : json)
+	{
+		VkDescriptorSetLayoutBinding& binding = bindings.emplace_back();
+		parse_json_struct(a, &binding, "VkDescriptorSetLayoutBinding");
+		// every client's variables are in the same ring buffer, at their own dynamic offset
+		bool client = a["_source"]["type"] == "client";
+		if(client)
+			binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		if(binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC)
+			dynamicBindings.push_back({binding.binding, client});
+	}
+	std::sort(dynamicBindings.begin(), dynamicBindings.end(), [](const DynamicBinding& a, const DynamicBinding& b){return a.binding < b.binding;});
 	layoutInfo.bindingCount = bindings.size();
 	layoutInfo.pBindings = bindings.data();
 
@@ -73,12 +89,14 @@ void createDescriptors(json& json, VkDevice device, CheekyLayer::active_logger&
 	std::map<VkDescriptorType, uint32_t> sizes;
 	for(auto& a : bindings) sizes[a.descriptorType]++;
 
-	int maxClients = mainConfig["maxClients"];
-	for(auto& [a, b] : sizes) b *= maxClients;
+	// a companion's set is replaced instead of written while frames in flight may use it, so there are some per client
+	uint32_t maxSets = mainConfig["maxClients"].get<uint32_t>() * mainConfig.value("descriptorSetsPerClient", 8u);
+	for(auto& [a, b] : sizes) b *= maxSets;
 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.maxSets = 1;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	poolInfo.maxSets = maxSets;
 	std::vector<VkDescriptorPoolSize> poolSizes;
 	for(auto& [type, size] : sizes) poolSizes.push_back(VkDescriptorPoolSize{.type = type, .descriptorCount = size});
 	poolInfo.poolSizeCount = poolSizes.size();
@@ -89,13 +107,67 @@ void createDescriptors(json& json, VkDevice device, CheekyLayer::active_logger&
 		throw std::runtime_error("failed to create descriptor pool: "+vk::to_string((vk::Result)r));
 }
 
+void compileDrawPlan(json& config)
+{
+	DrawPlan plan;
+	plan.renderArea = rect2D_from_json(config["renderPassBegin"]["renderArea"]);
+	plan.clearValues.resize(config["renderPass"]["subpasses"][0]["colorAttachments"].size()+1);
+
+	static const std::map<std::string, DescriptorSource> sources = {
+		{"vars", DescriptorSource::Vars},
+		{"client", DescriptorSource::Client},
+		{"texture", DescriptorSource::Texture},
+		{"steal", DescriptorSource::Steal}
+	};
+	for(size_t i=0; i<config["descriptors"].size(); i++)
+	{
+		auto& d = config["descriptors"][i];
+		auto source = sources.find(d["_source"]["type"].get<std::string>());
+		if(source == sources.end())
+			continue;
+		DescriptorPlan& descriptor = plan.descriptors.emplace_back();
+		descriptor.source = source->second;
+		descriptor.binding = d["binding"];
+		descriptor.type = descriptorBindings.at(i).descriptorType;
+		descriptor.srcBinding = source->second == DescriptorSource::Steal ? d["_source"]["binding"].get<uint32_t>() : 0;
+		descriptor.dynamicIndex = -1;
+		for(size_t k=0; k<dynamicBindings.size(); k++)
+			if(dynamicBindings[k].binding == descriptor.binding)
+				descriptor.dynamicIndex = k;
+	}
+	plan.steals = std::any_of(plan.descriptors.begin(), plan.descriptors.end(), [](const DescriptorPlan& d){return d.source == DescriptorSource::Steal;});
+	drawPlan = std::move(plan);
+}
+
 void createPipelineLayout(json& json, VkDevice device)
 {
 	VkPipelineLayoutCreateInfo plCreateInfo{};
 	plCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	plCreateInfo.setLayoutCount = 1;
 	plCreateInfo.pSetLayouts = &descriptorSetLayout;
-	plCreateInfo.pushConstantRangeCount = 0;
+
+	// one vertex stage range covering the dequantization at 0 and the client constants, by default right after it
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	if(vertexFormat == VertexFormat::Quantized)
+		pushConstantRange.size = sizeof(VertexDequantization);
+	if(json.contains("clientPushConstants"))
+	{
+		for(auto& d : gameConfig["descriptors"])
+			if(d["_source"]["type"] == "client")
+				throw std::runtime_error("descriptor binding "+std::to_string(d["binding"].get<int>())+" uses the client variables, which \"clientPushConstants\" replaces");
+		uint32_t offset = json["clientPushConstants"].value("offset", pushConstantRange.size);
+		if(pushConstantRange.size == 0)
+			pushConstantRange.offset = offset;
+		else if(offset < pushConstantRange.size)
+			throw std::runtime_error("the client push constants overlap the vertex dequantization");
+		pushConstantRange.size = offset + sizeof(ClientConstants) - pushConstantRange.offset;
+		clientConstantsOffset = offset;
+	}
+	else
+		clientConstantsOffset.reset();
+	plCreateInfo.pushConstantRangeCount = pushConstantRange.size > 0 ? 1 : 0;
+	plCreateInfo.pPushConstantRanges = &pushConstantRange;
 	
 	VkResult r = device_dispatch[GetKey(device)].CreatePipelineLayout(device, &plCreateInfo, nullptr, &pipelineLayout);
 	if(r != VK_SUCCESS)
@@ -168,6 +240,28 @@ void createRenderPass(json& json, VkDevice device)
 		throw std::runtime_error("failed to create render pass: "+vk::to_string((vk::Result)r));
 }
 
+void generateVertexInput(VertexFormat format, std::vector<VkVertexInputBindingDescription>& bindings, std::vector<VkVertexInputAttributeDescription>& attributes)
+{
+	bindings = {{.binding = 0, .stride = static_cast<uint32_t>(vertex_stride(format)), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX}};
+	switch(format)
+	{
+		case VertexFormat::Float:
+			attributes = {
+				{.location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = offsetof(Vertex, position)},
+				{.location = 1, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = offsetof(Vertex, normal)},
+				{.location = 2, .binding = 0, .format = VK_FORMAT_R32G32_SFLOAT, .offset = offsetof(Vertex, texCoord)}
+			};
+			break;
+		case VertexFormat::Quantized:
+			attributes = {
+				{.location = 0, .binding = 0, .format = VK_FORMAT_R16G16B16A16_UNORM, .offset = offsetof(PackedVertex, position)},
+				{.location = 1, .binding = 0, .format = VK_FORMAT_R16G16_SNORM, .offset = offsetof(PackedVertex, normal)},
+				{.location = 2, .binding = 0, .format = VK_FORMAT_R16G16_SFLOAT, .offset = offsetof(PackedVertex, texCoord)}
+			};
+			break;
+	}
+}
+
 void createPipeline(std::string filebase, json& json, VkDevice device)
 {
 	std::vector<VkShaderModule> shaderModules;
@@ -244,11 +338,33 @@ void createPipeline(std::string filebase, json& json, VkDevice device)
 	vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	vertexInputState.flags = json["vertexInputState"]["flags"];
 	std::vector<VkVertexInputBindingDescription> inputBindings;
-	for(auto& a : json["vertexInputState"]["vertexBindingDescriptions"]) parse_json_struct(a, &inputBindings.emplace_back(), "VkVertexInputBindingDescription");
+	std::vector<VkVertexInputAttributeDescription> inputAttributes;
+	// with an explicit vertex format, the descriptions have to match the cooked meshes, so they are not taken from the config
+	if(gameConfig.contains("vertexFormat"))
+		generateVertexInput(vertexFormat, inputBindings, inputAttributes);
+	else
+	{
+		for(auto& a : json["vertexInputState"]["vertexBindingDescriptions"]) parse_json_struct(a, &inputBindings.emplace_back(), "VkVertexInputBindingDescription");
+		for(auto& a : json["vertexInputState"]["vertexAttributeDescriptions"]) parse_json_struct(a, &inputAttributes.emplace_back(), "VkVertexInputAttributeDescription");
+	}
+	// a mat4 per instance, as four vec4 attributes from "location" on
+	if(gameConfig.contains("instanceMatrix"))
+	{
+		uint32_t binding = 0;
+		for(const auto& b : inputBindings)
+			binding = std::max(binding, b.binding + 1);
+		binding = gameConfig["instanceMatrix"].value("binding", binding);
+		uint32_t location = gameConfig["instanceMatrix"]["location"];
+		inputBindings.push_back({.binding = binding, .stride = sizeof(glm::mat4), .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE});
+		for(uint32_t column=0; column<4; column++)
+			inputAttributes.push_back({.location = location + column, .binding = binding, .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+				.offset = static_cast<uint32_t>(column * sizeof(glm::vec4))});
+		instanceBinding = binding;
+	}
+	else
+		instanceBinding.reset();
 	vertexInputState.vertexBindingDescriptionCount = inputBindings.size();
 	vertexInputState.pVertexBindingDescriptions = inputBindings.data();
-	std::vector<VkVertexInputAttributeDescription> inputAttributes;
-	for(auto& a : json["vertexInputState"]["vertexAttributeDescriptions"]) parse_json_struct(a, &inputAttributes.emplace_back(), "VkVertexInputAttributeDescription");
 	vertexInputState.vertexAttributeDescriptionCount = inputAttributes.size();
 	vertexInputState.pVertexAttributeDescriptions = inputAttributes.data();
 	info.pVertexInputState = &vertexInputState;
@@ -309,6 +425,30 @@ void createPipeline(std::string filebase, json& json, VkDevice device)
 		throw std::runtime_error("failed to create pipeline: "+vk::to_string((vk::Result)r));
 }
 
+void findSampledBlockFormats(VkDevice device, const VkDeviceCreateInfo* createInfo, CheekyLayer::active_logger& log)
+{
+	// BC formats are only allowed with the textureCompressionBC feature, which the game has to have enabled itself
+	bool enabled = createInfo && createInfo->pEnabledFeatures && createInfo->pEnabledFeatures->textureCompressionBC;
+	for(auto next = createInfo ? static_cast<const VkBaseInStructure*>(createInfo->pNext) : nullptr; next; next = next->pNext)
+		if(next->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2)
+			enabled = enabled || reinterpret_cast<const VkPhysicalDeviceFeatures2*>(next)->features.textureCompressionBC;
+
+	sampledBlockFormats.clear();
+	if(enabled)
+	{
+		VkPhysicalDevice physicalDevice = deviceInfos[device].physicalDevice;
+		for(VkFormat format : blockCompressedFormats)
+		{
+			VkFormatProperties properties;
+			instance_dispatch[GetKey(physicalDevice)].GetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+			if(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)
+				sampledBlockFormats.insert(format);
+		}
+	}
+	if(sampledBlockFormats.size() < blockCompressedFormats.size())
+		log << "BC textures are decoded to RGBA8 for " << (enabled ? std::to_string(blockCompressedFormats.size() - sampledBlockFormats.size())+" formats the device cannot sample" : std::string("textureCompressionBC is not enabled")) << "\n";
+}
+
 void createGeneralVariables(VkDevice device, CheekyLayer::active_logger& log)
 {
 	VkResult result;
@@ -322,23 +462,8 @@ void createGeneralVariables(VkDevice device, CheekyLayer::active_logger& log)
 	if((result = device_dispatch[GetKey(device)].CreateBuffer(device, &bufferCreateInfo, nullptr, &generalVariablesBuffer)) != VK_SUCCESS)
 		throw std::runtime_error("failed to create general variables buffer: "+vk::to_string((vk::Result)result));
 
-	VkMemoryRequirements requirements;
-	device_dispatch[GetKey(device)].GetBufferMemoryRequirements(device, generalVariablesBuffer, &requirements);
-
-	VkMemoryAllocateInfo memoryallocateInfo{};
-	memoryallocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryallocateInfo.memoryTypeIndex = findMemoryType(deviceInfos[device].memory, requirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	memoryallocateInfo.allocationSize = requirements.size;
-
-	if(device_dispatch[GetKey(device)].AllocateMemory(device, &memoryallocateInfo, nullptr, &generalVariablesMemory) != VK_SUCCESS)
-		throw std::runtime_error("failed to allocate memory for general variables buffer");
-
-	if(device_dispatch[GetKey(device)].BindBufferMemory(device, generalVariablesBuffer, generalVariablesMemory, 0) != VK_SUCCESS)
-		throw std::runtime_error("failed to bind memory to general variables buffer");
-
-	if(device_dispatch[GetKey(device)].MapMemory(device, generalVariablesMemory, 0, sizeof(GeneralVariables), 0, (void**)&generalVariables) != VK_SUCCESS)
-		throw std::runtime_error("failed to map memory for general variables buffer");
+	generalVariablesMemory = allocator->allocateBuffer(generalVariablesBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	generalVariables = reinterpret_cast<GeneralVariables*>(generalVariablesMemory.mapped);
 }
 
 void updateGeneralVariables()
@@ -357,14 +482,22 @@ void updateGeneralVariables()
 	generalVariables->partial_seconds = partialSeconds.count();
 }
 
-void loadCompanion(std::string directory, std::string name)
+// only reads companion.json, the assets are loaded once the companion gets its first user
+void addCompanion(std::string directory, std::string name, std::shared_ptr<const asset_bundle> bundle)
 {
 	json json;
+	if(bundle)
+	{
+		std::string_view manifest = bundle->manifest(name);
+		json = nlohmann::json::parse(manifest.begin(), manifest.end());
+	}
+	else
 	{
 		std::ifstream in(directory+"/companions/"+name+"/companion.json");
 		in >> json;
 	}
-	std::unique_ptr<companion> c = std::make_unique<companion>(json, directory+"/companions/"+name);
+	std::unique_ptr<companion> c = std::make_unique<companion>(json, directory+"/companions/"+name, bundle);
+	c->setVertexFormat(vertexFormat);
 	companions[c->id()] = std::move(c);
 }
 
@@ -417,21 +550,77 @@ class init_action : public action
 				std::ifstream in(m_directory+"/games/"+m_game+"/game.json");
 				in >> gameConfig;
 			}
+			vertexFormat = parse_vertex_format(gameConfig.value("vertexFormat", "float"));
+			if(gameConfig.contains("lodReference"))
+				lodReference = glm::vec3(gameConfig["lodReference"]["x"].get<float>(), gameConfig["lodReference"]["y"].get<float>(),
+					gameConfig["lodReference"]["z"].get<float>());
 
 			createDescriptors(gameConfig["descriptors"], device, ctx.logger);
+			compileDrawPlan(gameConfig);
 			createPipelineLayout(gameConfig["pipelineLayout"], device);
 			createRenderPass(gameConfig["renderPass"], device);
 			createPipeline(m_directory+"/games/"+m_game, gameConfig["pipeline"], device);
+			if(!allocator)
+				allocator = std::make_unique<gpu_allocator>(device, mainConfig.value("memoryBlockSize", VkDeviceSize{64} << 20));
 			createGeneralVariables(device, ctx.logger);
-
-			loadCompanion(m_directory, "TheCube");
-			loadCompanion(m_directory, "Monke");
-			for(auto& [name, companion] : companions)
+			findSampledBlockFormats(device, ctx.deviceCreateInfo, ctx.logger);
+			if(!clientVariables && std::any_of(dynamicBindings.begin(), dynamicBindings.end(), [](const DynamicBinding& b){return b.client;}))
+				clientVariables = std::make_unique<uniform_ring>(device, sizeof(ClientVariables), mainConfig["maxClients"].get<uint32_t>(),
+					mainConfig.value("framesInFlight", 4u));
+
+			if(!workers)
+				workers = std::make_unique<thread_pool>(mainConfig.value("workerThreads", std::thread::hardware_concurrency()));
+
+			if(!uploads)
+				uploads = std::make_unique<upload_service>(device, ctx.deviceCreateInfo, mainConfig.value("uploadQueue", json()), mainConfig.value("directUploads", true),
+					mainConfig.value("streamBudget", 4u << 20));
+			if(!geometry)
+				geometry = std::make_unique<geometry_store>(device, mainConfig.value("geometryBuffer", json()), *uploads);
+
+			if(!frames)
+				frames = std::make_unique<frame_tracker>(device);
+			// the frame tracker learns from the submissions when the GPU is done with a frame
+			install_device_hooks(device);
+			if(instanceBinding && !instances)
+				instances = std::make_unique<frame_arena>(device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, sizeof(glm::vec4), 64u << 10);
+			vramBudget = mainConfig.value("vramBudget", VkDeviceSize{512} << 20);
+
+			// a packed bundle replaces the companion directories, which stay for development
+			std::string bundlePath = m_directory+"/"+mainConfig.value("bundle", std::string("companions.bundle"));
+			std::shared_ptr<const asset_bundle> bundle;
+			if(std::filesystem::exists(bundlePath))
+			{
+				bundle = std::make_shared<asset_bundle>(bundlePath);
+				for(const auto& name : bundle->companions())
+					addCompanion(m_directory, name, bundle);
+				ctx.logger << "Found " << companions.size() << " companions in " << bundlePath << "\n";
+			}
+			else
 			{
-				companion->uploadMesh(device, ctx.logger);
-				companion->uploadTexture(device, ctx.logger);
+				for(const auto& entry : std::filesystem::directory_iterator(m_directory+"/companions"))
+					if(entry.is_directory() && std::filesystem::exists(entry.path()/"companion.json"))
+						addCompanion(m_directory, entry.path().filename().string(), nullptr);
+				ctx.logger << "Found " << companions.size() << " companions\n";
 			}
 
+			if(!watcher && !bundle && mainConfig.value("hotReload", false))
+				watcher = std::make_unique<asset_watcher>(m_directory+"/companions", [directory = m_directory](const std::string& name, const std::set<std::string>& files){
+					// the companions are only added at startup, so new directories wait for a restart
+					for(auto& [id, c] : companions)
+					{
+						if(c->directory() != directory+"/companions/"+name)
+							continue;
+						try
+						{
+							c->reload(globalDevice, *uploads, files);
+						}
+						catch(const std::exception& ex)
+						{
+							*::logger << CheekyLayer::logger::begin << CheekyLayer::logger::error << "[" << id << "] failed to reload: " << ex.what() << CheekyLayer::logger::end;
+						}
+					}
+				});
+
 			ctx.logger << "Companion initialized for " << m_game << " in directory " << m_directory << "\n";
 			ready = true;
 		}
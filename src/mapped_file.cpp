@@ -0,0 +1,71 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mapped_file::mapped_file(const std::string& path, bool populate)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		throw std::runtime_error("file not found: "+path);
+
+	struct stat st;
+	if(fstat(fd, &st) < 0)
+	{
+		close(fd);
+		throw std::runtime_error("cannot stat file "+path+": "+std::string(std::strerror(errno)));
+	}
+	m_size = st.st_size;
+
+	// mmap refuses zero-sized mappings, but an empty file is still a valid (empty) view
+	if(m_size > 0)
+	{
+		void* p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+		if(p == MAP_FAILED)
+		{
+			close(fd);
+			throw std::runtime_error("cannot map file "+path+": "+std::string(std::strerror(errno)));
+		}
+		if(populate)
+			madvise(p, m_size, MADV_WILLNEED);
+		m_data = static_cast<const uint8_t*>(p);
+	}
+	close(fd);
+}
+
+mapped_file::mapped_file(mapped_file&& other) noexcept : m_data(other.m_data), m_size(other.m_size)
+{
+	other.m_data = nullptr;
+	other.m_size = 0;
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& other) noexcept
+{
+	if(this != &other)
+	{
+		release();
+		m_data = other.m_data;
+		m_size = other.m_size;
+		other.m_data = nullptr;
+		other.m_size = 0;
+	}
+	return *this;
+}
+
+mapped_file::~mapped_file()
+{
+	release();
+}
+
+void mapped_file::release()
+{
+	if(m_data)
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+	m_data = nullptr;
+	m_size = 0;
+}
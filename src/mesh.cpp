@@ -0,0 +1,475 @@
+#include "mesh.hpp"
+#include "mapped_file.hpp"
+#include "glb.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+namespace
+{
+	struct obj_index
+	{
+		int32_t position;
+		int32_t texCoord;
+		int32_t normal;
+
+		bool operator==(const obj_index&) const = default;
+	};
+
+	// open addressing with linear probing, sized once for the worst case of all corners being unique
+	class index_map
+	{
+		public:
+			index_map(size_t count) : m_mask(std::bit_ceil(std::max<size_t>(16, count + count/2)) - 1),
+				m_slots(m_mask+1) {}
+
+			// returns the index stored for key, or inserts value and returns it
+			uint32_t insert(const obj_index& key, uint32_t value)
+			{
+				for(size_t i = hash(key) & m_mask;; i = (i+1) & m_mask)
+				{
+					slot& s = m_slots[i];
+					if(s.value == empty)
+					{
+						s.key = key;
+						s.value = value;
+						return value;
+					}
+					if(s.key == key)
+						return s.value;
+				}
+			}
+		private:
+			static constexpr uint32_t empty = UINT32_MAX;
+
+			// key and value share a cache line, so a probe costs a single miss
+			struct slot
+			{
+				obj_index key;
+				uint32_t value = empty;
+			};
+
+			static size_t hash(const obj_index& key)
+			{
+				uint64_t h = static_cast<uint32_t>(key.position) * 0x9E3779B97F4A7C15ull;
+				h ^= static_cast<uint32_t>(key.texCoord) * 0xC2B2AE3D27D4EB4Full;
+				h ^= static_cast<uint32_t>(key.normal) * 0x165667B19E3779F9ull;
+				return h ^ (h >> 29);
+			}
+
+			size_t m_mask;
+			std::vector<slot> m_slots;
+	};
+
+	bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	const char* skip_spaces(const char* p, const char* end)
+	{
+		while(p < end && is_space(*p)) p++;
+		return p;
+	}
+
+	// plain decimals as written by modelling tools take a fast path, anything else goes through std::from_chars
+	const char* parse_float(const char* p, const char* end, float& out)
+	{
+		static constexpr double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+			1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+
+		p = skip_spaces(p, end);
+		if(p < end && *p == '+') p++;
+
+		const char* q = p;
+		bool negative = q < end && *q == '-';
+		if(negative) q++;
+
+		uint64_t mantissa = 0;
+		int digits = 0, fraction = 0;
+		for(; q < end && *q >= '0' && *q <= '9'; q++, digits++)
+			mantissa = mantissa*10 + (*q - '0');
+		if(q < end && *q == '.')
+			for(q++; q < end && *q >= '0' && *q <= '9'; q++, digits++, fraction++)
+				mantissa = mantissa*10 + (*q - '0');
+
+		bool plain = digits > 0 && digits <= 18 && (q == end || is_space(*q));
+		if(plain)
+		{
+			double value = mantissa / powers[fraction];
+			out = static_cast<float>(negative ? -value : value);
+			return q;
+		}
+
+		auto [ptr, ec] = std::from_chars(p, end, out);
+		if(ec != std::errc())
+			out = 0.0f;
+		return ptr;
+	}
+
+	// OBJ indices are 1-based and may be negative to count back from the last element
+	int32_t resolve_index(int32_t index, size_t count)
+	{
+		if(index > 0 && static_cast<size_t>(index) <= count)
+			return index - 1;
+		if(index < 0 && static_cast<size_t>(-index) <= count)
+			return static_cast<int32_t>(count) + index;
+		throw std::runtime_error("index out of range: "+std::to_string(index));
+	}
+
+	// parses one face corner in the forms v, v/t, v//n or v/t/n
+	const char* parse_corner(const char* p, const char* end, obj_index& out, size_t positions, size_t texCoords, size_t normals)
+	{
+		int32_t v = 0, t = 0, n = 0;
+		p = std::from_chars(p, end, v).ptr;
+		if(p < end && *p == '/')
+		{
+			p++;
+			if(p < end && *p != '/')
+				p = std::from_chars(p, end, t).ptr;
+			if(p < end && *p == '/')
+				p = std::from_chars(p+1, end, n).ptr;
+		}
+
+		out.position = resolve_index(v, positions);
+		out.texCoord = t != 0 ? resolve_index(t, texCoords) : -1;
+		out.normal = n != 0 ? resolve_index(n, normals) : -1;
+		return p;
+	}
+}
+
+MeshData load_obj(std::string file)
+{
+	mapped_file obj(file);
+	std::string_view text = obj.view();
+
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texCoords;
+	std::vector<obj_index> indices;
+	bool missingNormals = false;
+
+	std::vector<obj_index> polygon;
+	const char* p = text.data();
+	const char* end = p + text.size();
+	while(p < end)
+	{
+		const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		if(!lineEnd)
+			lineEnd = end;
+
+		const char* q = skip_spaces(p, lineEnd);
+		if(lineEnd - q >= 2 && q[0] == 'v' && is_space(q[1]))
+		{
+			glm::vec3& v = positions.emplace_back();
+			q = parse_float(q+2, lineEnd, v.x);
+			q = parse_float(q, lineEnd, v.y);
+			parse_float(q, lineEnd, v.z);
+		}
+		else if(lineEnd - q >= 3 && q[0] == 'v' && q[1] == 't' && is_space(q[2]))
+		{
+			float u = 0.0f, v = 0.0f;
+			q = parse_float(q+3, lineEnd, u);
+			parse_float(q, lineEnd, v);
+			texCoords.push_back({u, -v});
+		}
+		else if(lineEnd - q >= 3 && q[0] == 'v' && q[1] == 'n' && is_space(q[2]))
+		{
+			glm::vec3& n = normals.emplace_back();
+			q = parse_float(q+3, lineEnd, n.x);
+			q = parse_float(q, lineEnd, n.y);
+			parse_float(q, lineEnd, n.z);
+		}
+		else if(lineEnd - q >= 2 && q[0] == 'f' && is_space(q[1]))
+		{
+			polygon.clear();
+			q = skip_spaces(q+2, lineEnd);
+			while(q < lineEnd)
+			{
+				try
+				{
+					q = parse_corner(q, lineEnd, polygon.emplace_back(), positions.size(), texCoords.size(), normals.size());
+				}
+				catch(const std::runtime_error& ex)
+				{
+					throw std::runtime_error(file+": "+ex.what());
+				}
+				missingNormals |= polygon.back().normal < 0;
+				while(q < lineEnd && !is_space(*q)) q++;
+				q = skip_spaces(q, lineEnd);
+			}
+
+			// triangulate n-gons as a fan around their first corner
+			for(size_t i=2; i<polygon.size(); i++)
+			{
+				indices.push_back(polygon[0]);
+				indices.push_back(polygon[i-1]);
+				indices.push_back(polygon[i]);
+			}
+		}
+
+		// the last line may end the file without a newline, stepping past it would leave p beyond end
+		p = lineEnd < end ? lineEnd + 1 : end;
+	}
+
+	// faces without normals get smooth normals accumulated from the faces around each position
+	std::vector<glm::vec3> generatedNormals;
+	if(missingNormals)
+	{
+		generatedNormals.assign(positions.size(), glm::vec3(0.0f));
+		for(size_t i=0; i+2<indices.size(); i+=3)
+		{
+			glm::vec3 a = positions[indices[i].position];
+			glm::vec3 b = positions[indices[i+1].position];
+			glm::vec3 c = positions[indices[i+2].position];
+			glm::vec3 n = glm::cross(b-a, c-a);
+			for(int j=0; j<3; j++)
+				generatedNormals[indices[i+j].position] += n;
+		}
+		for(auto& n : generatedNormals)
+		{
+			float l = glm::length(n);
+			n = l > 0.0f ? n / l : glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+	}
+
+	MeshData mesh;
+	mesh.vertices.reserve(indices.size() / 2);
+	mesh.indices.reserve(indices.size());
+	index_map map(indices.size());
+	for(const auto& index : indices)
+	{
+		uint32_t i = map.insert(index, mesh.vertices.size());
+		if(i == mesh.vertices.size())
+		{
+			mesh.vertices.push_back({
+				positions[index.position],
+				index.normal >= 0 ? normals[index.normal] : generatedNormals[index.position],
+				index.texCoord >= 0 ? texCoords[index.texCoord] : glm::vec2(0.0f)
+			});
+		}
+		mesh.indices.push_back(i);
+	}
+
+	return mesh;
+}
+
+// reads components floats per element into out, converting integer components like glTF defines them
+static void read_floats(const glb_file::accessor& accessor, uint32_t components, float* out, size_t outStride)
+{
+	if(accessor.count != components)
+		throw std::runtime_error("accessor has "+std::to_string(accessor.count)+" components instead of "+std::to_string(components));
+
+	uint8_t* o = reinterpret_cast<uint8_t*>(out);
+	const uint8_t* p = accessor.data;
+	if(accessor.componentType == 5126)
+	{
+		for(size_t i=0; i<accessor.elements; i++, p += accessor.stride, o += outStride)
+			std::memcpy(o, p, components * sizeof(float));
+		return;
+	}
+
+	for(size_t i=0; i<accessor.elements; i++, p += accessor.stride, o += outStride)
+		for(uint32_t c=0; c<components; c++)
+		{
+			float v;
+			switch(accessor.componentType)
+			{
+				case 5120: { int8_t x; std::memcpy(&x, p + c, 1); v = accessor.normalized ? std::max(x / 127.0f, -1.0f) : x; break; }
+				case 5121: { uint8_t x = p[c]; v = accessor.normalized ? x / 255.0f : x; break; }
+				case 5122: { int16_t x; std::memcpy(&x, p + c*2, 2); v = accessor.normalized ? std::max(x / 32767.0f, -1.0f) : x; break; }
+				case 5123: { uint16_t x; std::memcpy(&x, p + c*2, 2); v = accessor.normalized ? x / 65535.0f : x; break; }
+				default: throw std::runtime_error("unsupported vertex component type "+std::to_string(accessor.componentType));
+			}
+			std::memcpy(o + c * sizeof(float), &v, sizeof(float));
+		}
+}
+
+MeshData load_glb(std::string file)
+{
+	glb_file glb(file);
+	MeshData mesh;
+	try
+	{
+		// every triangle primitive of every mesh, without the transforms of the nodes using them
+		for(const auto& m : glb.json().value("meshes", nlohmann::json::array()))
+			for(const auto& primitive : m.at("primitives"))
+			{
+				if(primitive.value("mode", 4) != 4)
+					continue;
+				const auto& attributes = primitive.at("attributes");
+				size_t base = mesh.vertices.size();
+				auto positions = glb.getAccessor(attributes.at("POSITION"));
+				mesh.vertices.resize(base + positions.elements, Vertex{glm::vec3(0.0f), glm::vec3(0.0f), glm::vec2(0.0f)});
+				Vertex* vertices = mesh.vertices.data() + base;
+				read_floats(positions, 3, &vertices->position.x, sizeof(Vertex));
+				if(attributes.contains("NORMAL"))
+				{
+					auto normals = glb.getAccessor(attributes["NORMAL"]);
+					if(normals.elements != positions.elements)
+						throw std::runtime_error("NORMAL and POSITION differ in length");
+					read_floats(normals, 3, &vertices->normal.x, sizeof(Vertex));
+				}
+				if(attributes.contains("TEXCOORD_0"))
+				{
+					auto texCoords = glb.getAccessor(attributes["TEXCOORD_0"]);
+					if(texCoords.elements != positions.elements)
+						throw std::runtime_error("TEXCOORD_0 and POSITION differ in length");
+					read_floats(texCoords, 2, &vertices->texCoord.x, sizeof(Vertex));
+				}
+
+				size_t firstIndex = mesh.indices.size();
+				if(primitive.contains("indices"))
+				{
+					auto indices = glb.getAccessor(primitive["indices"]);
+					if(indices.count != 1)
+						throw std::runtime_error("indices are not scalars");
+					mesh.indices.resize(firstIndex + indices.elements);
+					const uint8_t* p = indices.data;
+					for(size_t i=0; i<indices.elements; i++, p += indices.stride)
+					{
+						uint32_t index;
+						switch(indices.componentType)
+						{
+							case 5121: index = *p; break;
+							case 5123: { uint16_t x; std::memcpy(&x, p, 2); index = x; break; }
+							case 5125: std::memcpy(&index, p, 4); break;
+							default: throw std::runtime_error("unsupported index component type "+std::to_string(indices.componentType));
+						}
+						if(index >= positions.elements)
+							throw std::runtime_error("index out of bounds");
+						mesh.indices[firstIndex + i] = base + index;
+					}
+				}
+				else
+				{
+					mesh.indices.resize(firstIndex + positions.elements);
+					for(size_t i=0; i<positions.elements; i++)
+						mesh.indices[firstIndex + i] = base + i;
+				}
+				mesh.indices.resize(firstIndex + (mesh.indices.size() - firstIndex) / 3 * 3);
+
+				// like with OBJ files, primitives without normals get smooth ones from the faces around each vertex
+				if(!attributes.contains("NORMAL"))
+				{
+					for(size_t i=firstIndex; i+2<mesh.indices.size(); i+=3)
+					{
+						Vertex& a = mesh.vertices[mesh.indices[i]];
+						Vertex& b = mesh.vertices[mesh.indices[i+1]];
+						Vertex& c = mesh.vertices[mesh.indices[i+2]];
+						glm::vec3 n = glm::cross(b.position-a.position, c.position-a.position);
+						a.normal += n;
+						b.normal += n;
+						c.normal += n;
+					}
+					for(size_t i=base; i<mesh.vertices.size(); i++)
+					{
+						float l = glm::length(mesh.vertices[i].normal);
+						mesh.vertices[i].normal = l > 0.0f ? mesh.vertices[i].normal / l : glm::vec3(0.0f, 1.0f, 0.0f);
+					}
+				}
+			}
+	}
+	catch(const std::exception& ex)
+	{
+		throw std::runtime_error(file+": "+ex.what());
+	}
+	if(mesh.indices.empty())
+		throw std::runtime_error(file+": no triangles found");
+	return mesh;
+}
+
+IndexedMesh build_indexed_mesh(const MeshData& mesh, bool split, const std::vector<float>& lodErrors)
+{
+	// 16 bit index 0xFFFF restarts strips when the game's pipeline enables primitive restart, so it is never used
+	constexpr size_t maxVertices = 65535;
+
+	std::vector<const std::vector<uint32_t>*> levels = {&mesh.indices};
+	for(const auto& lod : mesh.lods)
+		levels.push_back(&lod);
+
+	IndexedMesh result;
+	auto begin_lod = [&](uint32_t level) {
+		float error = level < lodErrors.size() ? lodErrors[level] : 0.0f;
+		result.lods.push_back({static_cast<uint32_t>(result.submeshes.size()), 0, error});
+	};
+
+	if(mesh.vertices.size() <= maxVertices || !split)
+	{
+		size_t indexCount = 0;
+		for(uint32_t level=0; level<levels.size(); level++)
+		{
+			begin_lod(level);
+			result.submeshes.push_back({static_cast<uint32_t>(indexCount), static_cast<uint32_t>(levels[level]->size()), 0});
+			result.lods.back().submeshCount = 1;
+			indexCount += levels[level]->size();
+		}
+
+		result.vertices = mesh.vertices;
+		result.indexType = mesh.vertices.size() <= maxVertices ? IndexType::Uint16 : IndexType::Uint32;
+		result.indexData.resize(indexCount * static_cast<size_t>(result.indexType));
+		uint8_t* out = result.indexData.data();
+		for(const auto* level : levels)
+		{
+			if(result.indexType == IndexType::Uint16)
+				out = reinterpret_cast<uint8_t*>(std::copy(level->begin(), level->end(), reinterpret_cast<uint16_t*>(out)));
+			else
+			{
+				std::memcpy(out, level->data(), level->size() * sizeof(uint32_t));
+				out += level->size() * sizeof(uint32_t);
+			}
+		}
+		return result;
+	}
+
+	// walk the triangles in order and start a new submesh whenever the next one would not fit anymore,
+	// every level of detail starts with a new submesh and adds the vertices it needs again
+	result.indexType = IndexType::Uint16;
+	std::vector<uint16_t> indices;
+	indices.reserve(mesh.indices.size());
+
+	std::vector<uint32_t> localIndex(mesh.vertices.size());
+	std::vector<uint32_t> localSubmesh(mesh.vertices.size(), UINT32_MAX);
+	for(uint32_t level=0; level<levels.size(); level++)
+	{
+		const std::vector<uint32_t>& levelIndices = *levels[level];
+		begin_lod(level);
+		Submesh current{static_cast<uint32_t>(indices.size()), 0, static_cast<int32_t>(result.vertices.size())};
+		for(size_t t=0; t+2<levelIndices.size(); t+=3)
+		{
+			uint32_t submesh = result.submeshes.size();
+			size_t added = 0;
+			for(int j=0; j<3; j++)
+				added += localSubmesh[levelIndices[t+j]] != submesh;
+			if(result.vertices.size() - current.vertexOffset + added > maxVertices)
+			{
+				result.submeshes.push_back(current);
+				current = {static_cast<uint32_t>(indices.size()), 0, static_cast<int32_t>(result.vertices.size())};
+				submesh++;
+			}
+
+			for(int j=0; j<3; j++)
+			{
+				uint32_t v = levelIndices[t+j];
+				if(localSubmesh[v] != submesh)
+				{
+					localSubmesh[v] = submesh;
+					localIndex[v] = result.vertices.size() - current.vertexOffset;
+					result.vertices.push_back(mesh.vertices[v]);
+				}
+				indices.push_back(localIndex[v]);
+			}
+			current.indexCount += 3;
+		}
+		result.submeshes.push_back(current);
+		result.lods.back().submeshCount = result.submeshes.size() - result.lods.back().firstSubmesh;
+	}
+
+	result.indexData.resize(indices.size() * sizeof(uint16_t));
+	std::memcpy(result.indexData.data(), indices.data(), result.indexData.size());
+	return result;
+}
@@ -0,0 +1,308 @@
+#include "mesh_cache.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_simplify.hpp"
+#include "mapped_file.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+struct cooked_mesh::header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceHash;
+	uint64_t optionsKey;
+	VertexFormat vertexFormat;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	IndexType indexType;
+	uint32_t submeshCount;
+	uint32_t lodCount;
+	uint64_t submeshOffset;
+	uint64_t lodOffset;
+	uint64_t payloadOffset;
+	uint64_t payloadSize;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	float acmrBefore;
+	float acmrAfter;
+};
+
+static constexpr char cacheMagic[4] = {'C', 'C', 'M', 'H'};
+static constexpr size_t payloadAlignment = 64;
+
+static size_t align(size_t offset, size_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+static bool fits(uint64_t offset, uint64_t size, uint64_t limit)
+{
+	return offset <= limit && size <= limit - offset;
+}
+
+uint64_t cook_options::key() const
+{
+	return (split ? 1 : 0) | (optimize ? 2 : 0) | (optimize && overdraw ? 4 : 0) | static_cast<uint64_t>(vertexFormat) << 3 |
+		static_cast<uint64_t>(std::max(lodLevels, 1u)) << 8;
+}
+
+bool cooked_mesh::valid(const uint8_t* data, size_t size, const cook_options& options)
+{
+	if(size < sizeof(header))
+		return false;
+
+	const header& h = *reinterpret_cast<const header*>(data);
+	if(std::memcmp(h.magic, cacheMagic, sizeof(cacheMagic)) != 0 || h.version != version || h.optionsKey != options.key())
+		return false;
+	if(h.indexType != IndexType::Uint16 && h.indexType != IndexType::Uint32)
+		return false;
+	if(h.vertexFormat != VertexFormat::Float && h.vertexFormat != VertexFormat::Quantized)
+		return false;
+	// the counts are 32 bit, so the sizes of the payload and the tables cannot wrap around, but the offsets can be anything
+	if(h.payloadSize != uint64_t{h.vertexCount} * vertex_stride(h.vertexFormat) + uint64_t{h.indexCount} * static_cast<size_t>(h.indexType) ||
+		h.payloadOffset % payloadAlignment != 0 || !fits(h.payloadOffset, h.payloadSize, size) ||
+		h.submeshOffset < sizeof(header) || h.submeshOffset % alignof(Submesh) != 0 ||
+		!fits(h.submeshOffset, uint64_t{h.submeshCount} * sizeof(Submesh), h.lodOffset) ||
+		h.lodCount == 0 || h.lodOffset % alignof(MeshLod) != 0 || !fits(h.lodOffset, uint64_t{h.lodCount} * sizeof(MeshLod), h.payloadOffset))
+		return false;
+
+	// the draws use the tables as they are, so every submesh has to stay inside the indices and vertices
+	const Submesh* submeshes = reinterpret_cast<const Submesh*>(data + h.submeshOffset);
+	for(uint32_t i=0; i<h.submeshCount; i++)
+	{
+		const Submesh& s = submeshes[i];
+		// an empty mesh still has its submesh at vertex 0
+		if(!fits(s.firstIndex, s.indexCount, h.indexCount) || s.vertexOffset < 0 || (s.vertexOffset > 0 && static_cast<uint32_t>(s.vertexOffset) >= h.vertexCount))
+			return false;
+	}
+	const MeshLod* lods = reinterpret_cast<const MeshLod*>(data + h.lodOffset);
+	for(uint32_t i=0; i<h.lodCount; i++)
+		if(!fits(lods[i].firstSubmesh, lods[i].submeshCount, h.submeshCount))
+			return false;
+	return true;
+}
+
+std::optional<cooked_mesh> cooked_mesh::open(const std::string& path, uint64_t sourceHash, const cook_options& options)
+{
+	std::shared_ptr<mapped_file> file;
+	try
+	{
+		file = std::make_shared<mapped_file>(path);
+	}
+	catch(const std::runtime_error&)
+	{
+		return std::nullopt;
+	}
+
+	if(!valid(file->data(), file->size(), options) || reinterpret_cast<const header*>(file->data())->sourceHash != sourceHash)
+		return std::nullopt;
+
+	const uint8_t* data = file->data();
+	size_t size = file->size();
+	return cooked_mesh(std::move(file), data, size);
+}
+
+std::optional<cooked_mesh> cooked_mesh::view(std::shared_ptr<const void> owner, const uint8_t* data, size_t size, const cook_options& options)
+{
+	if(reinterpret_cast<uintptr_t>(data) % alignof(header) != 0 || !valid(data, size, options))
+		return std::nullopt;
+	return cooked_mesh(std::move(owner), data, size);
+}
+
+cooked_mesh cooked_mesh::cook(const MeshData& source, uint64_t sourceHash, const cook_options& options)
+{
+	MeshData mesh = source;
+	float acmrBefore = compute_acmr(mesh.indices, mesh.vertices.size());
+
+	std::vector<float> lodErrors;
+	generate_lods(mesh, options.lodLevels, lodErrors);
+
+	if(options.optimize)
+	{
+		auto optimize_order = [&](std::vector<uint32_t>& indices) {
+			optimize_vertex_cache(indices, mesh.vertices.size());
+			if(options.overdraw)
+				optimize_overdraw(indices, mesh.vertices);
+		};
+		optimize_order(mesh.indices);
+		for(auto& lod : mesh.lods)
+			optimize_order(lod);
+		optimize_vertex_fetch(mesh);
+	}
+	float acmrAfter = compute_acmr(mesh.indices, mesh.vertices.size());
+
+	IndexedMesh indexed = build_indexed_mesh(mesh, options.split, lodErrors);
+
+	header h{};
+	std::memcpy(h.magic, cacheMagic, sizeof(cacheMagic));
+	h.version = version;
+	h.sourceHash = sourceHash;
+	h.optionsKey = options.key();
+	h.boundsMin = h.boundsMax = mesh.vertices.empty() ? glm::vec3(0.0f) : mesh.vertices[0].position;
+	for(const auto& v : mesh.vertices)
+	{
+		h.boundsMin = glm::min(h.boundsMin, v.position);
+		h.boundsMax = glm::max(h.boundsMax, v.position);
+	}
+
+	const void* vertexData = indexed.vertices.data();
+	std::vector<PackedVertex> packed;
+	if(options.vertexFormat == VertexFormat::Quantized)
+	{
+		VertexDequantization dequantization = vertex_dequantization(h.boundsMin, h.boundsMax);
+		packed.reserve(indexed.vertices.size());
+		for(const auto& v : indexed.vertices)
+			packed.push_back(pack_vertex(v, dequantization));
+		vertexData = packed.data();
+	}
+	size_t vertexDataSize = indexed.vertices.size() * vertex_stride(options.vertexFormat);
+
+	h.vertexFormat = options.vertexFormat;
+	h.vertexCount = indexed.vertices.size();
+	h.indexCount = indexed.indexData.size() / static_cast<size_t>(indexed.indexType);
+	h.indexType = indexed.indexType;
+	h.submeshCount = indexed.submeshes.size();
+	h.lodCount = indexed.lods.size();
+	h.submeshOffset = align(sizeof(header), alignof(Submesh));
+	h.lodOffset = align(h.submeshOffset + h.submeshCount * sizeof(Submesh), alignof(MeshLod));
+	h.payloadOffset = align(h.lodOffset + h.lodCount * sizeof(MeshLod), payloadAlignment);
+	h.payloadSize = vertexDataSize + indexed.indexData.size();
+	h.acmrBefore = acmrBefore;
+	h.acmrAfter = acmrAfter;
+
+	auto buffer = std::make_shared<std::vector<uint8_t>>(h.payloadOffset + h.payloadSize);
+	uint8_t* p = buffer->data();
+	std::memcpy(p, &h, sizeof(h));
+	std::memcpy(p + h.submeshOffset, indexed.submeshes.data(), indexed.submeshes.size() * sizeof(Submesh));
+	std::memcpy(p + h.lodOffset, indexed.lods.data(), indexed.lods.size() * sizeof(MeshLod));
+	std::memcpy(p + h.payloadOffset, vertexData, vertexDataSize);
+	std::memcpy(p + h.payloadOffset + vertexDataSize, indexed.indexData.data(), indexed.indexData.size());
+
+	return cooked_mesh(buffer, buffer->data(), buffer->size());
+}
+
+void cooked_mesh::write(const std::string& path) const
+{
+	std::string temporary = path + ".tmp" + std::to_string(getpid());
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		if(!out)
+			throw std::runtime_error("cannot create mesh cache: "+temporary);
+		out.write(reinterpret_cast<const char*>(m_data), m_size);
+		if(!out)
+		{
+			out.close();
+			std::remove(temporary.c_str());
+			throw std::runtime_error("cannot write mesh cache: "+temporary);
+		}
+	}
+	if(std::rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		std::remove(temporary.c_str());
+		throw std::runtime_error("cannot replace mesh cache: "+path);
+	}
+}
+
+const cooked_mesh::header& cooked_mesh::head() const
+{
+	return *reinterpret_cast<const header*>(m_data);
+}
+
+uint64_t cooked_mesh::sourceHash() const
+{
+	return head().sourceHash;
+}
+
+MeshBounds cooked_mesh::bounds() const
+{
+	return {head().boundsMin, head().boundsMax};
+}
+
+VertexFormat cooked_mesh::vertexFormat() const
+{
+	return head().vertexFormat;
+}
+
+VertexDequantization cooked_mesh::dequantization() const
+{
+	return vertex_dequantization(head().boundsMin, head().boundsMax);
+}
+
+uint32_t cooked_mesh::vertexCount() const
+{
+	return head().vertexCount;
+}
+
+std::span<const Vertex> cooked_mesh::vertices() const
+{
+	if(head().vertexFormat != VertexFormat::Float)
+		return {};
+	return {reinterpret_cast<const Vertex*>(m_data + head().payloadOffset), head().vertexCount};
+}
+
+std::span<const uint8_t> cooked_mesh::vertexData() const
+{
+	return {m_data + head().payloadOffset, head().vertexCount * vertex_stride(head().vertexFormat)};
+}
+
+IndexType cooked_mesh::indexType() const
+{
+	return head().indexType;
+}
+
+uint32_t cooked_mesh::indexCount() const
+{
+	return head().indexCount;
+}
+
+float cooked_mesh::acmrBefore() const
+{
+	return head().acmrBefore;
+}
+
+float cooked_mesh::acmrAfter() const
+{
+	return head().acmrAfter;
+}
+
+std::span<const uint8_t> cooked_mesh::indexData() const
+{
+	return {m_data + head().payloadOffset + vertexData().size(), head().indexCount * static_cast<size_t>(head().indexType)};
+}
+
+std::span<const Submesh> cooked_mesh::submeshes() const
+{
+	return {reinterpret_cast<const Submesh*>(m_data + head().submeshOffset), head().submeshCount};
+}
+
+std::span<const MeshLod> cooked_mesh::lods() const
+{
+	return {reinterpret_cast<const MeshLod*>(m_data + head().lodOffset), head().lodCount};
+}
+
+std::span<const uint8_t> cooked_mesh::payload() const
+{
+	return {m_data + head().payloadOffset, head().payloadSize};
+}
+
+cooked_mesh load_cooked_mesh(const std::string& source, const std::string& cache, mesh_loader loader, const cook_options& options, bool& stale)
+{
+	uint64_t hash;
+	{
+		mapped_file file(source);
+		hash = content_hash(file.data(), file.size());
+	}
+
+	stale = false;
+	if(auto cached = cooked_mesh::open(cache, hash, options))
+		return std::move(*cached);
+
+	stale = true;
+	return cooked_mesh::cook(loader(source), hash, options);
+}
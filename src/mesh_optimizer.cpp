@@ -0,0 +1,276 @@
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+
+float compute_acmr(const std::vector<uint32_t>& indices, size_t vertexCount, size_t cacheSize)
+{
+	if(indices.size() < 3)
+		return 0.0f;
+
+	// a vertex is cached if it was loaded within the last cacheSize misses
+	std::vector<size_t> loadedAt(vertexCount, 0);
+	size_t misses = 0;
+	for(uint32_t index : indices)
+	{
+		if(loadedAt[index] == 0 || misses - loadedAt[index] >= cacheSize)
+			loadedAt[index] = ++misses;
+	}
+	return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+namespace
+{
+	constexpr size_t cacheSize = 32;
+
+	float vertex_score(int cachePosition, uint32_t remaining)
+	{
+		if(remaining == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if(cachePosition >= 0)
+		{
+			// the triangle that was just emitted is cheap no matter what, so do not prefer its vertices too much
+			if(cachePosition < 3)
+				score = 0.75f;
+			else
+				score = std::pow(1.0f - (cachePosition - 3) / static_cast<float>(cacheSize - 3), 1.5f);
+		}
+		// vertices with few triangles left should be finished off before they drop out of the cache
+		return score + 2.0f / std::sqrt(static_cast<float>(remaining));
+	}
+}
+
+void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+	if(triangleCount == 0)
+		return;
+
+	// triangles around every vertex, compacted as triangles get emitted
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	for(uint32_t index : indices)
+		remaining[index]++;
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for(size_t v=0; v<vertexCount; v++)
+		offsets[v+1] = offsets[v] + remaining[v];
+	std::vector<uint32_t> adjacency(indices.size());
+	{
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for(size_t t=0; t<triangleCount; t++)
+			for(int j=0; j<3; j++)
+				adjacency[fill[indices[t*3+j]]++] = t;
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> score(vertexCount);
+	for(size_t v=0; v<vertexCount; v++)
+		score[v] = vertex_score(-1, remaining[v]);
+
+	std::vector<float> triangleScore(triangleCount);
+	for(size_t t=0; t<triangleCount; t++)
+		triangleScore[t] = score[indices[t*3]] + score[indices[t*3+1]] + score[indices[t*3+2]];
+
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+
+	std::vector<uint32_t> cache, newCache;
+	cache.reserve(cacheSize + 3);
+	newCache.reserve(cacheSize + 3);
+
+	size_t cursor = 0;
+	uint32_t best = 0;
+	for(;;)
+	{
+		result.insert(result.end(), &indices[best*3], &indices[best*3] + 3);
+		emitted[best] = true;
+
+		// the emitted triangle goes to the front of the cache, everything else moves back
+		newCache.clear();
+		for(int j=0; j<3; j++)
+		{
+			uint32_t v = indices[best*3+j];
+			newCache.push_back(v);
+
+			uint32_t* begin = &adjacency[offsets[v]];
+			uint32_t* end = begin + remaining[v];
+			*std::find(begin, end, best) = *(end - 1);
+			remaining[v]--;
+		}
+		for(uint32_t v : cache)
+			if(v != newCache[0] && v != newCache[1] && v != newCache[2])
+				newCache.push_back(v);
+
+		for(size_t i=0; i<newCache.size(); i++)
+			cachePosition[newCache[i]] = i < cacheSize ? static_cast<int>(i) : -1;
+
+		// rescore the vertices that moved and the triangles using them, and pick the best one among them
+		float bestScore = -1.0f;
+		for(uint32_t v : newCache)
+		{
+			score[v] = vertex_score(cachePosition[v], remaining[v]);
+			for(uint32_t i=offsets[v]; i<offsets[v]+remaining[v]; i++)
+			{
+				uint32_t t = adjacency[i];
+				triangleScore[t] = score[indices[t*3]] + score[indices[t*3+1]] + score[indices[t*3+2]];
+				if(triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+		newCache.resize(std::min(newCache.size(), cacheSize));
+		std::swap(cache, newCache);
+
+		if(bestScore < 0.0f)
+		{
+			// nothing in the cache has triangles left, continue with the next triangle in input order
+			while(cursor < triangleCount && emitted[cursor]) cursor++;
+			if(cursor == triangleCount)
+				break;
+			best = cursor;
+		}
+	}
+
+	indices = std::move(result);
+}
+
+void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold)
+{
+	constexpr size_t clusterCacheSize = 16;
+
+	size_t triangleCount = indices.size() / 3;
+	if(triangleCount == 0)
+		return;
+
+	// FIFO cache simulation that can be reset to cold in constant time
+	std::vector<size_t> loadedAt(vertices.size(), 0);
+	size_t misses = 0;
+	size_t coldAt = 0;
+	auto triangle_misses = [&](size_t t) {
+		int count = 0;
+		for(int j=0; j<3; j++)
+		{
+			uint32_t v = indices[t*3+j];
+			if(loadedAt[v] <= coldAt || misses - loadedAt[v] >= clusterCacheSize)
+			{
+				loadedAt[v] = ++misses;
+				count++;
+			}
+		}
+		return count;
+	};
+
+	// hard boundaries are where the cache is cold anyway
+	std::vector<uint32_t> hardClusters;
+	for(size_t t=0; t<triangleCount; t++)
+		if(triangle_misses(t) == 3)
+			hardClusters.push_back(t);
+	if(hardClusters.empty() || hardClusters[0] != 0)
+		hardClusters.insert(hardClusters.begin(), 0);
+
+	// soft boundaries split a hard cluster as soon as the part so far is within threshold of the whole cluster's ACMR
+	std::vector<uint32_t> clusters;
+	for(size_t c=0; c<hardClusters.size(); c++)
+	{
+		size_t begin = hardClusters[c];
+		size_t end = c+1 < hardClusters.size() ? hardClusters[c+1] : triangleCount;
+
+		coldAt = misses;
+		size_t clusterMisses = 0;
+		for(size_t t=begin; t<end; t++)
+			clusterMisses += triangle_misses(t);
+		float clusterAcmr = static_cast<float>(clusterMisses) / (end - begin);
+
+		clusters.push_back(begin);
+		coldAt = misses;
+		size_t start = begin;
+		size_t partMisses = 0;
+		for(size_t t=begin; t+1<end; t++)
+		{
+			partMisses += triangle_misses(t);
+			if(partMisses <= threshold * clusterAcmr * (t - start + 1))
+			{
+				clusters.push_back(t+1);
+				start = t+1;
+				partMisses = 0;
+				coldAt = misses;
+			}
+		}
+	}
+
+	glm::vec3 meshCentroid(0.0f);
+	for(const auto& v : vertices)
+		meshCentroid += v.position;
+	if(!vertices.empty())
+		meshCentroid /= static_cast<float>(vertices.size());
+
+	// clusters facing away from the center are likely in front of the others
+	std::vector<float> sortKey(clusters.size());
+	for(size_t c=0; c<clusters.size(); c++)
+	{
+		size_t begin = clusters[c];
+		size_t end = c+1 < clusters.size() ? clusters[c+1] : triangleCount;
+
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+		for(size_t t=begin; t<end; t++)
+		{
+			glm::vec3 a = vertices[indices[t*3]].position;
+			glm::vec3 b = vertices[indices[t*3+1]].position;
+			glm::vec3 d = vertices[indices[t*3+2]].position;
+			glm::vec3 n = glm::cross(b-a, d-a);
+			float l = glm::length(n);
+			centroid += (a+b+d) * (l / 3.0f);
+			normal += n;
+			area += l;
+		}
+		if(area > 0.0f)
+			centroid /= area;
+		float nl = glm::length(normal);
+		sortKey[c] = nl > 0.0f ? glm::dot(centroid - meshCentroid, normal / nl) : 0.0f;
+	}
+
+	std::vector<uint32_t> order(clusters.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&sortKey](uint32_t a, uint32_t b){ return sortKey[a] > sortKey[b]; });
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for(uint32_t c : order)
+	{
+		size_t begin = clusters[c];
+		size_t end = c+1 < clusters.size() ? clusters[c+1] : triangleCount;
+		result.insert(result.end(), indices.begin() + begin*3, indices.begin() + end*3);
+	}
+	indices = std::move(result);
+}
+
+void optimize_vertex_fetch(MeshData& mesh)
+{
+	std::vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+	auto renumber = [&](std::vector<uint32_t>& indices) {
+		for(uint32_t& index : indices)
+		{
+			if(remap[index] == UINT32_MAX)
+			{
+				remap[index] = vertices.size();
+				vertices.push_back(mesh.vertices[index]);
+			}
+			index = remap[index];
+		}
+	};
+	renumber(mesh.indices);
+	for(auto& lod : mesh.lods)
+		renumber(lod);
+	// unused vertices are dropped
+	mesh.vertices = std::move(vertices);
+}
@@ -0,0 +1,265 @@
+#include "mesh_simplify.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+namespace
+{
+	// area weighted sum of squared plane distances, as a symmetric 4x4 matrix
+	struct quadric
+	{
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+		double weight;
+
+		void add_plane(glm::dvec3 n, double d, double w)
+		{
+			a2 += w*n.x*n.x; ab += w*n.x*n.y; ac += w*n.x*n.z; ad += w*n.x*d;
+			b2 += w*n.y*n.y; bc += w*n.y*n.z; bd += w*n.y*d;
+			c2 += w*n.z*n.z; cd += w*n.z*d;
+			d2 += w*d*d;
+			weight += w;
+		}
+
+		quadric& operator+=(const quadric& o)
+		{
+			a2 += o.a2; ab += o.ab; ac += o.ac; ad += o.ad;
+			b2 += o.b2; bc += o.bc; bd += o.bd;
+			c2 += o.c2; cd += o.cd;
+			d2 += o.d2;
+			weight += o.weight;
+			return *this;
+		}
+
+		// mean squared distance of p to the planes
+		double error(glm::dvec3 p) const
+		{
+			double e = a2*p.x*p.x + 2*ab*p.x*p.y + 2*ac*p.x*p.z + 2*ad*p.x
+				+ b2*p.y*p.y + 2*bc*p.y*p.z + 2*bd*p.y
+				+ c2*p.z*p.z + 2*cd*p.z
+				+ d2;
+			return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+		}
+	};
+
+	struct collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+
+	struct position_hash
+	{
+		size_t operator()(const glm::vec3& p) const
+		{
+			uint32_t bits[3];
+			std::memcpy(bits, &p, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+
+	glm::dvec3 position(const std::vector<Vertex>& vertices, uint32_t v)
+	{
+		return glm::dvec3(vertices[v].position);
+	}
+}
+
+std::vector<uint32_t> simplify_mesh(const std::vector<uint32_t>& source, const std::vector<Vertex>& vertices,
+	size_t targetIndexCount, float& error)
+{
+	error = 0.0f;
+	std::vector<uint32_t> indices = source;
+	size_t vertexCount = vertices.size();
+	if(indices.size() <= targetIndexCount || vertexCount == 0)
+		return indices;
+
+	// vertices at the same position share topology and quadric, the representative is the first of them
+	std::vector<uint32_t> wedge(vertexCount);
+	std::vector<bool> locked(vertexCount, false);
+	{
+		std::unordered_map<glm::vec3, uint32_t, position_hash> first;
+		first.reserve(vertexCount);
+		for(uint32_t v=0; v<vertexCount; v++)
+		{
+			auto [it, inserted] = first.try_emplace(vertices[v].position, v);
+			wedge[v] = it->second;
+			if(!inserted)
+				locked[it->second] = locked[v] = true;
+		}
+	}
+
+	// edges without exactly one twin in the opposite direction are on a border or not manifold
+	{
+		std::vector<uint64_t> edges;
+		edges.reserve(indices.size());
+		auto key = [](uint32_t a, uint32_t b) {return static_cast<uint64_t>(a) << 32 | b;};
+		for(size_t t=0; t<indices.size(); t+=3)
+			for(int j=0; j<3; j++)
+				edges.push_back(key(wedge[indices[t+j]], wedge[indices[t+(j+1)%3]]));
+		std::sort(edges.begin(), edges.end());
+		for(size_t i=0; i<edges.size(); i++)
+		{
+			uint32_t a = edges[i] >> 32, b = edges[i] & 0xffffffffu;
+			auto [first, last] = std::equal_range(edges.begin(), edges.end(), key(b, a));
+			bool duplicate = (i > 0 && edges[i-1] == edges[i]) || (i+1 < edges.size() && edges[i+1] == edges[i]);
+			if(last - first != 1 || duplicate)
+				locked[a] = locked[b] = true;
+		}
+		for(uint32_t v=0; v<vertexCount; v++)
+			locked[v] = locked[wedge[v]];
+	}
+
+	// half the bounding box diagonal, which is what draws use to turn the error back into a distance
+	glm::vec3 boundsMin = vertices[0].position, boundsMax = vertices[0].position;
+	for(const auto& v : vertices)
+	{
+		boundsMin = glm::min(boundsMin, v.position);
+		boundsMax = glm::max(boundsMax, v.position);
+	}
+	double radius = glm::length(glm::dvec3(boundsMax - boundsMin)) / 2.0;
+	if(radius <= 0.0)
+		return indices;
+
+	std::vector<quadric> quadrics(vertexCount, quadric{});
+	for(size_t t=0; t<indices.size(); t+=3)
+	{
+		glm::dvec3 p0 = position(vertices, indices[t]), p1 = position(vertices, indices[t+1]), p2 = position(vertices, indices[t+2]);
+		glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+		double area = glm::length(n);
+		if(area <= 0.0)
+			continue;
+		n /= area;
+		for(int j=0; j<3; j++)
+			quadrics[wedge[indices[t+j]]].add_plane(n, -glm::dot(n, p0), area);
+	}
+
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	std::vector<uint32_t> fanOffsets(vertexCount+1);
+	std::vector<uint32_t> fans;
+	std::vector<collapse> collapses;
+	double maxCost = 0.0;
+
+	while(indices.size() > targetIndexCount)
+	{
+		// triangles around every vertex
+		std::fill(fanOffsets.begin(), fanOffsets.end(), 0);
+		for(uint32_t v : indices)
+			fanOffsets[v+1]++;
+		std::partial_sum(fanOffsets.begin(), fanOffsets.end(), fanOffsets.begin());
+		fans.resize(indices.size());
+		{
+			std::vector<uint32_t> fill(fanOffsets.begin(), fanOffsets.end()-1);
+			for(size_t i=0; i<indices.size(); i++)
+				fans[fill[indices[i]]++] = i/3;
+		}
+
+		// the twin half edge of the neighbouring triangle adds the opposite direction
+		collapses.clear();
+		for(size_t t=0; t<indices.size(); t+=3)
+		{
+			for(int j=0; j<3; j++)
+			{
+				uint32_t a = indices[t+j], b = indices[t+(j+1)%3];
+				if(wedge[a] == wedge[b] || locked[a])
+					continue;
+				quadric q = quadrics[wedge[a]];
+				collapses.push_back({a, b, (q += quadrics[wedge[b]]).error(position(vertices, b))});
+			}
+		}
+		if(collapses.empty())
+			break;
+
+		// each collapse removes about two triangles, many candidates are skipped because a neighbour already moved
+		size_t removable = (indices.size() - targetIndexCount) / 3;
+		auto cmp = [](const collapse& x, const collapse& y) {return x.cost < y.cost;};
+		auto pool = collapses.begin() + std::min(collapses.size(), removable * 2);
+		std::nth_element(collapses.begin(), pool, collapses.end(), cmp);
+		std::sort(collapses.begin(), pool, cmp);
+		collapses.erase(pool, collapses.end());
+
+		std::iota(remap.begin(), remap.end(), 0);
+		std::fill(touched.begin(), touched.end(), false);
+		size_t removed = 0;
+		for(const collapse& c : collapses)
+		{
+			if(removed >= removable)
+				break;
+			if(touched[c.from] || touched[c.to])
+				continue;
+
+			// reject collapses that would flip a triangle around the moved vertex
+			glm::dvec3 target = position(vertices, c.to);
+			bool flips = false;
+			size_t sharedTriangles = 0;
+			for(uint32_t f=fanOffsets[c.from]; f<fanOffsets[c.from+1] && !flips; f++)
+			{
+				const uint32_t* tri = &indices[fans[f]*3];
+				if(wedge[tri[0]] == wedge[c.to] || wedge[tri[1]] == wedge[c.to] || wedge[tri[2]] == wedge[c.to])
+				{
+					sharedTriangles++;
+					continue;
+				}
+				glm::dvec3 p[3], q[3];
+				for(int j=0; j<3; j++)
+				{
+					p[j] = position(vertices, tri[j]);
+					q[j] = tri[j] == c.from ? target : p[j];
+				}
+				glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::dvec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flips = glm::dot(before, after) <= 1e-2 * glm::length(before) * glm::length(after);
+			}
+			if(flips)
+				continue;
+
+			remap[c.from] = c.to;
+			quadrics[wedge[c.to]] += quadrics[wedge[c.from]];
+			for(uint32_t f=fanOffsets[c.from]; f<fanOffsets[c.from+1]; f++)
+				for(int j=0; j<3; j++)
+					touched[indices[fans[f]*3+j]] = true;
+			removed += sharedTriangles;
+			maxCost = std::max(maxCost, c.cost);
+		}
+		if(removed == 0)
+			break;
+
+		size_t write = 0;
+		for(size_t t=0; t<indices.size(); t+=3)
+		{
+			uint32_t a = remap[indices[t]], b = remap[indices[t+1]], c = remap[indices[t+2]];
+			if(wedge[a] == wedge[b] || wedge[b] == wedge[c] || wedge[c] == wedge[a])
+				continue;
+			indices[write++] = a;
+			indices[write++] = b;
+			indices[write++] = c;
+		}
+		indices.resize(write);
+	}
+
+	error = static_cast<float>(std::sqrt(maxCost) / radius);
+	return indices;
+}
+
+void generate_lods(MeshData& mesh, uint32_t levels, std::vector<float>& errors)
+{
+	errors.assign(1, 0.0f);
+	// every level is simplified from the one before, so the errors add up to a bound for the distance to the full mesh
+	const std::vector<uint32_t>* previous = &mesh.indices;
+	for(uint32_t level=1; level<levels; level++)
+	{
+		size_t target = previous->size() / 2;
+		target -= target % 3;
+		float error;
+		std::vector<uint32_t> lod = simplify_mesh(*previous, mesh.vertices, target, error);
+		// a level that barely shrinks is not worth the memory
+		if(lod.empty() || lod.size() > previous->size() * 3 / 4)
+			break;
+		mesh.lods.push_back(std::move(lod));
+		errors.push_back(errors.back() + error);
+		previous = &mesh.lods.back();
+	}
+}
@@ -34,7 +34,10 @@ namespace network
 			clients.erase(it);
 
 		if(m_renderClient)
+		{
+			companions[m_renderClient->companion()]->removeUser();
 			delete m_renderClient;
+		}
 	}
 
 	void network_handler::handlePacket(serverbound::PacketType type, void* data, size_t size)
@@ -49,10 +52,17 @@ namespace network
 			*::logger << logger::begin << "Join: " << companion << " from " << name << logger::end;
 
 			if(clients.size() >= mainConfig["maxClients"])
+			{
 				disconnect(clientbound::DisconnectReason::TooManyClients);
+				return;
+			}
 			if(!companions.contains(companion))
+			{
 				disconnect(clientbound::DisconnectReason::UnknownCompanion);
+				return;
+			}
 
+			companions[companion]->addUser(globalDevice, *uploads);
 			m_renderClient = new render_client(companion);
 			m_renderClient->init(globalDevice);
 
@@ -0,0 +1,72 @@
+#include "range_allocator.hpp"
+
+#include <algorithm>
+
+range_allocator::range_allocator(uint64_t size) : m_size(size)
+{
+	addFreeRange(0, size);
+}
+
+void range_allocator::addFreeRange(uint64_t offset, uint64_t size)
+{
+	if(size == 0)
+		return;
+	m_freeRanges[offset] = size;
+	m_freeSizes.insert({size, offset});
+}
+
+void range_allocator::removeFreeRange(std::map<uint64_t, uint64_t>::iterator range)
+{
+	auto [first, last] = m_freeSizes.equal_range(range->second);
+	for(auto it = first; it != last; ++it)
+		if(it->second == range->first)
+		{
+			m_freeSizes.erase(it);
+			break;
+		}
+	m_freeRanges.erase(range);
+}
+
+std::optional<uint64_t> range_allocator::allocate(uint64_t size, uint64_t alignment)
+{
+	alignment = std::max<uint64_t>(alignment, 1);
+	for(auto it = m_freeSizes.lower_bound(size); it != m_freeSizes.end(); ++it)
+	{
+		uint64_t rangeOffset = it->second;
+		uint64_t rangeSize = it->first;
+		uint64_t offset = (rangeOffset + alignment - 1) / alignment * alignment;
+		if(offset + size > rangeOffset + rangeSize)
+			continue;
+
+		// the gap in front stays free, so alignment only costs what no other allocation fits into
+		removeFreeRange(m_freeRanges.find(rangeOffset));
+		addFreeRange(rangeOffset, offset - rangeOffset);
+		addFreeRange(offset + size, rangeOffset + rangeSize - offset - size);
+		m_used += size;
+		m_allocations++;
+		return offset;
+	}
+	return std::nullopt;
+}
+
+void range_allocator::free(uint64_t offset, uint64_t size)
+{
+	m_used -= size;
+	m_allocations--;
+
+	// merge with the free neighbours, so freed space does not stay fragmented
+	auto next = m_freeRanges.lower_bound(offset);
+	if(next != m_freeRanges.end() && next->first == offset + size)
+	{
+		size += next->second;
+		removeFreeRange(next);
+	}
+	auto prev = m_freeRanges.lower_bound(offset);
+	if(prev != m_freeRanges.begin() && (--prev)->first + prev->second == offset)
+	{
+		offset = prev->first;
+		size += prev->second;
+		removeFreeRange(prev);
+	}
+	addFreeRange(offset, size);
+}
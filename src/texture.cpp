@@ -0,0 +1,359 @@
+#include "texture.hpp"
+#include "mapped_file.hpp"
+#include "hash.hpp"
+#include "glb.hpp"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace
+{
+	struct format_info
+	{
+		uint32_t blockSize;
+		uint32_t blockBytes;
+	};
+
+	bool format_info_of(VkFormat format, format_info& info)
+	{
+		switch(format)
+		{
+			case VK_FORMAT_R8G8B8A8_UNORM:
+			case VK_FORMAT_R8G8B8A8_SRGB:
+				info = {1, 4};
+				return true;
+			case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+			case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+				info = {4, 8};
+				return true;
+			case VK_FORMAT_BC3_UNORM_BLOCK:
+			case VK_FORMAT_BC3_SRGB_BLOCK:
+			case VK_FORMAT_BC7_UNORM_BLOCK:
+			case VK_FORMAT_BC7_SRGB_BLOCK:
+				info = {4, 16};
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	size_t level_size(const format_info& info, uint32_t width, uint32_t height)
+	{
+		size_t blocksX = (width + info.blockSize - 1) / info.blockSize;
+		size_t blocksY = (height + info.blockSize - 1) / info.blockSize;
+		return blocksX * blocksY * info.blockBytes;
+	}
+
+	// bigger than any device creates images, which also keeps the level sizes far from wrapping around
+	constexpr uint32_t maxTextureSize = 1u << 16;
+
+	bool fits(uint64_t offset, uint64_t size, uint64_t limit)
+	{
+		return offset <= limit && size <= limit - offset;
+	}
+
+	// the number of levels of a full mip chain down to 1x1
+	uint32_t mip_chain_length(uint32_t width, uint32_t height)
+	{
+		return std::bit_width(std::max(width, height));
+	}
+
+	// the header values the level sizes are computed from, checked before any of them is
+	void check_size(uint32_t width, uint32_t height, uint32_t levelCount, const std::string& file)
+	{
+		if(width == 0 || height == 0 || width > maxTextureSize || height > maxTextureSize)
+			throw std::runtime_error("unsupported texture size "+std::to_string(width)+"x"+std::to_string(height)+" in "+file);
+		if(levelCount > mip_chain_length(width, height))
+			throw std::runtime_error(std::to_string(levelCount)+" mip levels are more than a "+std::to_string(width)+"x"+std::to_string(height)+
+				" texture has in "+file);
+	}
+
+	template<typename T>
+	T read(const mapped_file& file, size_t offset)
+	{
+		if(offset + sizeof(T) > file.size())
+			throw std::runtime_error("texture file is truncated");
+		T value;
+		std::memcpy(&value, file.data() + offset, sizeof(T));
+		return value;
+	}
+
+	// levels are tightly packed starting at offset, level 0 first
+	TextureData read_packed_levels(const mapped_file& file, size_t offset, VkFormat format, uint32_t width, uint32_t height, uint32_t levelCount)
+	{
+		format_info info;
+		format_info_of(format, info);
+
+		TextureData texture{format};
+		size_t size = 0;
+		for(uint32_t level=0; level<levelCount; level++)
+		{
+			uint32_t w = std::max(1u, width >> level), h = std::max(1u, height >> level);
+			texture.levels.push_back({w, h, size, level_size(info, w, h)});
+			size += texture.levels.back().size;
+		}
+		if(!fits(offset, size, file.size()))
+			throw std::runtime_error("texture file is truncated");
+		texture.data.assign(file.data() + offset, file.data() + offset + size);
+		return texture;
+	}
+
+	const std::array<float, 256>& srgb_to_linear()
+	{
+		static const std::array<float, 256> table = [] {
+			std::array<float, 256> t;
+			for(int i=0; i<256; i++)
+			{
+				float c = i / 255.0f;
+				t[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			return t;
+		}();
+		return table;
+	}
+
+	uint8_t linear_to_srgb(float c)
+	{
+		c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+		return static_cast<uint8_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+}
+
+TextureData load_png(const std::string& file)
+{
+	if(!std::filesystem::exists(file))
+		throw std::runtime_error("file not found: "+file);
+
+	int w, h, comp;
+	uint8_t* pixels = stbi_load(file.c_str(), &w, &h, &comp, STBI_rgb_alpha);
+	if(!pixels)
+		throw std::runtime_error("cannot decode image "+file+": "+stbi_failure_reason());
+
+	size_t size = static_cast<size_t>(w) * h * 4;
+	TextureData texture{VK_FORMAT_R8G8B8A8_SRGB, {{static_cast<uint32_t>(w), static_cast<uint32_t>(h), 0, size}}};
+	texture.data.assign(pixels, pixels + size);
+	stbi_image_free(pixels);
+	return texture;
+}
+
+TextureData load_glb_texture(const std::string& file)
+{
+	glb_file glb(file);
+	const auto& json = glb.json();
+	try
+	{
+		// the base color of the first material that has one, or else simply the first image
+		size_t image = 0;
+		for(const auto& material : json.value("materials", nlohmann::json::array()))
+			if(material.contains("pbrMetallicRoughness") && material["pbrMetallicRoughness"].contains("baseColorTexture"))
+			{
+				image = json.at("textures").at(material["pbrMetallicRoughness"]["baseColorTexture"].at("index").get<size_t>()).at("source");
+				break;
+			}
+		if(!json.contains("images") || image >= json["images"].size())
+			throw std::runtime_error("no embedded image");
+		if(!json["images"][image].contains("bufferView"))
+			throw std::runtime_error("image "+std::to_string(image)+" is not embedded");
+		auto data = glb.bufferView(json["images"][image]["bufferView"]);
+
+		int w, h, comp;
+		uint8_t* pixels = stbi_load_from_memory(data.data(), data.size(), &w, &h, &comp, STBI_rgb_alpha);
+		if(!pixels)
+			throw std::runtime_error("cannot decode image "+std::to_string(image)+": "+stbi_failure_reason());
+
+		size_t size = static_cast<size_t>(w) * h * 4;
+		TextureData texture{VK_FORMAT_R8G8B8A8_SRGB, {{static_cast<uint32_t>(w), static_cast<uint32_t>(h), 0, size}}};
+		texture.data.assign(pixels, pixels + size);
+		stbi_image_free(pixels);
+		return texture;
+	}
+	catch(const std::exception& ex)
+	{
+		throw std::runtime_error(file+": "+ex.what());
+	}
+}
+
+TextureData solid_color(glm::vec4 color, uint32_t size)
+{
+	uint8_t rgba[4];
+	for(int i=0; i<4; i++)
+		rgba[i] = static_cast<uint8_t>(std::clamp(color[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+
+	TextureData texture{VK_FORMAT_R8G8B8A8_SRGB, {{size, size, 0, static_cast<size_t>(size) * size * 4}}};
+	texture.data.resize(texture.levels[0].size);
+	for(size_t i=0; i<texture.data.size(); i+=4)
+		std::memcpy(&texture.data[i], rgba, 4);
+	return texture;
+}
+
+TextureData load_dds(const std::string& file)
+{
+	constexpr size_t headerOffset = 4;
+	constexpr size_t headerSize = 124;
+	constexpr uint32_t dx10 = 0x30315844;
+
+	mapped_file dds(file);
+	if(dds.size() < headerOffset + headerSize || std::memcmp(dds.data(), "DDS ", 4) != 0)
+		throw std::runtime_error("not a DDS file: "+file);
+
+	uint32_t height = read<uint32_t>(dds, headerOffset + 8);
+	uint32_t width = read<uint32_t>(dds, headerOffset + 12);
+	uint32_t levelCount = std::max(1u, read<uint32_t>(dds, headerOffset + 24));
+	uint32_t fourCC = read<uint32_t>(dds, headerOffset + 80);
+
+	// legacy headers carry no color space, color textures are treated as sRGB like PNGs
+	VkFormat format;
+	size_t dataOffset = headerOffset + headerSize;
+	if(fourCC == 0x31545844)		// DXT1
+		format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	else if(fourCC == 0x35545844)	// DXT5
+		format = VK_FORMAT_BC3_SRGB_BLOCK;
+	else if(fourCC == dx10)
+	{
+		uint32_t dxgiFormat = read<uint32_t>(dds, dataOffset);
+		uint32_t arraySize = read<uint32_t>(dds, dataOffset + 12);
+		dataOffset += 20;
+		if(arraySize > 1)
+			throw std::runtime_error("texture arrays are not supported: "+file);
+		switch(dxgiFormat)
+		{
+			case 71: format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK; break;
+			case 72: format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK; break;
+			case 77: format = VK_FORMAT_BC3_UNORM_BLOCK; break;
+			case 78: format = VK_FORMAT_BC3_SRGB_BLOCK; break;
+			case 98: format = VK_FORMAT_BC7_UNORM_BLOCK; break;
+			case 99: format = VK_FORMAT_BC7_SRGB_BLOCK; break;
+			default:
+				throw std::runtime_error("unsupported DXGI format "+std::to_string(dxgiFormat)+" in "+file);
+		}
+	}
+	else
+		throw std::runtime_error("unsupported DDS pixel format in "+file);
+
+	check_size(width, height, levelCount, file);
+	return read_packed_levels(dds, dataOffset, format, width, height, levelCount);
+}
+
+TextureData load_ktx2(const std::string& file)
+{
+	static constexpr uint8_t identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+	constexpr size_t levelIndexOffset = 80;
+
+	mapped_file ktx(file);
+	if(ktx.size() < levelIndexOffset || std::memcmp(ktx.data(), identifier, sizeof(identifier)) != 0)
+		throw std::runtime_error("not a KTX2 file: "+file);
+
+	VkFormat format = static_cast<VkFormat>(read<uint32_t>(ktx, 12));
+	uint32_t width = read<uint32_t>(ktx, 20);
+	uint32_t height = std::max(1u, read<uint32_t>(ktx, 24));
+	uint32_t depth = read<uint32_t>(ktx, 28);
+	uint32_t layerCount = read<uint32_t>(ktx, 32);
+	uint32_t faceCount = read<uint32_t>(ktx, 36);
+	uint32_t levelCount = std::max(1u, read<uint32_t>(ktx, 40));
+	uint32_t supercompression = read<uint32_t>(ktx, 44);
+
+	format_info info;
+	if(!format_info_of(format, info))
+		throw std::runtime_error("unsupported Vulkan format "+std::to_string(format)+" in "+file);
+	if(supercompression != 0)
+		throw std::runtime_error("supercompressed KTX2 files are not supported: "+file);
+	if(depth > 1 || layerCount > 1 || faceCount != 1)
+		throw std::runtime_error("only plain 2D KTX2 textures are supported: "+file);
+	check_size(width, height, levelCount, file);
+
+	TextureData texture{format};
+	for(uint32_t level=0; level<levelCount; level++)
+	{
+		uint64_t offset = read<uint64_t>(ktx, levelIndexOffset + level*24);
+		uint64_t length = read<uint64_t>(ktx, levelIndexOffset + level*24 + 8);
+		uint32_t w = std::max(1u, width >> level), h = std::max(1u, height >> level);
+		if(length != level_size(info, w, h) || !fits(offset, length, ktx.size()))
+			throw std::runtime_error("KTX2 level "+std::to_string(level)+" has an unexpected size in "+file);
+
+		texture.levels.push_back({w, h, texture.data.size(), length});
+		texture.data.insert(texture.data.end(), ktx.data() + offset, ktx.data() + offset + length);
+	}
+	return texture;
+}
+
+bool valid_mip_chain(VkFormat format, const std::vector<TextureLevel>& levels)
+{
+	format_info info;
+	if(!format_info_of(format, info) || levels.empty())
+		return false;
+	uint32_t width = levels[0].width, height = levels[0].height;
+	if(width == 0 || height == 0 || width > maxTextureSize || height > maxTextureSize || levels.size() > mip_chain_length(width, height))
+		return false;
+	for(uint32_t level=0; level<levels.size(); level++)
+	{
+		uint32_t w = std::max(1u, width >> level), h = std::max(1u, height >> level);
+		if(levels[level].width != w || levels[level].height != h || levels[level].size != level_size(info, w, h))
+			return false;
+	}
+	return true;
+}
+
+void generate_mipmaps(TextureData& texture)
+{
+	bool srgb = texture.format == VK_FORMAT_R8G8B8A8_SRGB;
+	if(!srgb && texture.format != VK_FORMAT_R8G8B8A8_UNORM)
+		throw std::runtime_error("mipmaps can only be generated for RGBA8 textures");
+
+	const auto& toLinear = srgb_to_linear();
+	texture.levels.resize(1);
+	texture.data.resize(texture.levels[0].size);
+	while(texture.levels.back().width > 1 || texture.levels.back().height > 1)
+	{
+		TextureLevel source = texture.levels.back();
+		TextureLevel level{std::max(1u, source.width / 2), std::max(1u, source.height / 2), texture.data.size(), 0};
+		level.size = static_cast<size_t>(level.width) * level.height * 4;
+		texture.data.resize(level.offset + level.size);
+		const uint8_t* in = texture.data.data() + source.offset;
+		uint8_t* out = texture.data.data() + level.offset;
+
+		// every destination texel averages the source texels it covers, so odd sizes lose nothing
+		for(uint32_t y=0; y<level.height; y++)
+		{
+			uint32_t y0 = y * source.height / level.height, y1 = std::max(y0 + 1, (y + 1) * source.height / level.height);
+			for(uint32_t x=0; x<level.width; x++)
+			{
+				uint32_t x0 = x * source.width / level.width, x1 = std::max(x0 + 1, (x + 1) * source.width / level.width);
+				float sum[4] = {};
+				for(uint32_t sy=y0; sy<y1; sy++)
+				{
+					for(uint32_t sx=x0; sx<x1; sx++)
+					{
+						const uint8_t* texel = in + (static_cast<size_t>(sy) * source.width + sx) * 4;
+						for(int c=0; c<3; c++)
+							sum[c] += srgb ? toLinear[texel[c]] : texel[c] / 255.0f;
+						sum[3] += texel[3] / 255.0f;
+					}
+				}
+				float count = static_cast<float>((y1 - y0) * (x1 - x0));
+				uint8_t* texel = out + (static_cast<size_t>(y) * level.width + x) * 4;
+				for(int c=0; c<3; c++)
+					texel[c] = srgb ? linear_to_srgb(sum[c] / count) : static_cast<uint8_t>(sum[c] / count * 255.0f + 0.5f);
+				texel[3] = static_cast<uint8_t>(sum[3] / count * 255.0f + 0.5f);
+			}
+		}
+		texture.levels.push_back(level);
+	}
+}
+
+uint64_t texture_hash(const TextureData& texture)
+{
+	uint64_t hash = content_hash(texture.levels.data(), texture.levels.size() * sizeof(TextureLevel), texture.format);
+	if(texture.levels.empty())
+		return hash;
+	const TextureLevel& last = texture.levels.back();
+	return content_hash(texture.bytes(), last.offset + last.size, hash);
+}
@@ -0,0 +1,95 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace
+{
+	thread_local const thread_pool* currentPool = nullptr;
+	thread_local size_t currentIndex = 0;
+}
+
+thread_pool::thread_pool(unsigned threads)
+{
+	threads = std::max(1u, threads);
+	for(unsigned i=0; i<threads; i++)
+		m_queues.push_back(std::make_unique<worker_queue>());
+	for(unsigned i=0; i<threads; i++)
+		m_threads.emplace_back(&thread_pool::run, this, i);
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::scoped_lock lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for(auto& thread : m_threads)
+		thread.join();
+}
+
+void thread_pool::push(std::function<void()> task)
+{
+	size_t index = currentPool == this ? currentIndex : m_next++ % m_queues.size();
+	{
+		// counted before a worker can find it, or its decrement in run() would come first and wrap around;
+		// a sleeping worker checks the count under m_mutex, so it never sees it without the task being there
+		std::scoped_lock lock(m_mutex);
+		m_pending++;
+		std::scoped_lock queueLock(m_queues[index]->mutex);
+		m_queues[index]->tasks.push_back(std::move(task));
+	}
+	m_wake.notify_one();
+}
+
+bool thread_pool::pop(size_t index, std::function<void()>& task)
+{
+	{
+		worker_queue& own = *m_queues[index];
+		std::scoped_lock lock(own.mutex);
+		if(!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+	for(size_t i=1; i<m_queues.size(); i++)
+	{
+		worker_queue& victim = *m_queues[(index + i) % m_queues.size()];
+		std::scoped_lock lock(victim.mutex);
+		if(!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void thread_pool::run(size_t index)
+{
+	currentPool = this;
+	currentIndex = index;
+
+	std::function<void()> task;
+	while(true)
+	{
+		if(pop(index, task))
+		{
+			{
+				std::scoped_lock lock(m_mutex);
+				m_pending--;
+			}
+			task();
+			task = nullptr;
+			continue;
+		}
+
+		std::unique_lock lock(m_mutex);
+		m_wake.wait(lock, [this](){ return m_stop || m_pending > 0; });
+		if(m_stop && m_pending == 0)
+			return;
+	}
+}
@@ -0,0 +1,81 @@
+#include "uniform_ring.hpp"
+
+#include "dispatch.hpp"
+#include "layer.hpp"
+#include "shared.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <vulkan/vulkan.hpp>
+
+uniform_ring::uniform_ring(VkDevice device, VkDeviceSize size, uint32_t count, uint32_t slots) : m_device(device)
+{
+	VkPhysicalDevice physicalDevice = deviceInfos[device].physicalDevice;
+	VkPhysicalDeviceProperties properties;
+	instance_dispatch[GetKey(physicalDevice)].GetPhysicalDeviceProperties(physicalDevice, &properties);
+	m_alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+	m_slotSize = (size + m_alignment - 1) / m_alignment * m_alignment * count;
+
+	VkBufferCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	createInfo.size = m_slotSize * slots;
+	createInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkResult r;
+	if((r = device_dispatch[GetKey(device)].CreateBuffer(device, &createInfo, nullptr, &m_buffer)) != VK_SUCCESS)
+		throw std::runtime_error("failed to create uniform ring buffer: "+vk::to_string((vk::Result)r));
+	try
+	{
+		m_memory = allocator->allocateBuffer(m_buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	}
+	catch(...)
+	{
+		device_dispatch[GetKey(device)].DestroyBuffer(device, m_buffer, nullptr);
+		throw;
+	}
+
+	for(uint32_t i=0; i<slots; i++)
+		m_free.push_back(slots - 1 - i);
+}
+
+uniform_ring::~uniform_ring()
+{
+	device_dispatch[GetKey(m_device)].DestroyBuffer(m_device, m_buffer, nullptr);
+	allocator->free(m_memory);
+}
+
+bool uniform_ring::begin()
+{
+	if(m_current)
+		return true;
+	if(m_free.empty())
+		return false;
+	m_current = m_free.back();
+	m_free.pop_back();
+	m_used = 0;
+	return true;
+}
+
+uniform_ring::slice uniform_ring::allocate(VkDeviceSize size)
+{
+	if(!m_current)
+		throw std::runtime_error("allocating from the uniform ring outside of a frame");
+	VkDeviceSize offset = (m_used + m_alignment - 1) / m_alignment * m_alignment;
+	if(offset + size > m_slotSize)
+		throw std::runtime_error("a frame's uniforms do not fit into their slot of "+std::to_string(m_slotSize)+" bytes");
+	m_used = offset + size;
+	offset += *m_current * m_slotSize;
+	return {static_cast<uint32_t>(offset), m_memory.mapped + offset};
+}
+
+void uniform_ring::retire(frame_tracker& frames)
+{
+	if(!m_current)
+		return;
+	frames.defer([this, slot = *m_current](){
+		m_free.push_back(slot);
+	});
+	m_current.reset();
+}
@@ -0,0 +1,346 @@
+#include "upload_batch.hpp"
+
+#include "dispatch.hpp"
+#include "layer.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+#include <vulkan/vulkan.hpp>
+
+static constexpr VkDeviceSize chunkSize = 64 << 20;
+// multiple of every texel block size used for textures
+static constexpr VkDeviceSize imageAlignment = 16;
+
+upload_batch::upload_batch(VkDevice device, direct_upload direct) : m_device(device), m_direct(direct)
+{
+}
+
+upload_batch::~upload_batch()
+{
+	for(auto& c : m_chunks)
+	{
+		device_dispatch[GetKey(m_device)].DestroyBuffer(m_device, c.buffer, nullptr);
+		device_dispatch[GetKey(m_device)].UnmapMemory(m_device, c.memory);
+		device_dispatch[GetKey(m_device)].FreeMemory(m_device, c.memory, nullptr);
+	}
+}
+
+upload_batch::chunk& upload_batch::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	for(auto& c : m_chunks)
+	{
+		offset = (c.used + alignment - 1) / alignment * alignment;
+		if(offset + size <= c.size)
+		{
+			c.used = offset + size;
+			return c;
+		}
+	}
+
+	chunk& c = m_chunks.emplace_back();
+	c.size = std::max(chunkSize, size);
+	c.used = size;
+	offset = 0;
+
+	VkBufferCreateInfo bufferCreateInfo{};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.size = c.size;
+	bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if(device_dispatch[GetKey(m_device)].CreateBuffer(m_device, &bufferCreateInfo, nullptr, &c.buffer) != VK_SUCCESS)
+	{
+		m_chunks.pop_back();
+		throw std::runtime_error("failed to create staging buffer");
+	}
+
+	VkMemoryRequirements requirements;
+	device_dispatch[GetKey(m_device)].GetBufferMemoryRequirements(m_device, c.buffer, &requirements);
+
+	VkMemoryAllocateInfo allocateInfo{};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.allocationSize = requirements.size;
+	allocateInfo.memoryTypeIndex = findMemoryType(deviceInfos[m_device].memory, requirements.memoryTypeBits,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	if(device_dispatch[GetKey(m_device)].AllocateMemory(m_device, &allocateInfo, nullptr, &c.memory) != VK_SUCCESS)
+	{
+		device_dispatch[GetKey(m_device)].DestroyBuffer(m_device, c.buffer, nullptr);
+		m_chunks.pop_back();
+		throw std::runtime_error("failed to allocate staging memory");
+	}
+	if(device_dispatch[GetKey(m_device)].BindBufferMemory(m_device, c.buffer, c.memory, 0) != VK_SUCCESS ||
+		device_dispatch[GetKey(m_device)].MapMemory(m_device, c.memory, 0, VK_WHOLE_SIZE, 0, (void**)&c.mapped) != VK_SUCCESS)
+	{
+		device_dispatch[GetKey(m_device)].DestroyBuffer(m_device, c.buffer, nullptr);
+		device_dispatch[GetKey(m_device)].FreeMemory(m_device, c.memory, nullptr);
+		m_chunks.pop_back();
+		throw std::runtime_error("failed to map staging memory");
+	}
+	return c;
+}
+
+void upload_batch::uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size, bool concurrent)
+{
+	if(size == 0)
+		return;
+	VkDeviceSize stagingOffset;
+	chunk& c = allocate(size, 4, stagingOffset);
+	std::memcpy(c.mapped + stagingOffset, data, size);
+	m_bufferCopies.push_back({c.buffer, buffer, {stagingOffset, offset, size}, concurrent});
+	m_stagedBytes += size;
+}
+
+void upload_batch::uploadImage(VkImage image, const TextureData& texture, uint32_t firstLevel, uint32_t levelCount)
+{
+	levelCount = std::min<uint32_t>(levelCount, texture.levels.size() - firstLevel);
+	const TextureLevel& first = texture.levels[firstLevel];
+	const TextureLevel& last = texture.levels[firstLevel + levelCount - 1];
+	size_t size = last.offset + last.size - first.offset;
+
+	VkDeviceSize stagingOffset;
+	chunk& c = allocate(size, imageAlignment, stagingOffset);
+	std::memcpy(c.mapped + stagingOffset, texture.bytes() + first.offset, size);
+
+	image_copy& copy = m_imageCopies.emplace_back();
+	copy.source = c.buffer;
+	copy.destination = image;
+	copy.firstLevel = firstLevel;
+	copy.levelCount = levelCount;
+	for(uint32_t level=firstLevel; level<firstLevel+levelCount; level++)
+	{
+		VkBufferImageCopy& region = copy.regions.emplace_back();
+		region.bufferOffset = stagingOffset + texture.levels[level].offset - first.offset;
+		region.imageExtent = {texture.levels[level].width, texture.levels[level].height, 1};
+		region.imageSubresource = VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+	}
+	m_stagedBytes += size;
+}
+
+bool upload_batch::directMemoryType(uint32_t typeBits, uint32_t& type) const
+{
+	uint32_t types = typeBits & m_direct.memoryTypes;
+	if(!types)
+		return false;
+	type = std::countr_zero(types);
+	return true;
+}
+
+void upload_batch::writeMemory(const gpu_allocation& memory, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+	if(size == 0)
+		return;
+	// the direct memory types are host coherent, their blocks stay mapped
+	if(!memory.mapped)
+		throw std::runtime_error("writing to device memory that is not mapped");
+	std::memcpy(memory.mapped + offset, data, size);
+	m_writtenBytes += size;
+}
+
+bool upload_batch::hostImageCopy(VkFormat format) const
+{
+	if(!m_direct.copyMemoryToImage || !m_direct.transitionImageLayout)
+		return false;
+
+	VkPhysicalDevice physicalDevice = deviceInfos[m_device].physicalDevice;
+	auto getFormatProperties2 = instance_dispatch[GetKey(physicalDevice)].GetPhysicalDeviceFormatProperties2;
+	if(!getFormatProperties2)
+		getFormatProperties2 = instance_dispatch[GetKey(physicalDevice)].GetPhysicalDeviceFormatProperties2KHR;
+	if(!getFormatProperties2)
+		return false;
+	// the extended feature flags are the only place that tells which formats take host copies
+	VkFormatProperties3 features3{};
+	features3.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3;
+	VkFormatProperties2 features{};
+	features.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2;
+	features.pNext = &features3;
+	getFormatProperties2(physicalDevice, format, &features);
+	if(!(features3.optimalTilingFeatures & VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT))
+		return false;
+
+	VkImageFormatProperties properties;
+	return instance_dispatch[GetKey(physicalDevice)].GetPhysicalDeviceImageFormatProperties(physicalDevice, format, VK_IMAGE_TYPE_2D,
+		VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT, 0, &properties) == VK_SUCCESS;
+}
+
+void upload_batch::writeImage(VkImage image, const TextureData& texture, uint32_t firstLevel, uint32_t levelCount)
+{
+	levelCount = std::min<uint32_t>(levelCount, texture.levels.size() - firstLevel);
+
+	// VK_IMAGE_LAYOUT_GENERAL is the one layout every implementation supports for host copies
+	VkHostImageLayoutTransitionInfoEXT transition{};
+	transition.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT;
+	transition.image = image;
+	transition.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	transition.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	transition.subresourceRange = VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, firstLevel, levelCount, 0, 1};
+	VkResult r = m_direct.transitionImageLayout(m_device, 1, &transition);
+	if(r != VK_SUCCESS)
+		throw std::runtime_error("failed to transition image layout: "+vk::to_string((vk::Result)r));
+
+	std::vector<VkMemoryToImageCopyEXT> regions;
+	size_t size = 0;
+	for(uint32_t level=firstLevel; level<firstLevel+levelCount; level++)
+	{
+		size += texture.levels[level].size;
+		VkMemoryToImageCopyEXT& region = regions.emplace_back();
+		region.sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT;
+		region.pHostPointer = texture.bytes() + texture.levels[level].offset;
+		region.imageSubresource = VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+		region.imageExtent = {texture.levels[level].width, texture.levels[level].height, 1};
+	}
+	VkCopyMemoryToImageInfoEXT copyInfo{};
+	copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT;
+	copyInfo.dstImage = image;
+	copyInfo.dstImageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	copyInfo.regionCount = regions.size();
+	copyInfo.pRegions = regions.data();
+	r = m_direct.copyMemoryToImage(m_device, &copyInfo);
+	if(r != VK_SUCCESS)
+		throw std::runtime_error("failed to copy memory to image: "+vk::to_string((vk::Result)r));
+	m_writtenBytes += size;
+}
+
+// the exclusive ones, whose ownership is transferred as a whole
+static std::vector<VkBuffer> unique_buffers(const auto& copies)
+{
+	std::vector<VkBuffer> buffers;
+	for(const auto& copy : copies)
+		if(!copy.concurrent)
+			buffers.push_back(copy.destination);
+	std::sort(buffers.begin(), buffers.end());
+	buffers.erase(std::unique(buffers.begin(), buffers.end()), buffers.end());
+	return buffers;
+}
+
+void upload_batch::record(VkCommandBuffer commandBuffer, uint32_t srcFamily, uint32_t dstFamily)
+{
+	bool transfer = srcFamily != dstFamily;
+
+	std::vector<VkImageMemoryBarrier> barriers;
+	for(const auto& copy : m_imageCopies)
+	{
+		VkImageMemoryBarrier& barrier = barriers.emplace_back();
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = copy.destination;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange = VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, copy.firstLevel, copy.levelCount, 0, 1};
+	}
+	if(!barriers.empty())
+		device_dispatch[GetKey(m_device)].CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, {},
+			0, nullptr, 0, nullptr, barriers.size(), barriers.data());
+
+	for(const auto& copy : m_bufferCopies)
+		device_dispatch[GetKey(m_device)].CmdCopyBuffer(commandBuffer, copy.source, copy.destination, 1, &copy.region);
+	for(const auto& copy : m_imageCopies)
+		device_dispatch[GetKey(m_device)].CmdCopyBufferToImage(commandBuffer, copy.source, copy.destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			copy.regions.size(), copy.regions.data());
+
+	// a release makes the writes available, the visibility is up to the acquire on the other queue
+	for(auto& barrier : barriers)
+	{
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = transfer ? 0 : VK_ACCESS_SHADER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcQueueFamilyIndex = transfer ? srcFamily : VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = transfer ? dstFamily : VK_QUEUE_FAMILY_IGNORED;
+	}
+	if(transfer)
+	{
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+		for(VkBuffer buffer : unique_buffers(m_bufferCopies))
+		{
+			VkBufferMemoryBarrier& barrier = bufferBarriers.emplace_back();
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = 0;
+			barrier.srcQueueFamilyIndex = srcFamily;
+			barrier.dstQueueFamilyIndex = dstFamily;
+			barrier.buffer = buffer;
+			barrier.offset = 0;
+			barrier.size = VK_WHOLE_SIZE;
+		}
+		// ownership transfers are not allowed for concurrent buffers, their writes are only made available
+		for(const auto& copy : m_bufferCopies)
+		{
+			if(!copy.concurrent)
+				continue;
+			VkBufferMemoryBarrier& barrier = bufferBarriers.emplace_back();
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = 0;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = copy.destination;
+			barrier.offset = copy.region.dstOffset;
+			barrier.size = copy.region.size;
+		}
+		device_dispatch[GetKey(m_device)].CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, {},
+			0, nullptr, bufferBarriers.size(), bufferBarriers.data(), barriers.size(), barriers.data());
+	}
+	else
+	{
+		VkMemoryBarrier bufferBarrier{};
+		bufferBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+		device_dispatch[GetKey(m_device)].CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, {},
+			1, &bufferBarrier, 0, nullptr, barriers.size(), barriers.data());
+	}
+}
+
+void upload_batch::acquireBarriers(uint32_t srcFamily, uint32_t dstFamily,
+	std::vector<VkBufferMemoryBarrier>& buffers, std::vector<VkImageMemoryBarrier>& images) const
+{
+	if(srcFamily == dstFamily)
+		return;
+
+	for(VkBuffer buffer : unique_buffers(m_bufferCopies))
+	{
+		VkBufferMemoryBarrier& barrier = buffers.emplace_back();
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+		barrier.srcQueueFamilyIndex = srcFamily;
+		barrier.dstQueueFamilyIndex = dstFamily;
+		barrier.buffer = buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+	}
+	// the writes to concurrent buffers are available since the fence, they only have to become visible
+	for(const auto& copy : m_bufferCopies)
+	{
+		if(!copy.concurrent)
+			continue;
+		VkBufferMemoryBarrier& barrier = buffers.emplace_back();
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = copy.destination;
+		barrier.offset = copy.region.dstOffset;
+		barrier.size = copy.region.size;
+	}
+	for(const auto& copy : m_imageCopies)
+	{
+		VkImageMemoryBarrier& barrier = images.emplace_back();
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = copy.destination;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcQueueFamilyIndex = srcFamily;
+		barrier.dstQueueFamilyIndex = dstFamily;
+		barrier.subresourceRange = VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, copy.firstLevel, copy.levelCount, 0, 1};
+	}
+}
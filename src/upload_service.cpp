@@ -0,0 +1,392 @@
+#include "upload_service.hpp"
+
+#include "dispatch.hpp"
+#include "layer.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <string_view>
+
+#include <vulkan/vulkan.hpp>
+
+using CheekyLayer::logger;
+
+// how long the idle upload thread waits for a submission before looking for new requests again
+static constexpr uint64_t pollTimeout = std::chrono::nanoseconds(std::chrono::milliseconds(1)).count();
+
+// the extension's functions may be found even if the game did not enable it, only the create info tells
+static bool host_image_copy_enabled(const VkDeviceCreateInfo* createInfo)
+{
+	if(!createInfo)
+		return false;
+	bool extension = false;
+	for(uint32_t i=0; i<createInfo->enabledExtensionCount; i++)
+		if(std::string_view(createInfo->ppEnabledExtensionNames[i]) == VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME)
+			extension = true;
+	for(auto next = static_cast<const VkBaseInStructure*>(createInfo->pNext); next; next = next->pNext)
+		if(next->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT)
+			return extension && reinterpret_cast<const VkPhysicalDeviceHostImageCopyFeaturesEXT*>(next)->hostImageCopy;
+	return false;
+}
+
+upload_service::upload_service(VkDevice device, const VkDeviceCreateInfo* createInfo, const nlohmann::json& config, bool direct, VkDeviceSize streamBudget)
+	: m_device(device), m_streamBudget(streamBudget)
+{
+	if(direct)
+	{
+		// a small host visible heap next to a big device local one is the 256 MiB BAR window and too precious for assets
+		const VkPhysicalDeviceMemoryProperties& memory = deviceInfos[device].memory;
+		VkDeviceSize largestHeap = 0;
+		for(uint32_t i=0; i<memory.memoryHeapCount; i++)
+			if(memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+				largestHeap = std::max(largestHeap, memory.memoryHeaps[i].size);
+		VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		for(uint32_t i=0; i<memory.memoryTypeCount; i++)
+			if((memory.memoryTypes[i].propertyFlags & flags) == flags && memory.memoryHeaps[memory.memoryTypes[i].heapIndex].size == largestHeap)
+				m_direct.memoryTypes |= 1u << i;
+
+		if(host_image_copy_enabled(createInfo))
+		{
+			m_direct.copyMemoryToImage = (PFN_vkCopyMemoryToImageEXT) device_dispatch[GetKey(device)].GetDeviceProcAddr(device, "vkCopyMemoryToImageEXT");
+			m_direct.transitionImageLayout = (PFN_vkTransitionImageLayoutEXT) device_dispatch[GetKey(device)].GetDeviceProcAddr(device, "vkTransitionImageLayoutEXT");
+		}
+		*::logger << logger::begin << "Direct uploads: " << (m_direct.memoryTypes ? "device local host visible memory" : "no device local host visible memory")
+			<< ", " << (m_direct.copyMemoryToImage ? "host image copy" : "no host image copy") << logger::end;
+	}
+
+	if(config.is_object())
+	{
+		VkPhysicalDevice physicalDevice = deviceInfos[device].physicalDevice;
+		uint32_t count;
+		instance_dispatch[GetKey(physicalDevice)].GetPhysicalDeviceQueueFamilyProperties(physicalDevice, &count, nullptr);
+		std::vector<VkQueueFamilyProperties> families(count);
+		instance_dispatch[GetKey(physicalDevice)].GetPhysicalDeviceQueueFamilyProperties(physicalDevice, &count, families.data());
+
+		auto findFamily = [&families](VkQueueFlags required, VkQueueFlags excluded) {
+			for(uint32_t i=0; i<families.size(); i++)
+				if((families[i].queueFlags & required) == required && !(families[i].queueFlags & excluded))
+					return i;
+			return VK_QUEUE_FAMILY_IGNORED;
+		};
+		m_queueFamily = config.value("family", findFamily(VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+		m_graphicsFamily = config.value("graphicsFamily", findFamily(VK_QUEUE_GRAPHICS_BIT, 0));
+	}
+
+	if(m_queueFamily != VK_QUEUE_FAMILY_IGNORED && m_graphicsFamily != VK_QUEUE_FAMILY_IGNORED)
+	{
+		device_dispatch[GetKey(device)].GetDeviceQueue(device, m_queueFamily, config.value("index", 0u), &m_queue);
+
+		VkCommandPoolCreateInfo poolCreateInfo{};
+		poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolCreateInfo.queueFamilyIndex = m_queueFamily;
+		VkResult r = device_dispatch[GetKey(device)].CreateCommandPool(device, &poolCreateInfo, nullptr, &m_commandPool);
+		if(r != VK_SUCCESS)
+			throw std::runtime_error("failed to create upload command pool: "+vk::to_string((vk::Result)r));
+		*::logger << logger::begin << "Uploading on queue family " << m_queueFamily << " for queue family " << m_graphicsFamily << logger::end;
+	}
+	else
+	{
+		// only ever submitted to from acquire() on the draw thread
+		m_queue = transferQueues[device];
+		m_queueFamily = m_graphicsFamily = VK_QUEUE_FAMILY_IGNORED;
+		if(config.is_object())
+			*::logger << logger::begin << "No transfer-only queue family, uploading on the layer's transfer queue" << logger::end;
+	}
+
+	m_thread = std::thread(&upload_service::run, this);
+}
+
+upload_service::~upload_service()
+{
+	{
+		std::unique_lock lock(m_mutex);
+		m_stop = true;
+	}
+	m_condition.notify_all();
+	m_thread.join();
+
+	if(m_submitted)
+	{
+		device_dispatch[GetKey(m_device)].WaitForFences(m_device, 1, &m_submitted->fence, VK_TRUE, UINT64_MAX);
+		device_dispatch[GetKey(m_device)].DestroyFence(m_device, m_submitted->fence, nullptr);
+	}
+	if(m_commandPool)
+		device_dispatch[GetKey(m_device)].DestroyCommandPool(m_device, m_commandPool, nullptr);
+}
+
+void upload_service::upload(fill_function fill, resident_function resident)
+{
+	{
+		std::unique_lock lock(m_mutex);
+		m_requests.push_back({std::move(fill), std::move(resident)});
+	}
+	m_condition.notify_one();
+}
+
+void upload_service::stream(VkDeviceSize bytes, fill_function fill, resident_function resident)
+{
+	std::unique_lock lock(m_mutex);
+	m_streamed.push_back({bytes, {std::move(fill), std::move(resident)}});
+}
+
+void upload_service::acquire(VkCommandBuffer commandBuffer)
+{
+	std::vector<VkBufferMemoryBarrier> bufferAcquires;
+	std::vector<VkImageMemoryBarrier> imageAcquires;
+	std::vector<std::pair<resident_function, bool>> resident;
+	bool released = false;
+	if(!m_commandPool)
+		submitPrepared();
+	{
+		std::unique_lock lock(m_mutex);
+		VkDeviceSize bytes = 0;
+		while(!m_streamed.empty() && (!released || bytes + m_streamed.front().bytes <= m_streamBudget))
+		{
+			bytes += m_streamed.front().bytes;
+			m_requests.push_back(std::move(m_streamed.front().r));
+			m_streamed.pop_front();
+			released = true;
+		}
+		bufferAcquires.swap(m_bufferAcquires);
+		imageAcquires.swap(m_imageAcquires);
+		resident.swap(m_resident);
+	}
+	if(released)
+		m_condition.notify_one();
+
+	if(!bufferAcquires.empty() || !imageAcquires.empty())
+		device_dispatch[GetKey(m_device)].CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, {},
+			0, nullptr, bufferAcquires.size(), bufferAcquires.data(), imageAcquires.size(), imageAcquires.data());
+	for(auto& [r, ok] : resident)
+		r(ok);
+}
+
+std::vector<uint32_t> upload_service::sharingFamilies() const
+{
+	if(m_queueFamily == m_graphicsFamily)
+		return {};
+	return {m_queueFamily, m_graphicsFamily};
+}
+
+void upload_service::run()
+{
+	while(true)
+	{
+		std::vector<request> requests;
+		{
+			std::unique_lock lock(m_mutex);
+			if(m_inFlight.empty())
+				m_condition.wait(lock, [this](){return m_stop || !m_requests.empty();});
+			if(m_stop)
+				break;
+			requests.swap(m_requests);
+		}
+
+		try
+		{
+			if(requests.empty())
+			{
+				retire(pollTimeout);
+				continue;
+			}
+			submit(requests);
+			retire(0);
+		}
+		catch(const std::exception& ex)
+		{
+			*::logger << logger::begin << logger::error << "upload failed: " << ex.what() << logger::end;
+		}
+	}
+
+	try
+	{
+		while(!m_inFlight.empty())
+			retire(UINT64_MAX);
+	}
+	catch(const std::exception& ex)
+	{
+		*::logger << logger::begin << logger::error << "failed to finish uploads: " << ex.what() << logger::end;
+	}
+}
+
+void upload_service::submit(std::vector<request>& requests)
+{
+	submission s{};
+	s.batch = std::make_unique<upload_batch>(m_device, m_direct);
+	for(auto& r : requests)
+	{
+		CheekyLayer::active_logger log = *::logger << logger::begin;
+		try
+		{
+			r.fill(log, *s.batch);
+			s.resident.push_back(std::move(r.resident));
+		}
+		catch(const std::exception& ex)
+		{
+			log << logger::error << "failed to prepare upload: " << ex.what();
+			s.failed.push_back(std::move(r.resident));
+		}
+		log << logger::end;
+	}
+	if(s.batch->writtenBytes())
+		*::logger << logger::begin << "Wrote " << s.batch->writtenBytes() << " bytes without staging" << logger::end;
+	if(s.batch->empty())
+	{
+		finish(s, true);
+		return;
+	}
+	if(!m_commandPool)
+	{
+		std::unique_lock lock(m_mutex);
+		m_prepared.push_back(std::move(s));
+		return;
+	}
+
+	try
+	{
+		send(s);
+	}
+	catch(...)
+	{
+		finish(s, false);
+		throw;
+	}
+	m_inFlight.push_back(std::move(s));
+}
+
+void upload_service::send(submission& s)
+{
+	if(m_commandPool)
+	{
+		VkCommandBufferAllocateInfo allocateInfo{};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = m_commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+		VkResult r = device_dispatch[GetKey(m_device)].AllocateCommandBuffers(m_device, &allocateInfo, &s.commandBuffer);
+		if(r != VK_SUCCESS)
+			throw std::runtime_error("failed to allocate upload command buffer: "+vk::to_string((vk::Result)r));
+	}
+	else
+		s.commandBuffer = transferCommandBuffers[m_device];
+
+	try
+	{
+		if(!m_commandPool && device_dispatch[GetKey(m_device)].ResetCommandBuffer(s.commandBuffer, 0) != VK_SUCCESS)
+			throw std::runtime_error("failed to reset command buffer");
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if(device_dispatch[GetKey(m_device)].BeginCommandBuffer(s.commandBuffer, &beginInfo) != VK_SUCCESS)
+			throw std::runtime_error("failed to begin the command buffer");
+		s.batch->record(s.commandBuffer, m_queueFamily, m_graphicsFamily);
+		if(device_dispatch[GetKey(m_device)].EndCommandBuffer(s.commandBuffer) != VK_SUCCESS)
+			throw std::runtime_error("failed to end command buffer");
+
+		VkFenceCreateInfo fenceCreateInfo{};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		VkResult r = device_dispatch[GetKey(m_device)].CreateFence(m_device, &fenceCreateInfo, nullptr, &s.fence);
+		if(r != VK_SUCCESS)
+		{
+			s.fence = VK_NULL_HANDLE;
+			throw std::runtime_error("failed to create upload fence: "+vk::to_string((vk::Result)r));
+		}
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &s.commandBuffer;
+		r = device_dispatch[GetKey(m_device)].QueueSubmit(m_queue, 1, &submitInfo, s.fence);
+		if(r != VK_SUCCESS)
+			throw std::runtime_error("failed to submit uploads: "+vk::to_string((vk::Result)r));
+	}
+	catch(...)
+	{
+		if(s.fence)
+			device_dispatch[GetKey(m_device)].DestroyFence(m_device, s.fence, nullptr);
+		if(m_commandPool)
+			device_dispatch[GetKey(m_device)].FreeCommandBuffers(m_device, m_commandPool, 1, &s.commandBuffer);
+		s.fence = VK_NULL_HANDLE;
+		s.commandBuffer = VK_NULL_HANDLE;
+		throw;
+	}
+
+	*::logger << logger::begin << "Submitted " << s.batch->stagedBytes() << " bytes of uploads for " << s.resident.size() << " assets" << logger::end;
+}
+
+void upload_service::finish(submission& s, bool ok)
+{
+	std::unique_lock lock(m_mutex);
+	if(ok)
+		s.batch->acquireBarriers(m_queueFamily, m_graphicsFamily, m_bufferAcquires, m_imageAcquires);
+	for(auto& r : s.resident)
+		m_resident.emplace_back(std::move(r), ok);
+	for(auto& r : s.failed)
+		m_resident.emplace_back(std::move(r), false);
+	s.resident.clear();
+	s.failed.clear();
+}
+
+void upload_service::retire(uint64_t timeout)
+{
+	if(m_inFlight.empty())
+		return;
+	if(timeout > 0)
+	{
+		VkResult r = device_dispatch[GetKey(m_device)].WaitForFences(m_device, 1, &m_inFlight.front().fence, VK_TRUE, timeout);
+		if(r != VK_SUCCESS && r != VK_TIMEOUT)
+			throw std::runtime_error("failed to wait for uploads: "+vk::to_string((vk::Result)r));
+	}
+
+	// one queue finishes its submissions in order
+	auto it = m_inFlight.begin();
+	for(; it != m_inFlight.end(); it++)
+	{
+		if(device_dispatch[GetKey(m_device)].GetFenceStatus(m_device, it->fence) != VK_SUCCESS)
+			break;
+
+		finish(*it, true);
+		device_dispatch[GetKey(m_device)].DestroyFence(m_device, it->fence, nullptr);
+		device_dispatch[GetKey(m_device)].FreeCommandBuffers(m_device, m_commandPool, 1, &it->commandBuffer);
+	}
+	m_inFlight.erase(m_inFlight.begin(), it);
+}
+
+void upload_service::submitPrepared()
+{
+	if(m_submitted)
+	{
+		VkResult r = device_dispatch[GetKey(m_device)].GetFenceStatus(m_device, m_submitted->fence);
+		if(r == VK_NOT_READY)
+			return;
+		if(r != VK_SUCCESS)
+			*::logger << logger::begin << logger::error << "failed to wait for uploads: " << vk::to_string((vk::Result)r) << logger::end;
+		finish(*m_submitted, r == VK_SUCCESS);
+		device_dispatch[GetKey(m_device)].DestroyFence(m_device, m_submitted->fence, nullptr);
+		m_submitted.reset();
+	}
+
+	std::optional<submission> next;
+	{
+		std::unique_lock lock(m_mutex);
+		if(m_prepared.empty())
+			return;
+		next = std::move(m_prepared.front());
+		m_prepared.pop_front();
+	}
+	try
+	{
+		send(*next);
+		m_submitted = std::move(next);
+	}
+	catch(const std::exception& ex)
+	{
+		*::logger << logger::begin << logger::error << "upload failed: " << ex.what() << logger::end;
+		finish(*next, false);
+	}
+}
@@ -0,0 +1,90 @@
+#include "vertex_format.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <stdexcept>
+
+static float sign_not_zero(float v)
+{
+	return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+static glm::vec2 octahedral_encode(glm::vec3 n)
+{
+	n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	glm::vec2 e(n.x, n.y);
+	if(n.z < 0.0f)
+		e = glm::vec2((1.0f - std::abs(n.y)) * sign_not_zero(n.x), (1.0f - std::abs(n.x)) * sign_not_zero(n.y));
+	return e;
+}
+
+static glm::vec3 octahedral_decode(glm::vec2 e)
+{
+	glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	if(n.z < 0.0f)
+	{
+		float x = n.x;
+		n.x = (1.0f - std::abs(n.y)) * sign_not_zero(x);
+		n.y = (1.0f - std::abs(x)) * sign_not_zero(n.y);
+	}
+	return glm::normalize(n);
+}
+
+VertexFormat parse_vertex_format(const std::string& name)
+{
+	if(name == "float")		return VertexFormat::Float;
+	if(name == "quantized")	return VertexFormat::Quantized;
+	throw std::runtime_error("unknown vertex format: "+name);
+}
+
+size_t vertex_stride(VertexFormat format)
+{
+	switch(format)
+	{
+		case VertexFormat::Float:
+			return sizeof(Vertex);
+		case VertexFormat::Quantized:
+			return sizeof(PackedVertex);
+	}
+	throw std::runtime_error("unknown vertex format");
+}
+
+VertexDequantization vertex_dequantization(glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+	glm::vec3 scale = boundsMax - boundsMin;
+	// flat meshes still need a valid mapping on the flat axis
+	for(int i=0; i<3; i++)
+		if(!(scale[i] > 0.0f))
+			scale[i] = 1.0f;
+	return {glm::vec4(scale, 0.0f), glm::vec4(boundsMin, 1.0f)};
+}
+
+PackedVertex pack_vertex(const Vertex& vertex, const VertexDequantization& dequantization)
+{
+	PackedVertex packed;
+	for(int i=0; i<3; i++)
+		packed.position[i] = glm::packUnorm1x16((vertex.position[i] - dequantization.bias[i]) / dequantization.scale[i]);
+	packed.position[3] = glm::packUnorm1x16(1.0f);
+
+	glm::vec3 normal = vertex.normal;
+	glm::vec2 encoded = glm::dot(normal, normal) > 0.0f ? octahedral_encode(normal) : glm::vec2(0.0f);
+	packed.normal[0] = static_cast<int16_t>(glm::packSnorm1x16(encoded.x));
+	packed.normal[1] = static_cast<int16_t>(glm::packSnorm1x16(encoded.y));
+
+	packed.texCoord[0] = glm::packHalf1x16(vertex.texCoord.x);
+	packed.texCoord[1] = glm::packHalf1x16(vertex.texCoord.y);
+	return packed;
+}
+
+Vertex unpack_vertex(const PackedVertex& vertex, const VertexDequantization& dequantization)
+{
+	Vertex unpacked;
+	for(int i=0; i<3; i++)
+		unpacked.position[i] = glm::unpackUnorm1x16(vertex.position[i]) * dequantization.scale[i] + dequantization.bias[i];
+	unpacked.normal = octahedral_decode(glm::vec2(
+		glm::unpackSnorm1x16(static_cast<uint16_t>(vertex.normal[0])),
+		glm::unpackSnorm1x16(static_cast<uint16_t>(vertex.normal[1]))));
+	unpacked.texCoord = glm::vec2(glm::unpackHalf1x16(vertex.texCoord[0]), glm::unpackHalf1x16(vertex.texCoord[1]));
+	return unpacked;
+}
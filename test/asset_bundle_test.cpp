@@ -0,0 +1,132 @@
+#include "asset_bundle.hpp"
+#include "mesh_cache.hpp"
+#include "texture.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// a grid of n*n quads, enough for the cooked mesh to have levels of detail
+MeshData make_grid(int n)
+{
+	MeshData mesh;
+	for(int y=0; y<=n; y++)
+		for(int x=0; x<=n; x++)
+			mesh.vertices.push_back({glm::vec3(x, 0.1f*((x*7 + y*3) % 5), y), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(x/(float)n, y/(float)n)});
+	for(int y=0; y<n; y++)
+		for(int x=0; x<n; x++)
+		{
+			uint32_t a = y*(n+1)+x, b = a+1, c = a+n+1, d = c+1;
+			mesh.indices.insert(mesh.indices.end(), {a, b, d, a, d, c});
+		}
+	return mesh;
+}
+
+bool same_bytes(std::span<const uint8_t> a, std::span<const uint8_t> b)
+{
+	return std::equal(a.begin(), a.end(), b.begin(), b.end());
+}
+
+// a bundle whose table points past the end of the file has to be rejected, not read
+bool rejects_corrupt(const std::string& path, const std::vector<uint8_t>& bytes, size_t offset, uint64_t value)
+{
+	std::vector<uint8_t> corrupt = bytes;
+	std::memcpy(corrupt.data() + offset, &value, sizeof(value));
+	{
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(corrupt.data()), corrupt.size());
+	}
+	try
+	{
+		asset_bundle bundle(path);
+		for(const std::string& name : bundle.companions())
+			bundle.texture(name);
+	}
+	catch(const std::exception&)
+	{
+		return true;
+	}
+	return false;
+}
+
+int main()
+{
+	std::string path = (std::filesystem::temp_directory_path() / "cheeky_companion_test.bundle").string();
+
+	cook_options options;
+	cooked_mesh mesh = cooked_mesh::cook(make_grid(32), 42, options);
+	TextureData texture = solid_color(glm::vec4(0.2f, 0.4f, 0.6f, 1.0f), 64);
+	generate_mipmaps(texture);
+	std::string manifest = R"({"id": "test", "modelType": "obj", "modelFile": "model.obj", "textureType": "color"})";
+
+	bundle_writer writer;
+	writer.add("test", BundleEntry::Mesh, mesh.bytes());
+	writer.addTexture("test", texture);
+	writer.addManifest("test", manifest);
+	writer.write(path);
+
+	bool ok = true;
+	{
+		asset_bundle bundle(path);
+		std::optional<cooked_mesh> packedMesh = bundle.mesh("test", options);
+		TextureData packedTexture = bundle.texture("test");
+
+		cook_options other = options;
+		other.vertexFormat = VertexFormat::Quantized;
+		ok = bundle.companions() == std::vector<std::string>{"test"} && bundle.manifest("test") == manifest &&
+			packedMesh && same_bytes(packedMesh->bytes(), mesh.bytes()) && packedMesh->sourceHash() == 42 && !bundle.mesh("test", other) &&
+			packedTexture.format == texture.format && packedTexture.levels.size() == texture.levels.size();
+		for(size_t i=0; ok && i<texture.levels.size(); i++)
+		{
+			const TextureLevel& a = texture.levels[i];
+			const TextureLevel& b = packedTexture.levels[i];
+			ok = a.width == b.width && a.height == b.height && a.size == b.size &&
+				same_bytes({texture.bytes() + a.offset, a.size}, {packedTexture.bytes() + b.offset, b.size});
+		}
+	}
+	if(!ok)
+	{
+		std::filesystem::remove(path);
+		std::cerr << "the bundle does not give back what was packed" << std::endl;
+		return 1;
+	}
+
+	std::vector<uint8_t> bytes;
+	{
+		std::ifstream in(path, std::ios::binary);
+		bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	// the header's entry count and the first entry's data offset, set so that the table's size and the entry's end wrap around
+	bool rejected = rejects_corrupt(path, bytes, 8, (uint64_t{1} << 59) + 1) && rejects_corrupt(path, bytes, 32 + 16, ~uint64_t{0} - 63);
+
+	// a level smaller than its width and height need, which the uploads would read past
+	TextureData truncated = texture;
+	truncated.levels[0].size -= 4;
+	bundle_writer truncatedWriter;
+	truncatedWriter.addTexture("test", truncated);
+	truncatedWriter.write(path);
+	try
+	{
+		asset_bundle(path).texture("test");
+		rejected = false;
+	}
+	catch(const std::exception&)
+	{
+	}
+	std::filesystem::remove(path);
+	if(!rejected)
+	{
+		std::cerr << "a corrupt bundle was opened" << std::endl;
+		return 1;
+	}
+
+	std::cout << "packed and read back a mesh of " << mesh.bytes().size() << " bytes and " << texture.levels.size() << " texture levels" << std::endl;
+	return 0;
+}
@@ -0,0 +1,182 @@
+#include "texture.hpp"
+
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using texel = std::array<uint8_t, 4>;
+
+// writes the fields of a block LSB first, as BC7 stores them
+class bit_writer
+{
+	public:
+		void write(uint32_t value, uint32_t count)
+		{
+			for(uint32_t i=0; i<count; i++, m_position++)
+				m_block[m_position / 8] |= ((value >> i) & 1u) << (m_position % 8);
+		}
+		std::vector<uint8_t> block() const
+		{
+			return {m_block, m_block + 16};
+		}
+		uint32_t position() const {return m_position;}
+	private:
+		uint8_t m_block[16] = {};
+		uint32_t m_position = 0;
+};
+
+// decodes a single 4x4 block and compares it against the reference texels
+bool decodes_to(const std::string& what, VkFormat format, const std::vector<uint8_t>& block, const std::array<texel, 16>& expected)
+{
+	TextureData texture{format, {{4, 4, 0, block.size()}}, block};
+	TextureData decoded = decompress_blocks(texture);
+	for(int i=0; i<16; i++)
+	{
+		texel t;
+		std::memcpy(t.data(), decoded.bytes() + i*4, 4);
+		if(t != expected[i])
+		{
+			std::cerr << what << ": texel " << i << " is " << int(t[0]) << "," << int(t[1]) << "," << int(t[2]) << "," << int(t[3]) <<
+				" instead of " << int(expected[i][0]) << "," << int(expected[i][1]) << "," << int(expected[i][2]) << "," << int(expected[i][3]) << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+std::array<texel, 16> repeat(const std::array<texel, 4>& texels)
+{
+	std::array<texel, 16> result;
+	for(int i=0; i<16; i++)
+		result[i] = texels[i % 4];
+	return result;
+}
+
+bool test_bc1()
+{
+	// red above blue picks the 4 color mode, texel i uses color i % 4
+	std::vector<uint8_t> fourColors = {0x00, 0xF8, 0x1F, 0x00, 0xE4, 0xE4, 0xE4, 0xE4};
+	std::array<texel, 4> fourColorTexels = {texel{255, 0, 0, 255}, {0, 0, 255, 255}, {170, 0, 85, 255}, {85, 0, 170, 255}};
+
+	// black below (8,8,8) picks the 3 color mode, whose fourth color is transparent black with alpha
+	std::vector<uint8_t> threeColors = {0x00, 0x00, 0x41, 0x08, 0xE4, 0xE4, 0xE4, 0xE4};
+	std::array<texel, 4> threeColorTexels = {texel{0, 0, 0, 255}, {8, 8, 8, 255}, {4, 4, 4, 255}, {0, 0, 0, 0}};
+	std::array<texel, 4> threeColorOpaqueTexels = threeColorTexels;
+	threeColorOpaqueTexels[3] = {0, 0, 0, 255};
+
+	return decodes_to("BC1 4 colors", VK_FORMAT_BC1_RGBA_UNORM_BLOCK, fourColors, repeat(fourColorTexels)) &&
+		decodes_to("BC1 3 colors", VK_FORMAT_BC1_RGBA_UNORM_BLOCK, threeColors, repeat(threeColorTexels)) &&
+		decodes_to("BC1 3 colors without alpha", VK_FORMAT_BC1_RGB_UNORM_BLOCK, threeColors, repeat(threeColorOpaqueTexels));
+}
+
+bool test_bc3()
+{
+	// white color part, texel i uses alpha index i % 8
+	auto block = [](uint8_t alpha0, uint8_t alpha1) {
+		bit_writer bits;
+		bits.write(alpha0, 8);
+		bits.write(alpha1, 8);
+		for(uint32_t i=0; i<16; i++)
+			bits.write(i % 8, 3);
+		bits.write(0xFFFF, 16);
+		bits.write(0xFFFF, 16);
+		return bits.block();
+	};
+	std::array<texel, 16> eightAlphas, sixAlphas;
+	const uint8_t eight[8] = {70, 0, 60, 50, 40, 30, 20, 10};
+	const uint8_t six[8] = {0, 50, 10, 20, 30, 40, 0, 255};
+	for(int i=0; i<16; i++)
+	{
+		eightAlphas[i] = {255, 255, 255, eight[i % 8]};
+		sixAlphas[i] = {255, 255, 255, six[i % 8]};
+	}
+	return decodes_to("BC3 8 alphas", VK_FORMAT_BC3_UNORM_BLOCK, block(70, 0), eightAlphas) &&
+		decodes_to("BC3 6 alphas", VK_FORMAT_BC3_UNORM_BLOCK, block(0, 50), sixAlphas);
+}
+
+bool test_bc7()
+{
+	// mode 1: two subsets split into the top and bottom half by partition 13, a shared p-bit per subset
+	// and 3 bit indices, 2 bit for texel 0 and for texel 15, the anchor of the second subset
+	bit_writer mode1;
+	mode1.write(0b10, 2);
+	mode1.write(13, 6);
+	for(int c=0; c<3; c++)
+		for(uint32_t e : {0, 63, 63, 0})
+			mode1.write(e, 6);
+	mode1.write(0, 1);
+	mode1.write(1, 1);
+	for(uint32_t i=0; i<16; i++)
+		mode1.write(i == 15 ? 3 : i % 2 ? 7 : 0, i == 0 || i == 15 ? 2 : 3);
+	std::array<texel, 16> mode1Texels;
+	for(int i=0; i<16; i++)
+	{
+		uint8_t value = i < 8 ? (i % 2 ? 253 : 0) : (i % 2 ? 2 : 255);
+		mode1Texels[i] = {value, value, value, 255};
+	}
+	mode1Texels[15] = {148, 148, 148, 255};
+
+	// mode 5: one subset with separate color and alpha indices, rotation 1 swaps alpha and red
+	bit_writer mode5;
+	mode5.write(0b100000, 6);
+	mode5.write(1, 2);
+	for(int c=0; c<3; c++)
+	{
+		mode5.write(0, 7);
+		mode5.write(127, 7);
+	}
+	mode5.write(10, 8);
+	mode5.write(200, 8);
+	for(uint32_t i=0; i<16; i++)
+		mode5.write(i == 1 ? 3 : 0, i == 0 ? 1 : 2);
+	for(uint32_t i=0; i<16; i++)
+		mode5.write(i == 0 ? 0 : 3, i == 0 ? 1 : 2);
+	std::array<texel, 16> mode5Texels;
+	mode5Texels.fill({200, 0, 0, 0});
+	mode5Texels[0] = {10, 0, 0, 0};
+	mode5Texels[1] = {200, 255, 255, 255};
+
+	// mode 6: one subset with alpha, a p-bit per endpoint and 4 bit indices
+	bit_writer mode6;
+	mode6.write(0b1000000, 7);
+	for(auto [e0, e1] : {std::pair{0u, 127u}, {50u, 25u}, {100u, 0u}, {127u, 127u}})
+	{
+		mode6.write(e0, 7);
+		mode6.write(e1, 7);
+	}
+	mode6.write(0, 1);
+	mode6.write(1, 1);
+	for(uint32_t i=0; i<16; i++)
+		mode6.write(i == 1 ? 15 : i == 2 ? 8 : 0, i == 0 ? 3 : 4);
+	std::array<texel, 16> mode6Texels;
+	mode6Texels.fill({0, 100, 200, 254});
+	mode6Texels[1] = {255, 51, 1, 255};
+	mode6Texels[2] = {135, 74, 94, 255};
+
+	// no mode bit set at all is reserved and decodes to transparent black
+	std::array<texel, 16> transparent;
+	transparent.fill({0, 0, 0, 0});
+
+	if(mode1.position() != 128 || mode5.position() != 128 || mode6.position() != 128)
+	{
+		std::cerr << "the BC7 test blocks are not 128 bits long" << std::endl;
+		return false;
+	}
+	return decodes_to("BC7 mode 1", VK_FORMAT_BC7_UNORM_BLOCK, mode1.block(), mode1Texels) &&
+		decodes_to("BC7 mode 5", VK_FORMAT_BC7_UNORM_BLOCK, mode5.block(), mode5Texels) &&
+		decodes_to("BC7 mode 6", VK_FORMAT_BC7_UNORM_BLOCK, mode6.block(), mode6Texels) &&
+		decodes_to("BC7 reserved mode", VK_FORMAT_BC7_UNORM_BLOCK, std::vector<uint8_t>(16, 0), transparent);
+}
+
+int main()
+{
+	bool ok = test_bc1();
+	ok = test_bc3() && ok;
+	ok = test_bc7() && ok;
+	if(!ok)
+		return 1;
+	std::cout << "decoded BC1, BC3 and BC7 blocks like the reference" << std::endl;
+	return 0;
+}
@@ -0,0 +1,98 @@
+#include "mesh.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// a triangle with float positions and 16 bit indices, the accessor count and byte offset can be overridden
+std::string make_json(uint64_t count, uint64_t byteOffset)
+{
+	return R"({"asset": {"version": "2.0"}, "buffers": [{"byteLength": 44}],
+		"bufferViews": [{"buffer": 0, "byteOffset": 0, "byteLength": 36}, {"buffer": 0, "byteOffset": 36, "byteLength": 6}],
+		"accessors": [{"bufferView": 0, "componentType": 5126, "type": "VEC3", "count": )" + std::to_string(count) + R"(, "byteOffset": )" + std::to_string(byteOffset) + R"(},
+			{"bufferView": 1, "componentType": 5123, "type": "SCALAR", "count": 3}],
+		"meshes": [{"primitives": [{"attributes": {"POSITION": 0}, "indices": 1}]}]})";
+}
+
+void append_chunk(std::vector<uint8_t>& out, uint32_t type, std::vector<uint8_t> data, uint8_t padding)
+{
+	data.resize((data.size() + 3) & ~size_t{3}, padding);
+	uint32_t header[2] = {static_cast<uint32_t>(data.size()), type};
+	out.insert(out.end(), reinterpret_cast<const uint8_t*>(header), reinterpret_cast<const uint8_t*>(header + 2));
+	out.insert(out.end(), data.begin(), data.end());
+}
+
+void write_glb(const std::string& path, const std::string& json)
+{
+	float positions[9] = {0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f};
+	uint16_t indices[3] = {0, 1, 2};
+	std::vector<uint8_t> bin(sizeof(positions) + sizeof(indices));
+	std::memcpy(bin.data(), positions, sizeof(positions));
+	std::memcpy(bin.data() + sizeof(positions), indices, sizeof(indices));
+
+	std::vector<uint8_t> chunks;
+	append_chunk(chunks, 0x4E4F534A, {json.begin(), json.end()}, ' ');
+	append_chunk(chunks, 0x004E4942, bin, 0);
+	uint32_t header[3] = {0x46546C67, 2, static_cast<uint32_t>(sizeof(header) + chunks.size())};
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(chunks.data()), chunks.size());
+}
+
+bool rejects(const std::string& path, const std::string& json)
+{
+	write_glb(path, json);
+	try
+	{
+		load_glb(path);
+	}
+	// failing later, like when allocating the vertices of a bogus count, does not count
+	catch(const std::runtime_error& e)
+	{
+		return std::string(e.what()).find("out of bounds") != std::string::npos;
+	}
+	return false;
+}
+
+int main()
+{
+	std::string path = (std::filesystem::temp_directory_path() / "cheeky_companion_test.glb").string();
+
+	write_glb(path, make_json(3, 0));
+	MeshData mesh;
+	try
+	{
+		mesh = load_glb(path);
+	}
+	catch(const std::exception& e)
+	{
+		std::filesystem::remove(path);
+		std::cerr << "failed to load the GLB file: " << e.what() << std::endl;
+		return 1;
+	}
+	if(mesh.vertices.size() != 3 || mesh.indices != std::vector<uint32_t>{0, 1, 2} || mesh.vertices[1].position != glm::vec3(1.0f, 0.0f, 0.0f) ||
+		mesh.vertices[2].position != glm::vec3(0.0f, 1.0f, 0.0f))
+	{
+		std::filesystem::remove(path);
+		std::cerr << "the GLB file does not give back its triangle" << std::endl;
+		return 1;
+	}
+
+	// accessors reaching past their buffer view, once just by one element and once by a count that makes count * stride wrap around
+	bool rejected = rejects(path, make_json(4, 0)) && rejects(path, make_json(3, 4)) && rejects(path, make_json(3, 36)) &&
+		rejects(path, make_json((uint64_t{1} << 62) + 1, 0));
+	std::filesystem::remove(path);
+	if(!rejected)
+	{
+		std::cerr << "a GLB file with an out of bounds accessor was loaded" << std::endl;
+		return 1;
+	}
+
+	std::cout << "loaded a GLB triangle and rejected out of bounds accessors" << std::endl;
+	return 0;
+}
@@ -0,0 +1,195 @@
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// the parser load_obj used to have, kept as the baseline to compare against
+std::tuple<std::vector<Vertex>,std::vector<uint16_t>> load_obj_reference(std::string file)
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texCoords;
+	std::vector<std::tuple<int, int, int>> indices;
+
+	std::ifstream obj(file);
+	std::string line;
+	while(std::getline(obj, line))
+	{
+		std::istringstream is(line);
+		std::string type;
+		is >> type;
+		if(type=="v")
+		{
+			float x, y, z;
+			is >> x >> y >> z;
+			positions.push_back({x, y, z});
+		}
+		if(type=="vt")
+		{
+			float u, v;
+			is >> u >> v;
+			texCoords.push_back({u, -v});
+		}
+		if(type=="vn")
+		{
+			float x, y, z;
+			is >> x >> y >> z;
+			normals.push_back({x, y, z});
+		}
+		if(type=="f")
+		{
+			std::array<std::string, 3> args;
+			is >> args[0] >> args[1] >> args[2];
+			for(int i=0; i<3; i++)
+			{
+				std::stringstream s(args[i]);
+				int vertex, uv, normal;
+
+				s >> vertex;
+				s.ignore(1);
+				s >> uv;
+				s.ignore(1);
+				s >> normal;
+
+				indices.push_back({vertex-1, uv-1, normal-1});
+			}
+		}
+	}
+
+	std::vector<Vertex> vertices;
+	std::vector<std::tuple<int, int, int>> indexCombos;
+	std::vector<uint16_t> newIndices;
+	for(size_t i=0; i<indices.size(); i++)
+	{
+		auto index = indices[i];
+		auto p = std::find(indexCombos.begin(), indexCombos.end(), index);
+		if(p == indexCombos.end())
+		{
+			newIndices.push_back(vertices.size());
+			auto [pos, tex, nor] = index;
+			vertices.push_back({positions[pos], normals[nor], texCoords[tex]});
+			indexCombos.push_back(index);
+		}
+		else
+		{
+			newIndices.push_back(std::distance(indexCombos.begin(), p));
+		}
+	}
+
+	return {vertices, newIndices};
+}
+
+// writes a displaced grid of n*n quads, split into two triangles each
+void write_grid(const std::string& path, int n)
+{
+	std::ofstream out(path);
+	for(int y=0; y<=n; y++)
+		for(int x=0; x<=n; x++)
+		{
+			out << "v " << x/(float)n << " " << 0.1f*std::sin(x*0.3f)*std::cos(y*0.2f) << " " << y/(float)n << "\n";
+			out << "vt " << x/(float)n << " " << y/(float)n << "\n";
+			out << "vn 0.0 1.0 0.0\n";
+		}
+	for(int y=0; y<n; y++)
+		for(int x=0; x<n; x++)
+		{
+			int a = y*(n+1)+x+1, b = a+1, c = a+n+1, d = c+1;
+			out << "f " << a << "/" << a << "/" << a << " " << b << "/" << b << "/" << b << " " << d << "/" << d << "/" << d << "\n";
+			out << "f " << a << "/" << a << "/" << a << " " << d << "/" << d << "/" << d << " " << c << "/" << c << "/" << c << "\n";
+		}
+}
+
+// a file whose last face is not followed by a newline still has that face
+bool check_no_trailing_newline(const std::string& path)
+{
+	{
+		std::ofstream out(path);
+		out << "v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nvn 0 0 1\nf 1/1/1 2/1/1 3/1/1";
+	}
+	MeshData mesh = load_obj(path);
+	std::filesystem::remove(path);
+	return mesh.indices.size() == 3 && mesh.vertices.size() == 3;
+}
+
+// n-gons, negative indices and corners without texture coordinates or normals, against the reference parser
+// reading the same mesh spelled out as triangles with all three indices
+bool check_face_forms(const std::string& path)
+{
+	const char* positions = "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 2 0 0\n";
+	{
+		std::ofstream out(path);
+		out << positions << "vt 0.5 0.5\nvn 0 0 1\n";
+		out << "f 1/1/1 2/1/1 3/1/1 4/1/1\n";
+		out << "f -4//-1 -1//-1 -3//-1\n";
+		// the generated normals of this face equal the given ones, but corners without a normal stay vertices of their own
+		out << "f 2 5 3\n";
+	}
+	MeshData mesh = load_obj(path);
+	{
+		std::ofstream out(path);
+		out << positions << "vt 0.5 0.5\nvt 0 0\nvt 0 0\nvn 0 0 1\nvn 0 0 1\n";
+		out << "f 1/1/1 2/1/1 3/1/1\nf 1/1/1 3/1/1 4/1/1\n";
+		out << "f 2/2/1 5/2/1 3/2/1\nf 2/3/2 5/3/2 3/3/2\n";
+	}
+	auto [referenceVertices, referenceIndices] = load_obj_reference(path);
+	std::filesystem::remove(path);
+
+	return std::equal(mesh.indices.begin(), mesh.indices.end(), referenceIndices.begin(), referenceIndices.end()) &&
+		std::equal(mesh.vertices.begin(), mesh.vertices.end(), referenceVertices.begin(), referenceVertices.end(), [](const Vertex& a, const Vertex& b){
+			return a.position == b.position && a.normal == b.normal && a.texCoord == b.texCoord;
+		});
+}
+
+template<typename F>
+double measure(F&& f)
+{
+	auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+	int n = argc > 1 ? std::stoi(argv[1]) : 200;
+	std::string path = (std::filesystem::temp_directory_path() / "cheeky_companion_benchmark.obj").string();
+	if(!check_no_trailing_newline(path))
+	{
+		std::cerr << "load_obj lost the last line of a file without a trailing newline" << std::endl;
+		return 1;
+	}
+	if(!check_face_forms(path))
+	{
+		std::cerr << "load_obj read n-gons, negative indices or faces without texture coordinates or normals differently than the reference parser" << std::endl;
+		return 1;
+	}
+	write_grid(path, n);
+
+	MeshData fast;
+	std::tuple<std::vector<Vertex>,std::vector<uint16_t>> reference;
+	double fastTime = measure([&](){ fast = load_obj(path); });
+	double referenceTime = measure([&](){ reference = load_obj_reference(path); });
+	std::filesystem::remove(path);
+
+	auto& [referenceVertices, referenceIndices] = reference;
+	std::cout << 2*n*n << " triangles, " << fast.vertices.size() << " vertices" << std::endl;
+	std::cout << "reference: " << referenceTime*1000.0 << " ms" << std::endl;
+	std::cout << "load_obj:  " << fastTime*1000.0 << " ms" << std::endl;
+	std::cout << "speedup:   " << referenceTime/fastTime << "x" << std::endl;
+
+	if(!std::equal(fast.indices.begin(), fast.indices.end(), referenceIndices.begin(), referenceIndices.end()) ||
+		fast.vertices.size() != referenceVertices.size())
+	{
+		std::cerr << "load_obj produced a different mesh than the reference parser" << std::endl;
+		return 1;
+	}
+	return 0;
+}
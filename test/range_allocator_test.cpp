@@ -0,0 +1,135 @@
+#include "gpu_allocator.hpp"
+#include "range_allocator.hpp"
+#include "dispatch.hpp"
+#include "layer.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what)
+{
+	if(!condition)
+	{
+		std::cerr << "failed: " << what << std::endl;
+		failures++;
+	}
+}
+
+static void test_coalescing()
+{
+	range_allocator ranges(1000);
+	auto a = ranges.allocate(100, 1), b = ranges.allocate(100, 1), c = ranges.allocate(100, 1);
+	check(a == 0u && b == 100u && c == 200u, "ranges are handed out back to back");
+
+	// freeing a and then b leaves one free range of 200 in front of c
+	ranges.free(*a, 100);
+	ranges.free(*b, 100);
+	check(ranges.allocate(200, 1) == 0u, "neighbouring free ranges merge");
+	ranges.free(0, 200);
+
+	ranges.free(*c, 100);
+	check(ranges.used() == 0 && ranges.allocations() == 0, "everything is free again");
+	check(ranges.allocate(1000, 1) == 0u, "the whole space merges back into one range");
+	check(!ranges.allocate(1, 1), "a full space has no room");
+}
+
+static void test_best_fit()
+{
+	range_allocator ranges(1000);
+	auto a = ranges.allocate(50, 1), b = ranges.allocate(10, 1), c = ranges.allocate(200, 1), d = ranges.allocate(10, 1);
+	ranges.free(*a, 50);
+	ranges.free(*c, 200);
+	check(ranges.allocate(40, 1) == 0u, "the smallest free range that fits is taken");
+	check(ranges.allocate(100, 1) == 60u, "a bigger range goes where it fits");
+	ranges.free(*b, 10);
+	ranges.free(*d, 10);
+	check(!ranges.allocate(1000, 1), "no range fits while other ranges are used");
+}
+
+static void test_alignment()
+{
+	range_allocator ranges(1024);
+	check(ranges.allocate(10, 1) == 0u, "the first range starts at 0");
+	check(ranges.allocate(10, 64) == 64u, "a range starts aligned");
+	// the gap in front of the aligned range stays free
+	check(ranges.allocate(54, 1) == 10u, "the alignment gap is used later");
+	auto odd = ranges.allocate(10, 48);
+	check(odd && *odd % 48 == 0, "alignments do not have to be powers of two");
+	check(ranges.used() == 10 + 10 + 54 + 10, "alignment gaps do not count as used");
+}
+
+// a device that hands out made up memory handles and counts them
+static uint64_t nextMemory = 0;
+static std::map<VkDeviceMemory, VkDeviceSize> allocatedMemory;
+
+static VKAPI_ATTR VkResult VKAPI_CALL fake_AllocateMemory(VkDevice, const VkMemoryAllocateInfo* info, const VkAllocationCallbacks*, VkDeviceMemory* memory)
+{
+	*memory = (VkDeviceMemory)(uintptr_t)++nextMemory;
+	allocatedMemory[*memory] = info->allocationSize;
+	return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL fake_FreeMemory(VkDevice, VkDeviceMemory memory, const VkAllocationCallbacks*)
+{
+	allocatedMemory.erase(memory);
+}
+
+static void test_gpu_allocator()
+{
+	// dispatchable handles point at the loader's data, which is what the dispatch tables are keyed by
+	static void* loaderData = nullptr;
+	VkDevice device = reinterpret_cast<VkDevice>(&loaderData);
+	device_dispatch[GetKey(device)].AllocateMemory = fake_AllocateMemory;
+	device_dispatch[GetKey(device)].FreeMemory = fake_FreeMemory;
+	VkPhysicalDeviceMemoryProperties& memory = deviceInfos[device].memory;
+	memory = {};
+	memory.memoryTypeCount = 1;
+	memory.memoryTypes[0] = {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0};
+	memory.memoryHeapCount = 1;
+	memory.memoryHeaps[0] = {VkDeviceSize{1} << 30, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT};
+
+	const VkDeviceSize blockSize = 1 << 20;
+	{
+		gpu_allocator allocator(device, blockSize);
+
+		gpu_allocation buffer1 = allocator.allocateOfType({1000, 256, 1}, 0, true);
+		gpu_allocation buffer2 = allocator.allocateOfType({1000, 256, 1}, 0, true);
+		check(buffer1.memory == buffer2.memory && buffer2.offset % 256 == 0 && buffer2.offset >= buffer1.offset + buffer1.size,
+			"small buffers share a block");
+		check(allocatedMemory.size() == 1 && allocatedMemory[buffer1.memory] == blockSize, "a shared block has the block size");
+
+		gpu_allocation image = allocator.allocateOfType({1000, 256, 1}, 0, false);
+		check(image.memory != buffer1.memory, "images and buffers never share a block");
+
+		gpu_allocation big = allocator.allocateOfType({blockSize / 2 + 1, 256, 1}, 0, true);
+		check(big.memory != buffer1.memory && big.offset == 0 && allocatedMemory[big.memory] == blockSize / 2 + 1,
+			"allocations bigger than half a block get a block of their own");
+		allocator.free(big);
+		check(!allocatedMemory.contains(big.memory), "a dedicated block is freed with its allocation");
+
+		allocator.free(buffer1);
+		allocator.free(buffer2);
+		check(allocatedMemory.contains(buffer1.memory), "one empty block per kind is kept around");
+		gpu_allocation again = allocator.allocateOfType({1000, 256, 1}, 0, true);
+		check(again.memory == buffer1.memory && again.offset == 0, "the kept block is reused and merged back into one range");
+		allocator.free(again);
+		allocator.free(image);
+	}
+	check(allocatedMemory.empty(), "the allocator frees its blocks");
+}
+
+int main()
+{
+	test_coalescing();
+	test_best_fit();
+	test_alignment();
+	test_gpu_allocator();
+	if(failures > 0)
+		return 1;
+	std::cout << "range and GPU allocators behave" << std::endl;
+	return 0;
+}
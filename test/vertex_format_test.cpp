@@ -0,0 +1,83 @@
+#include "mesh_cache.hpp"
+#include "vertex_format.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+// a torus has normals pointing everywhere and positions far from the origin
+MeshData make_torus(int rings, int sides, float major, float minor)
+{
+	const float pi = 3.14159265358979f;
+	MeshData mesh;
+	for(int i=0; i<=rings; i++)
+	{
+		for(int j=0; j<=sides; j++)
+		{
+			float u = 2*pi*i/rings, v = 2*pi*j/sides;
+			glm::vec3 normal(std::cos(u)*std::cos(v), std::sin(v), std::sin(u)*std::cos(v));
+			glm::vec3 center(major*std::cos(u), 0.0f, major*std::sin(u));
+			mesh.vertices.push_back({center + minor*normal + glm::vec3(100.0f, -20.0f, 5.0f), normal,
+				glm::vec2(4.0f*i/rings, 2.0f*j/sides)});
+		}
+	}
+	for(int i=0; i<rings; i++)
+	{
+		for(int j=0; j<sides; j++)
+		{
+			uint32_t a = i*(sides+1)+j, b = a+sides+1;
+			mesh.indices.insert(mesh.indices.end(), {a, b, a+1, a+1, b, b+1});
+		}
+	}
+	return mesh;
+}
+
+int main()
+{
+	MeshData mesh = make_torus(250, 120, 3.0f, 1.0f);
+
+	cook_options options;
+	options.optimize = false;
+	cooked_mesh reference = cooked_mesh::cook(mesh, 0, options);
+	options.vertexFormat = VertexFormat::Quantized;
+	cooked_mesh quantized = cooked_mesh::cook(mesh, 0, options);
+
+	auto vertices = reference.vertices();
+	auto packed = quantized.vertexData();
+	VertexDequantization dequantization = quantized.dequantization();
+	MeshBounds bounds = quantized.bounds();
+	glm::vec3 extent = bounds.max - bounds.min;
+
+	float positionError = 0.0f, normalError = 0.0f, texCoordError = 0.0f;
+	for(size_t i=0; i<vertices.size(); i++)
+	{
+		PackedVertex p;
+		std::memcpy(&p, packed.data() + i*sizeof(PackedVertex), sizeof(PackedVertex));
+		Vertex v = unpack_vertex(p, dequantization);
+		const Vertex& r = vertices[i];
+
+		for(int k=0; k<3; k++)
+			positionError = std::max(positionError, std::abs(v.position[k] - r.position[k]) / extent[k]);
+		float cosine = std::clamp(glm::dot(v.normal, glm::normalize(r.normal)), -1.0f, 1.0f);
+		normalError = std::max(normalError, std::acos(cosine) * 180.0f / 3.14159265358979f);
+		for(int k=0; k<2; k++)
+			texCoordError = std::max(texCoordError, std::abs(v.texCoord[k] - r.texCoord[k]) / std::max(std::abs(r.texCoord[k]), 1.0f));
+	}
+
+	std::cout << vertices.size() << " vertices, " << reference.vertexData().size() << " -> " << packed.size() << " bytes" << std::endl;
+	std::cout << "position error: " << positionError << " of the extent" << std::endl;
+	std::cout << "normal error:   " << normalError << " degrees" << std::endl;
+	std::cout << "uv error:       " << texCoordError << " relative" << std::endl;
+
+	// half a unorm16 step, about two snorm16 steps on the octahedron, half a half-float ulp
+	if(positionError > 0.5f/65535.0f + 1e-6f || normalError > 0.05f || texCoordError > 1.0f/2048.0f ||
+		!std::equal(reference.indexData().begin(), reference.indexData().end(), quantized.indexData().begin(), quantized.indexData().end()))
+	{
+		std::cerr << "quantized vertices are less precise than expected" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,78 @@
+#include "companion.hpp"
+#include "mesh_cache.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+int main(int argc, char* argv[])
+{
+	bool force = false;
+	VertexFormat format = VertexFormat::Float;
+	std::string directory;
+	for(int i=1; i<argc; i++)
+	{
+		std::string arg = argv[i];
+		if(arg == "--force")
+			force = true;
+		else if(arg == "--quantize")
+			format = VertexFormat::Quantized;
+		else if(directory.empty())
+			directory = arg;
+		else
+		{
+			directory.clear();
+			break;
+		}
+	}
+	if(directory.empty())
+	{
+		std::cerr << "Usage: " << argv[0] << " [--force] [--quantize] <companions directory>" << std::endl;
+		std::cerr << "Prebuilds the mesh caches of every companion in the directory." << std::endl;
+		std::cerr << "Use --quantize for games with \"vertexFormat\": \"quantized\"." << std::endl;
+		return 2;
+	}
+
+	int failed = 0;
+	for(const auto& entry : fs::directory_iterator(directory))
+	{
+		fs::path config = entry.path() / "companion.json";
+		if(!entry.is_directory() || !fs::exists(config))
+			continue;
+
+		try
+		{
+			json json;
+			{
+				std::ifstream in(config);
+				in >> json;
+			}
+			companion c(json, entry.path().string());
+			c.setVertexFormat(format);
+			if(force)
+				std::remove(c.meshCacheFile().c_str());
+
+			bool stale;
+			cooked_mesh mesh = c.loadMesh(stale);
+			if(stale)
+				mesh.write(c.meshCacheFile());
+
+			std::cout << "[" << c.id() << "] " << (stale ? "cooked " : "up to date ") << c.meshCacheFile()
+				<< " (" << mesh.vertexCount() << " vertices, " << mesh.indexCount() << " indices, "
+				<< mesh.submeshes().size() << " submeshes, " << mesh.lods().size() << " levels of detail, ACMR " << mesh.acmrBefore() << " -> " << mesh.acmrAfter() << ")" << std::endl;
+		}
+		catch(const std::exception& ex)
+		{
+			std::cerr << entry.path().filename().string() << ": " << ex.what() << std::endl;
+			failed++;
+		}
+	}
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+#include "asset_bundle.hpp"
+#include "companion.hpp"
+#include "mesh_cache.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+namespace fs = std::filesystem;
+
+int main(int argc, char* argv[])
+{
+	VertexFormat format = VertexFormat::Float;
+	std::string directory;
+	std::string output;
+	for(int i=1; i<argc; i++)
+	{
+		std::string arg = argv[i];
+		if(arg == "--quantize")
+			format = VertexFormat::Quantized;
+		else if(directory.empty())
+			directory = arg;
+		else if(output.empty())
+			output = arg;
+		else
+		{
+			directory.clear();
+			break;
+		}
+	}
+	if(directory.empty() || output.empty())
+	{
+		std::cerr << "Usage: " << argv[0] << " [--quantize] <companions directory> <bundle>" << std::endl;
+		std::cerr << "Packs the manifests, cooked meshes and textures of every companion in the directory into one bundle." << std::endl;
+		std::cerr << "Put it next to the companions directory as companions.bundle to have it used instead of the directory." << std::endl;
+		std::cerr << "Use --quantize for games with \"vertexFormat\": \"quantized\"." << std::endl;
+		return 2;
+	}
+
+	bundle_writer writer;
+	int failed = 0;
+	int packed = 0;
+	for(const auto& entry : fs::directory_iterator(directory))
+	{
+		fs::path config = entry.path() / "companion.json";
+		if(!entry.is_directory() || !fs::exists(config))
+			continue;
+
+		std::string name = entry.path().filename().string();
+		try
+		{
+			std::string manifest;
+			{
+				std::ifstream in(config);
+				manifest.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+			}
+			json json = json::parse(manifest);
+			companion c(json, entry.path().string());
+			c.setVertexFormat(format);
+
+			// reuses the mesh cache if it is up to date
+			bool stale;
+			cooked_mesh mesh = c.loadMesh(stale);
+			TextureData texture = c.loadTexture();
+
+			writer.addManifest(name, manifest);
+			writer.add(name, BundleEntry::Mesh, mesh.bytes());
+			if(!texture.levels.empty())
+				writer.addTexture(name, texture);
+			packed++;
+
+			std::cout << "[" << c.id() << "] packed " << name << " (" << mesh.vertexCount() << " vertices, "
+				<< texture.levels.size() << " texture levels)" << std::endl;
+		}
+		catch(const std::exception& ex)
+		{
+			std::cerr << name << ": " << ex.what() << std::endl;
+			failed++;
+		}
+	}
+
+	try
+	{
+		writer.write(output);
+		std::cout << "Wrote " << packed << " companions to " << output << std::endl;
+	}
+	catch(const std::exception& ex)
+	{
+		std::cerr << ex.what() << std::endl;
+		return 1;
+	}
+	return failed > 0 ? 1 : 0;
+}